@@ -1,6 +1,8 @@
 #include "gy_neo6mv2.h"
 #include "driver/uart.h"
 #include "esp_log.h"
+#include "nvs.h"
+#include "trace.h"
 #include <charconv>
 #include <cstdlib>
 #include <cstring>
@@ -10,6 +12,46 @@
 #include <string>
 #include <vector>
 
+static const char *AID_KEY = "aid";
+// AID-INI flags: position valid, position given as lat/lon/alt, altitude not valid
+static const uint32_t AID_INI_FLAG_POSITION = 0x01;
+static const uint32_t AID_INI_FLAG_LLA = 0x20;
+static const uint32_t AID_INI_FLAG_ALT_INVALID = 0x40;
+static const size_t AID_INI_POS_ACC_OFFSET = 12;
+static const size_t AID_INI_FLAGS_OFFSET = 44;
+// The vehicle may have moved a little while powered off
+static const uint32_t AID_INI_MIN_POS_ACC_CM = 100000;
+
+static uint32_t read_le32(const uint8_t *data) {
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void write_le32(uint8_t *data, uint32_t value) {
+    data[0] = value;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+// Keeps the per-satellite AID-EPH/AID-ALM payload, returns true if the stored copy changed
+static bool store_satellite(uint8_t *slots, uint32_t &valid, uint16_t slot_len, const UBX_message &message) {
+    if (message.len < 4) return false;
+    uint32_t svid = read_le32(message.payload);
+    if (svid < 1 || svid > GPS_aid::SATELLITES) return false;
+    uint32_t bit = 1u << (svid - 1);
+    uint8_t *slot = slots + (svid - 1) * slot_len;
+    if (message.len != slot_len) {
+        // The receiver holds nothing for this satellite any more, the saved copy has expired
+        if (!(valid & bit)) return false;
+        valid &= ~bit;
+        return true;
+    }
+    if ((valid & bit) && memcmp(slot, message.payload, slot_len) == 0) return false;
+    memcpy(slot, message.payload, slot_len);
+    valid |= bit;
+    return true;
+}
+
 GY_NEO6MV2::GY_NEO6MV2() {
 }
 
@@ -54,6 +96,106 @@ void GY_NEO6MV2::send_command(uint8_t *cmd, size_t len) {
     }
 }
 
+void GY_NEO6MV2::send_ubx(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len) {
+    uint8_t frame[READ_BUFFER_LEN];
+    size_t frame_len = UBX::encode(frame, sizeof(frame), cls, id, payload, len);
+    if (frame_len == 0) {
+        ESP_LOGE(TAG, "UBX message %02X %02X too long: %u", cls, id, len);
+        return;
+    }
+    uart_write_bytes(this->uart_num, (const char *)frame, frame_len);
+}
+
+// Injects the position first, the receiver uses it to pick the satellites to search for. The saved time
+// is stale after a power cycle, so only the position is kept from AID-INI; the receiver takes the time
+// from the first satellite it tracks and checks the age of the ephemerides itself. At 9600 baud the
+// full set takes about 5 s to send, which is why this runs from the GPS task rather than at boot.
+esp_err_t GY_NEO6MV2::restore_aid() {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(AID_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) return err;
+    size_t len = sizeof(aid);
+    err = nvs_get_blob(handle, AID_KEY, &aid, &len);
+    nvs_close(handle);
+    if (err == ESP_OK && len != sizeof(aid)) err = ESP_ERR_INVALID_SIZE;
+    if (err != ESP_OK) {
+        aid = {};
+        return err;
+    }
+
+    if (aid.has_ini) {
+        uint8_t ini[GPS_aid::INI_LEN];
+        memcpy(ini, aid.ini, sizeof(ini));
+        uint32_t flags = read_le32(ini + AID_INI_FLAGS_OFFSET);
+        write_le32(ini + AID_INI_FLAGS_OFFSET, flags & (AID_INI_FLAG_POSITION | AID_INI_FLAG_LLA |
+                                                        AID_INI_FLAG_ALT_INVALID));
+        if (read_le32(ini + AID_INI_POS_ACC_OFFSET) < AID_INI_MIN_POS_ACC_CM) {
+            write_le32(ini + AID_INI_POS_ACC_OFFSET, AID_INI_MIN_POS_ACC_CM);
+        }
+        send_ubx(UBX::CLASS_AID, UBX::ID_AID_INI, ini, sizeof(ini));
+    }
+    for (int sv = 0; sv < GPS_aid::SATELLITES; sv++) {
+        if (aid.eph_valid & (1u << sv)) send_ubx(UBX::CLASS_AID, UBX::ID_AID_EPH, aid.eph[sv], GPS_aid::EPH_LEN);
+    }
+    for (int sv = 0; sv < GPS_aid::SATELLITES; sv++) {
+        if (aid.alm_valid & (1u << sv)) send_ubx(UBX::CLASS_AID, UBX::ID_AID_ALM, aid.alm[sv], GPS_aid::ALM_LEN);
+    }
+    aid_injected = true;
+    int eph_count = __builtin_popcount(aid.eph_valid);
+    int alm_count = __builtin_popcount(aid.alm_valid);
+    TRACE_I(TRACE_GPS_AID_INJECTED, aid.has_ini, eph_count, alm_count);
+    ESP_LOGI(TAG, "Injected aiding data: position %s, %d ephemerides, %d almanacs", aid.has_ini ? "yes" : "no",
+             eph_count, alm_count);
+    return ESP_OK;
+}
+
+void GY_NEO6MV2::request_aid() {
+    // An empty AID message is a poll, AID-EPH and AID-ALM are answered with one message per satellite
+    send_ubx(UBX::CLASS_AID, UBX::ID_AID_INI, NULL, 0);
+    send_ubx(UBX::CLASS_AID, UBX::ID_AID_EPH, NULL, 0);
+    send_ubx(UBX::CLASS_AID, UBX::ID_AID_ALM, NULL, 0);
+}
+
+// A blob write stalls both cores while the flash cache is off, so nothing is written unless the
+// receiver reported new data
+esp_err_t GY_NEO6MV2::save_aid() {
+    if (!aid_dirty) return ESP_OK;
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(AID_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, AID_KEY, &aid, sizeof(aid));
+        if (err == ESP_OK) err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+    TRACE_I(TRACE_GPS_AID_SAVED, __builtin_popcount(aid.eph_valid), __builtin_popcount(aid.alm_valid), err);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save aiding data: %s", esp_err_to_name(err));
+        return err;
+    }
+    aid_dirty = false;
+    return ESP_OK;
+}
+
+bool GY_NEO6MV2::get_aid_injected() {
+    return aid_injected;
+}
+
+void GY_NEO6MV2::handle_ubx(const UBX_message &message) {
+    if (message.cls != UBX::CLASS_AID) return;
+    if (message.id == UBX::ID_AID_INI) {
+        if (message.len != GPS_aid::INI_LEN) return;
+        if (!(read_le32(message.payload + AID_INI_FLAGS_OFFSET) & AID_INI_FLAG_POSITION)) return;
+        if (aid.has_ini && memcmp(aid.ini, message.payload, GPS_aid::INI_LEN) == 0) return;
+        memcpy(aid.ini, message.payload, GPS_aid::INI_LEN);
+        aid.has_ini = true;
+        aid_dirty = true;
+    } else if (message.id == UBX::ID_AID_EPH) {
+        aid_dirty |= store_satellite(&aid.eph[0][0], aid.eph_valid, GPS_aid::EPH_LEN, message);
+    } else if (message.id == UBX::ID_AID_ALM) {
+        aid_dirty |= store_satellite(&aid.alm[0][0], aid.alm_valid, GPS_aid::ALM_LEN, message);
+    }
+}
+
 int GY_NEO6MV2::hex_string_to_bytes(const char *hex_string, uint8_t *bytes) {
     int len = strlen(hex_string);
     if (len % 2 != 0) return -1; // Invalid hex string
@@ -72,8 +214,9 @@ int GY_NEO6MV2::bytes_array_to_hex_string(uint8_t *bytes, int len, char *hex_str
     return len * 2;
 }
 
-uint8_t GY_NEO6MV2::obtain_payload(uint8_t *buffer, int len) {
-    uint8_t pos = 0;
+// Returns the message length, or 0 for a message that does not fit in `buffer`
+int GY_NEO6MV2::obtain_payload(uint8_t *buffer, int len) {
+    int pos = 0;
     while (true) {
         uart_read_bytes(this->uart_num, buffer + pos, 1, portMAX_DELAY);
         if (buffer[pos] == '$') {
@@ -95,11 +238,15 @@ uint8_t GY_NEO6MV2::obtain_payload(uint8_t *buffer, int len) {
                 buffer[pos] = '\0';
                 break;
             }
+            // No line end in sight, drop the sentence and resync on the next one
+            if (pos >= len - 1) return 0;
         }
     } else {
         uart_read_bytes(this->uart_num, buffer + pos, 4, portMAX_DELAY);
         pos += 4;
         uint16_t payload_len = buffer[5] << 8 | buffer[4];
+        // Not a message we handle, or a corrupt length; the sync search skips whatever follows
+        if (pos + payload_len + 2 > len) return 0;
         uart_read_bytes(this->uart_num, buffer + pos, payload_len + 2, portMAX_DELAY);
         pos += payload_len + 2;
     }
@@ -118,19 +265,24 @@ double parseCoordinate(const std::string &raw, char direction) {
 }
 
 GY_NEO6MV2_data GY_NEO6MV2::read() {
-    uint8_t buffer[100];
+    uint8_t buffer[READ_BUFFER_LEN];
     GY_NEO6MV2_data data;
     while (true) {
-        obtain_payload(buffer, sizeof(buffer));
-        if (strncmp((const char *)buffer, "$GPGLL", 6) == 0) {
-            ESP_LOGD(TAG, "Received: %s", buffer);
-        } else {
-            uint8_t str[100];
-            bytes_array_to_hex_string(buffer, strlen((const char *)buffer), (char *)str);
-            ESP_LOGD(TAG, "Received: %s", str);
+        int len = obtain_payload(buffer, sizeof(buffer));
+        if (len == 0) continue;
+        // Record bytes 2..5 (NMEA talker+sentence ID, or UBX class/id/length) instead of hex-formatting every payload
+        TRACE_D(TRACE_GPS_SENTENCE, buffer[2] << 24 | buffer[3] << 16 | buffer[4] << 8 | buffer[5], len);
+        UBX_message message;
+        if (buffer[0] == 0xB5 && UBX::decode(buffer, len, message)) {
+            handle_ubx(message);
+            continue;
         }
         if (strncmp((const char *)buffer, "$GPGLL", 6) == 0) {
             data = parse_GPGLL((const char *)buffer);
+            if (data.position.latitude.has_value() && data.position.longitude.has_value()) {
+                TRACE_I(TRACE_GPS_FIX, (int32_t)(data.position.latitude.value() * 1e7),
+                        (int32_t)(data.position.longitude.value() * 1e7));
+            }
             break;
         }
     }
@@ -242,14 +394,14 @@ int add_checksum(uint8_t *data, int len) {
     return len + 2;
 }
 
-bool verify_checksum(uint8_t *data, int len) {
-    if (len < 8) return -1; // Invalid UBX message
-    uint8_t checksum = calculate_checksum(data, len - 2);
-    uint8_t actual_checksum = data[len - 2] << 8 | data[len - 1];
+bool verify_checksum(const uint8_t *data, int len) {
+    if (len < 8) return false; // Invalid UBX message
+    uint16_t checksum = calculate_checksum(data, len - 2);
+    uint16_t actual_checksum = data[len - 2] << 8 | data[len - 1];
     return checksum == actual_checksum;
 }
 
-uint16_t calculate_checksum(uint8_t *data, int len) {
+uint16_t calculate_checksum(const uint8_t *data, int len) {
     uint8_t a = 0, b = 0;
     for (int i = 2; i < len; i++) {
         a += data[i];
@@ -257,6 +409,29 @@ uint16_t calculate_checksum(uint8_t *data, int len) {
     }
     return (uint16_t)a << 8 | b;
 }
+
+size_t encode(uint8_t *out, size_t out_len, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len) {
+    if (out_len < len + FRAME_OVERHEAD) return 0;
+    out[0] = 0xB5;
+    out[1] = 0x62;
+    out[2] = cls;
+    out[3] = id;
+    out[4] = len & 0xFF;
+    out[5] = len >> 8;
+    if (len > 0) memcpy(out + 6, payload, len);
+    return add_checksum(out, len + 6);
+}
+
+bool decode(const uint8_t *frame, size_t len, UBX_message &message) {
+    if (len < FRAME_OVERHEAD || frame[0] != 0xB5 || frame[1] != 0x62) return false;
+    uint16_t payload_len = frame[5] << 8 | frame[4];
+    if (len != payload_len + FRAME_OVERHEAD || !verify_checksum(frame, len)) return false;
+    message.cls = frame[2];
+    message.id = frame[3];
+    message.payload = frame + 6;
+    message.len = payload_len;
+    return true;
+}
 } // namespace UBX
 
 std::vector<std::string> GY_NEO6MV2::split(const std::string &s, char delimiter) {
@@ -1,5 +1,6 @@
 #pragma once
 #include "driver/uart.h"
+#include "esp_err.h"
 #include <optional>
 #include <string>
 #include <vector>
@@ -16,13 +17,42 @@ struct GY_NEO6MV2_data {
     } time;
 };
 
+struct UBX_message {
+    uint8_t cls;
+    uint8_t id;
+    const uint8_t *payload;
+    uint16_t len;
+};
+
+// Aiding data for a hot start, polled from the receiver and written back after a power cycle. AID-EPH and
+// AID-ALM are kept per satellite; a short payload from the receiver means it holds no data for that one.
+struct GPS_aid {
+    static const int SATELLITES = 32;
+    static const uint16_t INI_LEN = 48;
+    static const uint16_t EPH_LEN = 104;
+    static const uint16_t ALM_LEN = 40;
+    uint8_t ini[INI_LEN];
+    bool has_ini;
+    uint32_t eph_valid; // bit n set when eph[n] holds SV n + 1
+    uint8_t eph[SATELLITES][EPH_LEN];
+    uint32_t alm_valid;
+    uint8_t alm[SATELLITES][ALM_LEN];
+};
+
 class GY_NEO6MV2 {
   private:
     const char *TAG = "GY_NEO6MV2";
     uart_port_t uart_num;
+    // Large enough for AID-EPH, the longest message polled
+    static const size_t READ_BUFFER_LEN = 128;
+    static constexpr const char *AID_NAMESPACE = "gps_aid";
+    GPS_aid aid = {};
+    bool aid_dirty = false;
+    bool aid_injected = false;
+    void handle_ubx(const UBX_message &message);
     int hex_string_to_bytes(const char *hex_string, uint8_t *bytes);
     double parseCoordinate(const char *coordStr);
-    uint8_t obtain_payload(uint8_t *buffer, int len);
+    int obtain_payload(uint8_t *buffer, int len);
     GY_NEO6MV2_data parse_GPGLL(const char *buffer);
     static std::vector<std::string> split(const std::string &s, char delimiter);
 
@@ -32,6 +62,14 @@ class GY_NEO6MV2 {
     void init(uart_port_t uart_num);
     GY_NEO6MV2_data read();
     void send_command(uint8_t *cmd, size_t len);
+    void send_ubx(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len);
+    // Loads the aiding data saved by save_aid() and sends it to the receiver, expects NVS to be initialised
+    esp_err_t restore_aid();
+    // Polls AID-INI, AID-EPH and AID-ALM, the answers are picked up by read()
+    void request_aid();
+    // Writes the aiding data to NVS if it changed since the last save
+    esp_err_t save_aid();
+    bool get_aid_injected();
 };
 
 namespace NMEA {
@@ -41,7 +79,18 @@ uint8_t calculate_checksum(uint8_t *data, int len);
 } // namespace NMEA
 
 namespace UBX {
+static const uint8_t CLASS_AID = 0x0B;
+static const uint8_t ID_AID_INI = 0x01;
+static const uint8_t ID_AID_ALM = 0x30;
+static const uint8_t ID_AID_EPH = 0x31;
+// Sync, class, id, length and checksum around the payload
+static const size_t FRAME_OVERHEAD = 8;
+
 int add_checksum(uint8_t *data, int len);
-bool verify_checksum(uint8_t *data, int len);
-uint16_t calculate_checksum(uint8_t *data, int len);
+bool verify_checksum(const uint8_t *data, int len);
+uint16_t calculate_checksum(const uint8_t *data, int len);
+// Frames a message into `out`, returns its length or 0 if it does not fit in `out_len`
+size_t encode(uint8_t *out, size_t out_len, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len);
+// Checks the sync, length and checksum of a frame, `message.payload` points into `frame`
+bool decode(const uint8_t *frame, size_t len, UBX_message &message);
 } // namespace UBX
\ No newline at end of file
@@ -1,8 +1,28 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "driver/i2c_master.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Length of the accelerometer/temperature/gyroscope register burst starting at ACCEL_XOUT_H
+static const uint8_t MPU6050_RAW_DATA_LEN = 14;
+
+// Channel mask, one bit per 16-bit word of the burst in register order
+static const uint8_t MPU6050_CHANNEL_ACCEL_X = 0x01;
+static const uint8_t MPU6050_CHANNEL_ACCEL_Y = 0x02;
+static const uint8_t MPU6050_CHANNEL_ACCEL_Z = 0x04;
+static const uint8_t MPU6050_CHANNEL_TEMPERATURE = 0x08;
+static const uint8_t MPU6050_CHANNEL_GYRO_X = 0x10;
+static const uint8_t MPU6050_CHANNEL_GYRO_Y = 0x20;
+static const uint8_t MPU6050_CHANNEL_GYRO_Z = 0x40;
+static const uint8_t MPU6050_CHANNEL_ACCEL = 0x07;
+static const uint8_t MPU6050_CHANNEL_GYRO = 0x70;
+static const uint8_t MPU6050_CHANNEL_ALL = 0x7F;
+static const int MPU6050_CHANNEL_COUNT = 7;
 
 struct MPU6050_data {
     struct accelerometer {
@@ -15,6 +35,7 @@ struct MPU6050_data {
         float y;
         float z;
     } gyroscope;
+    float temperature; // degrees Celsius
 
     MPU6050_data operator-(const MPU6050_data &other) {
         MPU6050_data result;
@@ -24,32 +45,74 @@ struct MPU6050_data {
         result.gyroscope.x = gyroscope.x - other.gyroscope.x;
         result.gyroscope.y = gyroscope.y - other.gyroscope.y;
         result.gyroscope.z = gyroscope.z - other.gyroscope.z;
+        result.temperature = temperature - other.temperature;
         return result;
     }
 };
 
+struct MPU6050_fixed_data;
+
 class MPU6050 {
   private:
     const char *TAG = "MPU6050";
+    i2c_master_bus_handle_t bus_handle;
     i2c_master_dev_handle_t dev_handle;
+    i2c_device_config_t dev_config;
     uint8_t acceleration_scale_range;
     float acceleration_scale_factor;
     uint8_t gyro_scale_range;
     float gyro_scale_factor;
+    // Asynchronous transfers need the bus to be created with a non-zero trans_queue_depth
+    bool async = false;
+    SemaphoreHandle_t transfer_done = NULL;
+    volatile esp_err_t transfer_result = ESP_OK;
+    // Only the words from the first to the last enabled channel are read
+    uint8_t channels = MPU6050_CHANNEL_ALL;
+    uint8_t burst_offset = 0;
+    uint8_t burst_len = MPU6050_RAW_DATA_LEN;
+    // Buffers of an in-flight burst read must outlive start_read()
+    uint8_t burst_reg;
+    uint8_t burst_data[MPU6050_RAW_DATA_LEN] = {};
+    esp_err_t burst_result = ESP_OK;
+    bool burst_pending = false;
+    // Register accesses in async mode go through here, a transfer the driver never settles must not write
+    // into the caller's stack
+    static const size_t TRANSFER_LEN = 32;
+    uint8_t transfer_data[TRANSFER_LEN] = {};
+    uint32_t fault_count = 0;
     uint8_t _get_acceleration_scale_range();
     uint8_t _get_gyro_scale_range();
     void _set_acceleration_scale_range(uint8_t range);
     void _set_gyro_scale_range(uint8_t range);
+    esp_err_t add_device();
+    esp_err_t transfer(const uint8_t *write_data, size_t write_len, uint8_t *read_data, size_t read_len);
+    esp_err_t wait_done(uint32_t timeout_ms);
+    esp_err_t abandon_transfers();
+    static bool on_transfer_done(i2c_master_dev_handle_t dev, const i2c_master_event_data_t *event_data, void *arg);
 
   public:
     MPU6050();
-    void init(i2c_master_bus_handle_t &bus_handle);
-    void raw_read(uint8_t reg_addr, uint8_t *data, uint8_t len);
-    void raw_write(uint8_t reg_addr, uint8_t &data, uint8_t len);
+    void init(i2c_master_bus_handle_t &bus_handle, bool async = false);
+    esp_err_t raw_read(uint8_t reg_addr, uint8_t *data, uint8_t len);
+    esp_err_t raw_write(uint8_t reg_addr, uint8_t &data, uint8_t len);
     MPU6050_data read();
-    void reset();
+    esp_err_t read_raw(uint8_t *raw_data);
+    esp_err_t start_read();
+    esp_err_t finish_read(uint8_t *raw_data, uint32_t timeout_ms);
+    esp_err_t recover();
+    uint32_t get_fault_count();
+    MPU6050_data convert(const uint8_t *raw_data);
+    void convert_batch(const uint8_t *raw_data, size_t stride, size_t count, MPU6050_data *out);
+    void convert_batch_fixed(const uint8_t *raw_data, size_t stride, size_t count, MPU6050_fixed_data *out);
+    esp_err_t reset();
     uint8_t get_acceleration_scale_range();
     uint8_t get_gyro_scale_range();
-    void set_acceleration_scale_range(uint8_t range);
-    void set_gyro_scale_range(uint8_t range);
+    esp_err_t set_acceleration_scale_range(uint8_t range);
+    esp_err_t set_gyro_scale_range(uint8_t range);
+    esp_err_t set_channels(uint8_t channels);
+    uint8_t get_channels();
+    uint8_t get_burst_len();
+    static const char *channel_name(int channel);
+    static size_t pack_channels(uint8_t channels, const uint8_t *raw_data, uint8_t *out);
+    static void channel_values(const MPU6050_data &data, float values[MPU6050_CHANNEL_COUNT]);
 };
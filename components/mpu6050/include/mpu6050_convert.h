@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mpu6050.h"
+
+// Batch raw-to-physical conversion kernels.
+// The accel/gyro ranges are template parameters so every scale constant is folded at compile time
+// and each axis costs one multiply instead of a division. Use MPU6050::convert_batch() for runtime
+// dispatch over the ranges currently configured on the device.
+
+// Fixed-point sample, values are in Q(31-FRAC_BITS).FRAC_BITS: m/s^2 for the accelerometer, deg/s for the
+// gyroscope, degrees Celsius for the temperature
+struct MPU6050_fixed_data {
+    int32_t accelerometer[3];
+    int32_t gyroscope[3];
+    int32_t temperature;
+};
+
+namespace MPU6050Convert {
+static constexpr float EARTH_GRAVITY = 9.80665f;
+static constexpr int FRAC_BITS = 16;
+static constexpr float TEMPERATURE_LSB_PER_DEGREE = 340.0f;
+static constexpr float TEMPERATURE_OFFSET = 36.53f;
+
+constexpr float accel_lsb_per_g(uint8_t range) {
+    return 2048.0f * (1 << (3 - range));
+}
+
+constexpr float gyro_lsb_per_dps(uint8_t range) {
+    return 16.4f * (1 << (3 - range));
+}
+
+inline int16_t be16(const uint8_t *bytes) {
+    return (int16_t)(bytes[0] << 8 | bytes[1]);
+}
+
+// `raw` points to the first 14-byte register burst, consecutive bursts are `stride` bytes apart
+template <uint8_t AccelRange, uint8_t GyroRange>
+void convert_batch(const uint8_t *raw, size_t stride, size_t count, MPU6050_data *out) {
+    static_assert(AccelRange <= 3 && GyroRange <= 3, "MPU6050 ranges are 0..3");
+    constexpr float accel_scale = EARTH_GRAVITY / accel_lsb_per_g(AccelRange);
+    constexpr float gyro_scale = 1.0f / gyro_lsb_per_dps(GyroRange);
+    for (size_t i = 0; i < count; i++, raw += stride) {
+        out[i].accelerometer.x = be16(raw + 0) * accel_scale;
+        out[i].accelerometer.y = be16(raw + 2) * accel_scale;
+        out[i].accelerometer.z = be16(raw + 4) * accel_scale;
+        out[i].gyroscope.x = be16(raw + 8) * gyro_scale;
+        out[i].gyroscope.y = be16(raw + 10) * gyro_scale;
+        out[i].gyroscope.z = be16(raw + 12) * gyro_scale;
+        out[i].temperature = be16(raw + 6) * (1.0f / TEMPERATURE_LSB_PER_DEGREE) + TEMPERATURE_OFFSET;
+    }
+}
+
+// Same as convert_batch but produces Q-format output using a Q32 multiplier and integer arithmetic only
+template <uint8_t AccelRange, uint8_t GyroRange>
+void convert_batch_fixed(const uint8_t *raw, size_t stride, size_t count, MPU6050_fixed_data *out) {
+    static_assert(AccelRange <= 3 && GyroRange <= 3, "MPU6050 ranges are 0..3");
+    constexpr int64_t accel_mul = (int64_t)(EARTH_GRAVITY / accel_lsb_per_g(AccelRange) * 4294967296.0 + 0.5);
+    constexpr int64_t gyro_mul = (int64_t)(1.0 / gyro_lsb_per_dps(GyroRange) * 4294967296.0 + 0.5);
+    constexpr int64_t temperature_mul = (int64_t)(1.0 / TEMPERATURE_LSB_PER_DEGREE * 4294967296.0 + 0.5);
+    constexpr int32_t temperature_offset = (int32_t)(TEMPERATURE_OFFSET * (1 << FRAC_BITS) + 0.5f);
+    constexpr int SHIFT = 32 - FRAC_BITS;
+    for (size_t i = 0; i < count; i++, raw += stride) {
+        out[i].accelerometer[0] = (int32_t)((be16(raw + 0) * accel_mul) >> SHIFT);
+        out[i].accelerometer[1] = (int32_t)((be16(raw + 2) * accel_mul) >> SHIFT);
+        out[i].accelerometer[2] = (int32_t)((be16(raw + 4) * accel_mul) >> SHIFT);
+        out[i].gyroscope[0] = (int32_t)((be16(raw + 8) * gyro_mul) >> SHIFT);
+        out[i].gyroscope[1] = (int32_t)((be16(raw + 10) * gyro_mul) >> SHIFT);
+        out[i].gyroscope[2] = (int32_t)((be16(raw + 12) * gyro_mul) >> SHIFT);
+        out[i].temperature = (int32_t)((be16(raw + 6) * temperature_mul) >> SHIFT) + temperature_offset;
+    }
+}
+
+typedef void (*batch_kernel_t)(const uint8_t *raw, size_t stride, size_t count, MPU6050_data *out);
+typedef void (*batch_fixed_kernel_t)(const uint8_t *raw, size_t stride, size_t count, MPU6050_fixed_data *out);
+
+// Kernel tables indexed by [accel_range][gyro_range]
+#define MPU6050_KERNEL_ROW(fn, a) {fn<a, 0>, fn<a, 1>, fn<a, 2>, fn<a, 3>}
+static constexpr batch_kernel_t batch_kernels[4][4] = {
+    MPU6050_KERNEL_ROW(convert_batch, 0),
+    MPU6050_KERNEL_ROW(convert_batch, 1),
+    MPU6050_KERNEL_ROW(convert_batch, 2),
+    MPU6050_KERNEL_ROW(convert_batch, 3),
+};
+static constexpr batch_fixed_kernel_t batch_fixed_kernels[4][4] = {
+    MPU6050_KERNEL_ROW(convert_batch_fixed, 0),
+    MPU6050_KERNEL_ROW(convert_batch_fixed, 1),
+    MPU6050_KERNEL_ROW(convert_batch_fixed, 2),
+    MPU6050_KERNEL_ROW(convert_batch_fixed, 3),
+};
+#undef MPU6050_KERNEL_ROW
+} // namespace MPU6050Convert
@@ -1,4 +1,5 @@
 #include "mpu6050.h"
+#include "mpu6050_convert.h"
 
 #include <string.h>
 
@@ -19,31 +20,196 @@ static const uint8_t MPU6050_GYRO_REG = 0x43;
 static const uint8_t MPU6050_GYRO_CONFIG = 0x1B;
 static const uint8_t MPU6050_ACCEL_CONFIG = 0x1C;
 static const uint8_t MPU6050_PWR_MGMT_1 = 0x6B;
+static const uint8_t MPU6050_PWR_MGMT_1_CLOCK_PLL_X = 0x01;
+static const uint8_t MPU6050_PWR_MGMT_1_TEMP_DIS = 0x08;
 static const uint8_t MPU6050_SIGNAL_PATH_RESET = 0x68;
 static const uint8_t MPU6050_USER_CTRL = 0x6A;
 static const float EARTH_GRAVITY = 9.80665f;
+static const float TEMPERATURE_LSB_PER_DEGREE = 340.0f;
+static const float TEMPERATURE_OFFSET = 36.53f;
+static const char *const CHANNEL_NAMES[MPU6050_CHANNEL_COUNT] = {"ax", "ay", "az", "temp", "gx", "gy", "gz"};
+static const int I2C_TIMEOUT_MS = 20;
 
 MPU6050::MPU6050() {
 }
 
-void MPU6050::init(i2c_master_bus_handle_t &bus_handle) {
-    i2c_device_config_t dev_cfg = {
+void MPU6050::init(i2c_master_bus_handle_t &bus_handle, bool async) {
+    this->bus_handle = bus_handle;
+    this->async = async;
+    dev_config = {
         .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-        .device_address = 0x68,
+        .device_address = MPU6050_ADDR,
         .scl_speed_hz = 400000,
         .scl_wait_us = 1000,
     };
-    ESP_ERROR_CHECK(i2c_master_bus_add_device(bus_handle, &dev_cfg, &dev_handle));
-    reset();
+    transfer_done = xSemaphoreCreateBinary();
+    ESP_ERROR_CHECK(add_device());
+    if (reset() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to reset device");
+    }
     get_acceleration_scale_range();
     get_gyro_scale_range();
+    // The reset value of PWR_MGMT_1 powers the temperature sensor down, bring it in line with the mask
+    set_channels(channels);
+}
+
+esp_err_t MPU6050::add_device() {
+    esp_err_t err = i2c_master_bus_add_device(bus_handle, &dev_config, &dev_handle);
+    if (err != ESP_OK || !async) return err;
+    i2c_master_event_callbacks_t callbacks = {
+        .on_trans_done = on_transfer_done,
+    };
+    return i2c_master_register_event_callbacks(dev_handle, &callbacks, this);
+}
+
+bool MPU6050::on_transfer_done(i2c_master_dev_handle_t dev, const i2c_master_event_data_t *event_data, void *arg) {
+    MPU6050 *self = (MPU6050 *)arg;
+    switch (event_data->event) {
+    case I2C_EVENT_DONE:
+        self->transfer_result = ESP_OK;
+        break;
+    case I2C_EVENT_NACK:
+        self->transfer_result = ESP_ERR_INVALID_RESPONSE;
+        break;
+    case I2C_EVENT_TIMEOUT:
+        self->transfer_result = ESP_ERR_TIMEOUT;
+        break;
+    default:
+        return false;
+    }
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(self->transfer_done, &woken);
+    return woken == pdTRUE;
+}
+
+esp_err_t MPU6050::wait_done(uint32_t timeout_ms) {
+    if (xSemaphoreTake(transfer_done, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return transfer_result;
+}
+
+// After a wait_done() timeout the driver still owns the transfer and its buffers, and its completion would
+// be taken for the next one. Waits for the bus to go idle; if it doesn't, the bus is reset, which aborts the
+// transfer, and its completion is awaited before the device handle is replaced. Removing a device does not
+// cancel its queued transfers, the driver would call back into the freed handle.
+esp_err_t MPU6050::abandon_transfers() {
+    esp_err_t err = i2c_master_bus_wait_all_done(bus_handle, I2C_TIMEOUT_MS);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Transfer still pending after %d ms, resetting the bus", I2C_TIMEOUT_MS);
+        err = i2c_master_bus_reset(bus_handle);
+        if (err == ESP_OK) err = i2c_master_bus_wait_all_done(bus_handle, I2C_TIMEOUT_MS);
+        if (err != ESP_OK) {
+            // Keep the handle, the transfer only writes into member buffers; the next recover() tries again
+            ESP_LOGE(TAG, "Transfer not cancelled: %s", esp_err_to_name(err));
+            return err;
+        }
+        i2c_master_bus_rm_device(dev_handle);
+        err = add_device();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to re-add device: %s", esp_err_to_name(err));
+        }
+    }
+    xSemaphoreTake(transfer_done, 0);
+    return err;
+}
+
+// Blocking transfer in both modes. In async mode the driver holds on to the buffers until completion, so
+// the data is staged in transfer_data, which outlives a transfer that times out.
+esp_err_t MPU6050::transfer(const uint8_t *write_data, size_t write_len, uint8_t *read_data, size_t read_len) {
+    if (!async) {
+        return read_len > 0
+                   ? i2c_master_transmit_receive(dev_handle, write_data, write_len, read_data, read_len, I2C_TIMEOUT_MS)
+                   : i2c_master_transmit(dev_handle, write_data, write_len, I2C_TIMEOUT_MS);
+    }
+    if (write_len + read_len > TRANSFER_LEN) return ESP_ERR_INVALID_SIZE;
+    // Drop a completion left over from a transfer that previously timed out
+    xSemaphoreTake(transfer_done, 0);
+    memcpy(transfer_data, write_data, write_len);
+    uint8_t *read_buffer = transfer_data + write_len;
+    esp_err_t err = read_len > 0 ? i2c_master_transmit_receive(dev_handle, transfer_data, write_len, read_buffer,
+                                                                read_len, I2C_TIMEOUT_MS)
+                                 : i2c_master_transmit(dev_handle, transfer_data, write_len, I2C_TIMEOUT_MS);
+    if (err == ESP_OK) err = wait_done(I2C_TIMEOUT_MS);
+    if (err == ESP_ERR_TIMEOUT) {
+        abandon_transfers();
+    } else if (err == ESP_OK && read_len > 0) {
+        memcpy(read_data, read_buffer, read_len);
+    }
+    return err;
 }
 
 MPU6050_data MPU6050::read() {
+    uint8_t raw_data[MPU6050_RAW_DATA_LEN];
+    read_raw(raw_data);
+    return convert(raw_data);
+}
+
+esp_err_t MPU6050::read_raw(uint8_t *raw_data) {
+    esp_err_t err = start_read();
+    if (err != ESP_OK) return err;
+    return finish_read(raw_data, I2C_TIMEOUT_MS);
+}
+
+// Queues the accel/temp/gyro burst read. In async mode this returns immediately so the caller can do other
+// work while the bus is busy; finish_read() collects the result.
+esp_err_t MPU6050::start_read() {
+    burst_reg = MPU6050_ACCEL_REG + burst_offset;
+    burst_pending = true;
+    if (async) {
+        xSemaphoreTake(transfer_done, 0);
+    }
+    burst_result = i2c_master_transmit_receive(dev_handle, &burst_reg, 1, burst_data + burst_offset, burst_len,
+                                               I2C_TIMEOUT_MS);
+    return burst_result;
+}
+
+// Waits for the read queued by start_read() and copies the full 14-byte layout. Words outside the enabled
+// channel range are zero. On error the contents of raw_data are undefined and the caller should flag the
+// sample and call recover().
+esp_err_t MPU6050::finish_read(uint8_t *raw_data, uint32_t timeout_ms) {
+    if (!burst_pending) return ESP_ERR_INVALID_STATE;
+    burst_pending = false;
+    esp_err_t err = burst_result;
+    if (err == ESP_OK && async) {
+        err = wait_done(timeout_ms);
+    }
+    if (err == ESP_OK) {
+        memcpy(raw_data, burst_data, MPU6050_RAW_DATA_LEN);
+    }
+    return err;
+}
+
+// Clears a stuck bus by clocking SCL until the slave releases SDA, then re-initialises the device and
+// restores the configured ranges
+esp_err_t MPU6050::recover() {
+    fault_count++;
+    burst_pending = false;
+    ESP_LOGW(TAG, "Recovering I2C bus, fault %lu", fault_count);
+    // A burst read that timed out may still write into burst_data, settle it before touching the bus
+    esp_err_t err = async ? abandon_transfers() : ESP_OK;
+    if (err != ESP_OK) return err;
+    err = i2c_master_bus_reset(bus_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Bus reset failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    err = reset();
+    if (err == ESP_OK) err = set_acceleration_scale_range(acceleration_scale_range);
+    if (err == ESP_OK) err = set_gyro_scale_range(gyro_scale_range);
+    if (err == ESP_OK) err = set_channels(channels);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Device re-init failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+uint32_t MPU6050::get_fault_count() {
+    return fault_count;
+}
+
+MPU6050_data MPU6050::convert(const uint8_t *raw_data) {
     MPU6050_data data;
-    uint8_t raw_data[14];
-    uint8_t reg_addr = MPU6050_ACCEL_REG;
-    i2c_master_transmit_receive(dev_handle, &reg_addr, 1, raw_data, 14, 1000);
     // Don't attempt to memcpy directly because ESP32 is little-endian
     int16_t accel_x = raw_data[0] << 8 | raw_data[1];
     int16_t accel_y = raw_data[2] << 8 | raw_data[3];
@@ -57,9 +223,19 @@ MPU6050_data MPU6050::read() {
     data.gyroscope.x = gyro_x / gyro_scale_factor;
     data.gyroscope.y = gyro_y / gyro_scale_factor;
     data.gyroscope.z = gyro_z / gyro_scale_factor;
+    int16_t temperature = raw_data[6] << 8 | raw_data[7];
+    data.temperature = temperature / TEMPERATURE_LSB_PER_DEGREE + TEMPERATURE_OFFSET;
     return data;
 }
 
+void MPU6050::convert_batch(const uint8_t *raw_data, size_t stride, size_t count, MPU6050_data *out) {
+    MPU6050Convert::batch_kernels[acceleration_scale_range & 3][gyro_scale_range & 3](raw_data, stride, count, out);
+}
+
+void MPU6050::convert_batch_fixed(const uint8_t *raw_data, size_t stride, size_t count, MPU6050_fixed_data *out) {
+    MPU6050Convert::batch_fixed_kernels[acceleration_scale_range & 3][gyro_scale_range & 3](raw_data, stride, count, out);
+}
+
 uint8_t MPU6050::get_acceleration_scale_range() {
     acceleration_scale_range = _get_acceleration_scale_range();
     acceleration_scale_factor = 2048.0f * (1 << (3 - acceleration_scale_range));
@@ -67,64 +243,125 @@ uint8_t MPU6050::get_acceleration_scale_range() {
 }
 
 uint8_t MPU6050::_get_acceleration_scale_range() {
-    uint8_t data;
+    uint8_t data = 0;
     uint8_t reg_addr = MPU6050_ACCEL_CONFIG;
-    i2c_master_transmit_receive(dev_handle, &reg_addr, 1, &data, 1, 1000);
+    transfer(&reg_addr, 1, &data, 1);
     return (data & 0x18) >> 3;
 }
 
 uint8_t MPU6050::get_gyro_scale_range() {
-    uint8_t data;
+    uint8_t data = 0;
     uint8_t reg_addr = MPU6050_GYRO_CONFIG;
-    i2c_master_transmit_receive(dev_handle, &reg_addr, 1, &data, 1, 1000);
+    transfer(&reg_addr, 1, &data, 1);
     gyro_scale_range = (data & 0x18) >> 3;
     gyro_scale_factor = 16.4f * (1 << (3 - gyro_scale_range));
     return gyro_scale_range;
 }
 
-void MPU6050::set_acceleration_scale_range(uint8_t range) {
+esp_err_t MPU6050::set_acceleration_scale_range(uint8_t range) {
     uint8_t data[2] = {MPU6050_ACCEL_CONFIG, 0x00};
-    i2c_master_transmit_receive(dev_handle, data, 1, data + 1, 1, 1000);
+    esp_err_t err = transfer(data, 1, data + 1, 1);
+    if (err != ESP_OK) return err;
     data[1] = (data[1] & 0xE7) | (range << 3);
-    i2c_master_transmit(dev_handle, data, 2, 1000);
+    err = transfer(data, 2, NULL, 0);
+    if (err != ESP_OK) return err;
     acceleration_scale_range = range;
     acceleration_scale_factor = 2048.0f * (1 << (3 - acceleration_scale_range));
+    return ESP_OK;
 }
 
-void MPU6050::set_gyro_scale_range(uint8_t range) {
+esp_err_t MPU6050::set_gyro_scale_range(uint8_t range) {
     uint8_t data[2] = {MPU6050_GYRO_CONFIG, 0x00};
-    i2c_master_transmit_receive(dev_handle, data, 1, data + 1, 1, 1000);
+    esp_err_t err = transfer(data, 1, data + 1, 1);
+    if (err != ESP_OK) return err;
     data[1] = (data[1] & 0xE7) | (range << 3);
-    i2c_master_transmit(dev_handle, data, 2, 1000);
+    err = transfer(data, 2, NULL, 0);
+    if (err != ESP_OK) return err;
     gyro_scale_range = range;
     gyro_scale_factor = 16.4f * (1 << (3 - gyro_scale_range));
+    return ESP_OK;
 }
 
-void MPU6050::raw_read(uint8_t reg_addr, uint8_t *data, uint8_t len) {
-    i2c_master_transmit_receive(dev_handle, &reg_addr, 1, data, len, 1000);
+esp_err_t MPU6050::raw_read(uint8_t reg_addr, uint8_t *data, uint8_t len) {
+    return transfer(&reg_addr, 1, data, len);
 }
 
-void MPU6050::raw_write(uint8_t reg_addr, uint8_t &data, uint8_t len) {
+esp_err_t MPU6050::raw_write(uint8_t reg_addr, uint8_t &data, uint8_t len) {
     uint8_t buffer[len + 1];
     buffer[0] = reg_addr;
     memcpy(&buffer[1], &data, len);
-    i2c_master_transmit(dev_handle, buffer, len + 1, 1000);
+    return transfer(buffer, len + 1, NULL, 0);
 }
 
-void MPU6050::reset() {
+esp_err_t MPU6050::reset() {
     uint8_t transmit_data[2] = {MPU6050_PWR_MGMT_1, 0x80};
-    i2c_master_transmit(dev_handle, transmit_data, 2, 1000);
+    esp_err_t err = transfer(transmit_data, 2, NULL, 0);
     vTaskDelay(100 / portTICK_PERIOD_MS);
     transmit_data[0] = MPU6050_SIGNAL_PATH_RESET;
     transmit_data[1] = 0x07;
-    i2c_master_transmit(dev_handle, transmit_data, 2, 1000);
+    if (err == ESP_OK) err = transfer(transmit_data, 2, NULL, 0);
     vTaskDelay(100 / portTICK_PERIOD_MS);
     transmit_data[0] = MPU6050_PWR_MGMT_1;
     transmit_data[1] = 0x09;
-    i2c_master_transmit(dev_handle, transmit_data, 2, 1000);
+    if (err == ESP_OK) err = transfer(transmit_data, 2, NULL, 0);
     vTaskDelay(100 / portTICK_PERIOD_MS);
     transmit_data[0] = MPU6050_USER_CTRL;
     transmit_data[1] = 0x07;
-    i2c_master_transmit(dev_handle, transmit_data, 2, 1000);
+    if (err == ESP_OK) err = transfer(transmit_data, 2, NULL, 0);
     vTaskDelay(50 / portTICK_PERIOD_MS);
+    return err;
+}
+
+// Reads only the contiguous register range covering the enabled channels. A channel between two enabled
+// ones is read as well, the burst can't skip registers. The temperature sensor is powered down unless
+// its channel is enabled.
+esp_err_t MPU6050::set_channels(uint8_t channels) {
+    if (channels == 0 || (channels & ~MPU6050_CHANNEL_ALL) != 0) return ESP_ERR_INVALID_ARG;
+    uint8_t data[2] = {MPU6050_PWR_MGMT_1, MPU6050_PWR_MGMT_1_CLOCK_PLL_X};
+    if (!(channels & MPU6050_CHANNEL_TEMPERATURE)) data[1] |= MPU6050_PWR_MGMT_1_TEMP_DIS;
+    esp_err_t err = transfer(data, 2, NULL, 0);
+    if (err != ESP_OK) return err;
+    int first = __builtin_ctz(channels);
+    int last = 31 - __builtin_clz(channels);
+    this->channels = channels;
+    burst_offset = first * 2;
+    burst_len = (last - first + 1) * 2;
+    memset(burst_data, 0, sizeof(burst_data));
+    ESP_LOGI(TAG, "Channels 0x%02x, reading %u bytes from 0x%02x", channels, burst_len,
+             MPU6050_ACCEL_REG + burst_offset);
+    return ESP_OK;
+}
+
+uint8_t MPU6050::get_channels() {
+    return channels;
+}
+
+uint8_t MPU6050::get_burst_len() {
+    return burst_len;
+}
+
+const char *MPU6050::channel_name(int channel) {
+    return CHANNEL_NAMES[channel];
+}
+
+// Copies the words of the enabled channels out of a 14-byte burst, keeping the big-endian register order
+size_t MPU6050::pack_channels(uint8_t channels, const uint8_t *raw_data, uint8_t *out) {
+    size_t len = 0;
+    for (int channel = 0; channel < MPU6050_CHANNEL_COUNT; channel++) {
+        if (!(channels & (1 << channel))) continue;
+        out[len++] = raw_data[channel * 2];
+        out[len++] = raw_data[channel * 2 + 1];
+    }
+    return len;
+}
+
+// Converted values in channel order, for writing out the enabled channels
+void MPU6050::channel_values(const MPU6050_data &data, float values[MPU6050_CHANNEL_COUNT]) {
+    values[0] = data.accelerometer.x;
+    values[1] = data.accelerometer.y;
+    values[2] = data.accelerometer.z;
+    values[3] = data.temperature;
+    values[4] = data.gyroscope.x;
+    values[5] = data.gyroscope.y;
+    values[6] = data.gyroscope.z;
 }
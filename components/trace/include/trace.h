@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "trace_events.h"
+
+// Binary trace log: records an event ID and up to four raw arguments into a per-core RAM ring.
+// Nothing is formatted on the device; trace_dump() prints the records as hex and tools/trace_decoder.py
+// formats them with the strings from trace_events.h. The rings live in .noinit memory, so the records
+// leading up to a panic or watchdog reset are dumped on the next boot.
+
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_WARN 2
+#define TRACE_LEVEL_INFO 3
+#define TRACE_LEVEL_DEBUG 4
+
+#ifdef CONFIG_TRACE_LEVEL
+#define TRACE_LEVEL CONFIG_TRACE_LEVEL
+#else
+#define TRACE_LEVEL TRACE_LEVEL_INFO
+#endif
+
+struct TraceRecord {
+    uint32_t timestamp_us;
+    uint16_t event;
+    uint8_t level;
+    uint8_t argc;
+    uint32_t args[4];
+};
+
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord layout must match tools/trace_decoder.py");
+
+void trace_init();
+void trace_write(uint8_t level, uint16_t event, uint8_t argc, const uint32_t *args);
+void trace_dump();
+
+template <typename... Args> inline void trace_emit(uint8_t level, uint16_t event, Args... args) {
+    static_assert(sizeof...(Args) <= 4, "Trace events take at most four arguments");
+    const uint32_t values[sizeof...(Args) + 1] = {(uint32_t)args...};
+    trace_write(level, event, sizeof...(Args), values);
+}
+
+// The level check is a compile-time constant, so trace points above TRACE_LEVEL generate no code and
+// their arguments are never evaluated
+#define TRACE(level, event, ...)                                                                                       \
+    do {                                                                                                               \
+        if (TRACE_LEVEL >= (level)) trace_emit((level), (event), ##__VA_ARGS__);                                       \
+    } while (0)
+
+#define TRACE_E(event, ...) TRACE(TRACE_LEVEL_ERROR, event, ##__VA_ARGS__)
+#define TRACE_W(event, ...) TRACE(TRACE_LEVEL_WARN, event, ##__VA_ARGS__)
+#define TRACE_I(event, ...) TRACE(TRACE_LEVEL_INFO, event, ##__VA_ARGS__)
+#define TRACE_D(event, ...) TRACE(TRACE_LEVEL_DEBUG, event, ##__VA_ARGS__)
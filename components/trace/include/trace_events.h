@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Trace event table: X(id, format). The format is only used by tools/trace_decoder.py, which parses this
+// file, so append new events at the end to keep existing IDs stable. Arguments are recorded as uint32_t.
+#define TRACE_EVENTS(X)                                                                                                \
+    X(TRACE_BOOT, "boot reset_reason=%u")                                                                              \
+    X(TRACE_GPS_SENTENCE, "gps sentence id=%08x len=%u")                                                               \
+    X(TRACE_GPS_FIX, "gps fix lat_e7=%d lon_e7=%d")                                                                    \
+    X(TRACE_SAMPLER_DEADLINE_MISS, "sampler deadline miss total=%u")                                                   \
+    X(TRACE_SAMPLE_RING_OVERRUN, "sample ring overrun sequence=%u total=%u")                                           \
+    X(TRACE_BATCH_ENCODED, "batch encoded bytes=%u time_us=%u largest_free_block=%u")                                  \
+    X(TRACE_BATCH_ALLOC_FAILED, "batch allocation failed largest_free_block=%u")                                       \
+    X(TRACE_UPLOAD_DONE, "upload done bytes=%u err=%d transport=%u")                                                   \
+    X(TRACE_I2C_FAULT, "i2c fault sequence=%u err=%x faults=%u")                                                       \
+    X(TRACE_I2C_RECOVERED, "i2c recovery err=%x faults=%u")                                                            \
+    X(TRACE_BACKLOG_EVICTED, "backlog evicted batch id=%u flags=%x pending=%u")                                        \
+    X(TRACE_UPLOAD_ACK, "upload acknowledged through sequence=%u pending=%u")                                          \
+    X(TRACE_GPS_AID_INJECTED, "gps aid injected ini=%u eph=%u alm=%u")                                                 \
+    X(TRACE_GPS_AID_SAVED, "gps aid saved eph=%u alm=%u err=%x")                                                       \
+    X(TRACE_GPS_TTFF, "gps first fix ttff_ms=%u aided=%u")                                                             \
+    X(TRACE_CONFIG_REJECTED, "config rejected version=%u err=%x")                                                      \
+    X(TRACE_CONFIG_APPLIED, "config applied version=%u generation=%u")                                                 \
+    X(TRACE_CONFIG_CONFIRMED, "config confirmed version=%u")                                                           \
+    X(TRACE_CONFIG_ROLLBACK, "config rolled back failed=%u restored=%u")                                               \
+    X(TRACE_CONFIG_RESTART, "config restart for new urls version=%u")                                                  \
+    X(TRACE_BACKLOG_DROPPED, "backlog dropped batch, every slot awaits an ack pending=%u")                             \
+    X(TRACE_BACKLOG_UNACKNOWLEDGED, "backlog released unacknowledged sequence=%u")
+
+#define TRACE_EVENT_ENUM(id, format) id,
+enum trace_event_t : uint16_t { TRACE_EVENTS(TRACE_EVENT_ENUM) TRACE_EVENT_COUNT };
+#undef TRACE_EVENT_ENUM
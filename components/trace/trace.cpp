@@ -0,0 +1,76 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef CONFIG_TRACE_RING_SIZE
+static const uint32_t TRACE_RING_SIZE = CONFIG_TRACE_RING_SIZE;
+#else
+static const uint32_t TRACE_RING_SIZE = 256;
+#endif
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "CONFIG_TRACE_RING_SIZE must be a power of two");
+
+static const uint32_t TRACE_MAGIC = 0x54524331; // "TRC1"
+
+struct TraceRing {
+    uint32_t head;
+    TraceRecord records[TRACE_RING_SIZE];
+};
+
+// Not cleared at reset, so the rings still hold the last records after a crash
+static __NOINIT_ATTR uint32_t trace_magic;
+static __NOINIT_ATTR TraceRing trace_rings[portNUM_PROCESSORS];
+
+static bool reset_was_crash(esp_reset_reason_t reason) {
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+           reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
+
+void trace_init() {
+    esp_reset_reason_t reason = esp_reset_reason();
+    if (trace_magic == TRACE_MAGIC && reset_was_crash(reason)) {
+        printf("Trace records from before the %s reset:\n", reason == ESP_RST_BROWNOUT ? "brownout" : "crash");
+        trace_dump();
+    }
+    memset(trace_rings, 0, sizeof(trace_rings));
+    trace_magic = TRACE_MAGIC;
+    TRACE_I(TRACE_BOOT, reason);
+}
+
+void trace_write(uint8_t level, uint16_t event, uint8_t argc, const uint32_t *args) {
+    TraceRing &ring = trace_rings[esp_cpu_get_core_id()];
+    // Tasks on the same core may preempt each other, claim the slot atomically
+    uint32_t index = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED) & (TRACE_RING_SIZE - 1);
+    TraceRecord &record = ring.records[index];
+    record.timestamp_us = (uint32_t)esp_timer_get_time();
+    record.event = event;
+    record.level = level;
+    record.argc = argc;
+    memcpy(record.args, args, argc * sizeof(uint32_t));
+}
+
+// Prints every record as "TRACE,<core>,<hex>", oldest first. Decode with tools/trace_decoder.py.
+void trace_dump() {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        const TraceRing &ring = trace_rings[core];
+        uint32_t head = ring.head;
+        uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        for (uint32_t i = head - count; i != head; i++) {
+            const uint8_t *bytes = (const uint8_t *)&ring.records[i & (TRACE_RING_SIZE - 1)];
+            char hex[sizeof(TraceRecord) * 2 + 1];
+            static const char digits[] = "0123456789abcdef";
+            for (size_t j = 0; j < sizeof(TraceRecord); j++) {
+                hex[j * 2] = digits[bytes[j] >> 4];
+                hex[j * 2 + 1] = digits[bytes[j] & 0x0F];
+            }
+            hex[sizeof(hex) - 1] = '\0';
+            printf("TRACE,%d,%s\n", core, hex);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <optional>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+// Binary layout of the track index blob written by tools/track_index_builder.py.
+// All fields are little-endian, coordinates are in 1e-7 degrees.
+static const uint32_t TRACK_INDEX_MAGIC = 0x494B5254; // "TRKI"
+static const uint16_t TRACK_INDEX_VERSION = 1;
+static const esp_partition_subtype_t TRACK_INDEX_PARTITION_SUBTYPE = (esp_partition_subtype_t)0x40;
+
+struct TrackIndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    int32_t origin_lat;     // south-west corner of the grid
+    int32_t origin_lon;
+    int32_t cell_size;      // grid cell edge
+    uint16_t cols;
+    uint16_t rows;
+    uint32_t segment_count;
+    uint32_t entry_count;
+    uint32_t segments_offset; // TrackSegment[segment_count]
+    uint32_t cells_offset;    // uint32_t[cols * rows + 1], first entry of each cell
+    uint32_t entries_offset;  // uint32_t[entry_count], segment indices
+    float max_distance_m;     // segments were registered in every cell within this distance
+};
+
+struct TrackSegment {
+    int32_t lat0;
+    int32_t lon0;
+    int32_t lat1;
+    int32_t lon1;
+    uint32_t start_chainage_cm;
+    uint16_t line_id;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(TrackIndexHeader) == 48, "TrackIndexHeader layout must match the host builder");
+static_assert(sizeof(TrackSegment) == 24, "TrackSegment layout must match the host builder");
+
+struct TrackPosition {
+    uint32_t segment_id;
+    uint16_t line_id;
+    float chainage_m;
+    float offset_m; // perpendicular distance from the segment
+};
+
+class TrackIndex {
+  private:
+    const char *TAG = "TrackIndex";
+    const uint8_t *base = nullptr;
+    const TrackIndexHeader *header = nullptr;
+    const TrackSegment *segments = nullptr;
+    const uint32_t *cells = nullptr;
+    const uint32_t *entries = nullptr;
+    esp_partition_mmap_handle_t mmap_handle;
+
+  public:
+    TrackIndex();
+    esp_err_t init(const char *partition_label = "track");
+    esp_err_t load(const void *blob, size_t size);
+    bool is_loaded() const;
+    std::optional<TrackPosition> locate(double latitude, double longitude) const;
+};
@@ -0,0 +1,106 @@
+#include "track_index.h"
+
+#include <math.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+
+static const float METRES_PER_DEGREE = 111319.49f;
+static const float METRES_PER_E7 = METRES_PER_DEGREE * 1e-7f;
+
+TrackIndex::TrackIndex() {
+}
+
+esp_err_t TrackIndex::init(const char *partition_label) {
+    const esp_partition_t *partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TRACK_INDEX_PARTITION_SUBTYPE, partition_label);
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "Partition %s not found", partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    const void *ptr;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &ptr, &mmap_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mmap partition %s: %s", partition_label, esp_err_to_name(err));
+        return err;
+    }
+    err = load(ptr, partition->size);
+    if (err != ESP_OK) {
+        esp_partition_munmap(mmap_handle);
+        return err;
+    }
+    ESP_LOGI(TAG, "Loaded %lu segments in a %ux%u grid", header->segment_count, header->cols, header->rows);
+    return ESP_OK;
+}
+
+// Validates the blob and points the lookup tables into it. The blob is not copied.
+esp_err_t TrackIndex::load(const void *blob, size_t size) {
+    const TrackIndexHeader *h = (const TrackIndexHeader *)blob;
+    if (size < sizeof(TrackIndexHeader) || h->magic != TRACK_INDEX_MAGIC) {
+        ESP_LOGW(TAG, "No track index found");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (h->version != TRACK_INDEX_VERSION || h->header_size != sizeof(TrackIndexHeader)) {
+        ESP_LOGE(TAG, "Unsupported track index version %u", h->version);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    uint64_t cell_count = (uint64_t)h->cols * h->rows;
+    if (h->segments_offset + (uint64_t)h->segment_count * sizeof(TrackSegment) > size ||
+        h->cells_offset + (cell_count + 1) * sizeof(uint32_t) > size ||
+        h->entries_offset + (uint64_t)h->entry_count * sizeof(uint32_t) > size || h->cell_size <= 0) {
+        ESP_LOGE(TAG, "Track index is truncated or corrupt");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    base = (const uint8_t *)blob;
+    header = h;
+    segments = (const TrackSegment *)(base + h->segments_offset);
+    cells = (const uint32_t *)(base + h->cells_offset);
+    entries = (const uint32_t *)(base + h->entries_offset);
+    return ESP_OK;
+}
+
+bool TrackIndex::is_loaded() const {
+    return header != nullptr;
+}
+
+std::optional<TrackPosition> TrackIndex::locate(double latitude, double longitude) const {
+    if (header == nullptr) return std::nullopt;
+    int32_t lat = (int32_t)lround(latitude * 1e7);
+    int32_t lon = (int32_t)lround(longitude * 1e7);
+    int64_t row = ((int64_t)lat - header->origin_lat) / header->cell_size;
+    int64_t col = ((int64_t)lon - header->origin_lon) / header->cell_size;
+    if (lat < header->origin_lat || lon < header->origin_lon || row >= header->rows || col >= header->cols) {
+        return std::nullopt;
+    }
+    uint32_t cell = row * header->cols + col;
+
+    // Project into a local equirectangular frame centred on the query point
+    float x_scale = METRES_PER_E7 * cosf(latitude * (float)M_PI / 180.0f);
+    float best_distance_sq = header->max_distance_m * header->max_distance_m;
+    std::optional<TrackPosition> best = std::nullopt;
+    for (uint32_t i = cells[cell]; i < cells[cell + 1] && i < header->entry_count; i++) {
+        uint32_t segment_id = entries[i];
+        if (segment_id >= header->segment_count) continue;
+        const TrackSegment &segment = segments[segment_id];
+        float ax = (segment.lon0 - lon) * x_scale;
+        float ay = (segment.lat0 - lat) * METRES_PER_E7;
+        float dx = (segment.lon1 - segment.lon0) * x_scale;
+        float dy = (segment.lat1 - segment.lat0) * METRES_PER_E7;
+        float length_sq = dx * dx + dy * dy;
+        float t = length_sq > 0.0f ? -(ax * dx + ay * dy) / length_sq : 0.0f;
+        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+        float px = ax + t * dx;
+        float py = ay + t * dy;
+        float distance_sq = px * px + py * py;
+        if (distance_sq < best_distance_sq) {
+            best_distance_sq = distance_sq;
+            best = TrackPosition{
+                .segment_id = segment_id,
+                .line_id = segment.line_id,
+                .chainage_m = segment.start_chainage_cm / 100.0f + t * sqrtf(length_sq),
+                .offset_m = sqrtf(distance_sq),
+            };
+        }
+    }
+    return best;
+}
@@ -0,0 +1,76 @@
+#include "capture.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "driver/uart.h"
+#include "esp_log.h"
+
+CaptureStream::CaptureStream() {
+}
+
+// Expects the UART driver to be installed already, with a TX buffer large enough to absorb bursts
+esp_err_t CaptureStream::init(uart_port_t uart_num, int baud_rate) {
+    this->uart_num = uart_num;
+    esp_err_t err = uart_set_baudrate(uart_num, baud_rate);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set baud rate %d: %s", baud_rate, esp_err_to_name(err));
+        return err;
+    }
+    uart_flush(uart_num);
+    return ESP_OK;
+}
+
+static size_t finish_frame(uint8_t *out, uint8_t type, size_t payload_len) {
+    out[0] = CAPTURE_SYNC_0;
+    out[1] = CAPTURE_SYNC_1;
+    out[2] = type;
+    out[3] = payload_len;
+    uint16_t crc = crc16_ccitt(out + 2, payload_len + 2);
+    memcpy(out + 4 + payload_len, &crc, sizeof(crc));
+    return payload_len + CAPTURE_FRAME_OVERHEAD;
+}
+
+// Only the words of the enabled channels are sent, so the frame shrinks with the channel mask
+size_t CaptureStream::encode_sample(uint8_t *out, uint32_t sequence, int64_t timestamp_us, const uint8_t *raw,
+                                    uint8_t channels, uint8_t flags, const GY_NEO6MV2_data &gps_data) {
+    uint8_t *payload = out + 4;
+    size_t pos = 0;
+    memcpy(payload + pos, &sequence, sizeof(sequence));
+    pos += sizeof(sequence);
+    memcpy(payload + pos, &timestamp_us, sizeof(timestamp_us));
+    pos += sizeof(timestamp_us);
+    pos += MPU6050::pack_channels(channels, raw, payload + pos);
+    bool has_fix = gps_data.position.latitude.has_value() && gps_data.position.longitude.has_value();
+    int32_t latitude = has_fix ? (int32_t)lround(gps_data.position.latitude.value() * 1e7) : CAPTURE_NO_FIX;
+    int32_t longitude = has_fix ? (int32_t)lround(gps_data.position.longitude.value() * 1e7) : CAPTURE_NO_FIX;
+    memcpy(payload + pos, &latitude, sizeof(latitude));
+    pos += sizeof(latitude);
+    memcpy(payload + pos, &longitude, sizeof(longitude));
+    pos += sizeof(longitude);
+    return finish_frame(out, CAPTURE_FRAME_SAMPLE | (flags << 4), pos);
+}
+
+size_t CaptureStream::encode_schema(uint8_t *out, uint8_t channels, uint8_t acceleration_range,
+                                    uint8_t gyro_range) {
+    out[4] = channels;
+    out[5] = acceleration_range;
+    out[6] = gyro_range;
+    return finish_frame(out, CAPTURE_FRAME_SCHEMA, 3);
+}
+
+// Queues the frames into the UART TX ring buffer in one call, the driver drains it from its ISR
+void CaptureStream::write(const uint8_t *data, size_t len) {
+    uart_write_bytes(uart_num, (const char *)data, len);
+}
+
+uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver/uart.h"
+#include "esp_err.h"
+#include "gy_neo6mv2.h"
+#include "mpu6050.h"
+
+// Binary records streamed in capture mode, decoded by tools/capture_receiver.py. Every frame is
+//     sync[2] type length payload[length] crc16
+// with the CRC-16/CCITT-FALSE over type..payload. Multi-byte fields are little-endian except the sensor
+// words, which are the MPU6050 registers as read.
+//
+// Sample payload: sequence u32, timestamp_us i64, one big-endian word per enabled channel in register
+// order, latitude i32, longitude i32 (1e-7 degrees, CAPTURE_NO_FIX without a fix).
+// Schema payload: channel mask u8, accelerometer range u8, gyroscope range u8. Sent at the start of the
+// stream and every CAPTURE_SCHEMA_INTERVAL samples so a receiver attached mid-stream can decode it.
+
+static const uint8_t CAPTURE_SYNC_0 = 0xA5;
+static const uint8_t CAPTURE_SYNC_1 = 0x5A;
+static const uint8_t CAPTURE_FRAME_SAMPLE = 0x01;
+static const uint8_t CAPTURE_FRAME_SCHEMA = 0x02;
+// Frame type in the low nibble, sample flags in the high nibble
+static const uint8_t CAPTURE_FRAME_TYPE_MASK = 0x0F;
+static const int32_t CAPTURE_NO_FIX = INT32_MIN;
+static const uint32_t CAPTURE_SCHEMA_INTERVAL = 1000;
+// sync, type, length, crc
+static const size_t CAPTURE_FRAME_OVERHEAD = 6;
+static const size_t CAPTURE_SAMPLE_MAX_LEN = CAPTURE_FRAME_OVERHEAD + 4 + 8 + MPU6050_RAW_DATA_LEN + 4 + 4;
+static const size_t CAPTURE_SCHEMA_LEN = CAPTURE_FRAME_OVERHEAD + 3;
+
+class CaptureStream {
+  private:
+    const char *TAG = "CaptureStream";
+    uart_port_t uart_num;
+
+  public:
+    CaptureStream();
+    esp_err_t init(uart_port_t uart_num, int baud_rate);
+    // Both return the frame length, `out` needs room for CAPTURE_SAMPLE_MAX_LEN or CAPTURE_SCHEMA_LEN
+    static size_t encode_sample(uint8_t *out, uint32_t sequence, int64_t timestamp_us, const uint8_t *raw,
+                                uint8_t channels, uint8_t flags, const GY_NEO6MV2_data &gps_data);
+    static size_t encode_schema(uint8_t *out, uint8_t channels, uint8_t acceleration_range, uint8_t gyro_range);
+    void write(const uint8_t *data, size_t len);
+};
+
+uint16_t crc16_ccitt(const uint8_t *data, size_t len);
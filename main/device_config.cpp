@@ -0,0 +1,249 @@
+#include "device_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "flat_json.h"
+#include "nvs.h"
+
+static const char *BLOB_KEY = "stored";
+static const char *const UPLOAD_MODE_NAMES[] = {"auto", "http", "stream"};
+
+struct ConfigParse {
+    DeviceConfig *config;
+    bool has_version;
+    char *error;
+    size_t error_len;
+};
+
+static bool parse_integer(const FlatJsonValue &value, uint32_t min, uint32_t max, uint32_t &out) {
+    if (value.type != FlatJsonValue::NUMBER || value.number < min || value.number > max) return false;
+    if (value.number != (double)(uint32_t)value.number) return false;
+    out = (uint32_t)value.number;
+    return true;
+}
+
+static bool parse_url(const FlatJsonValue &value, const char *const *schemes, char *out) {
+    char url[DeviceConfig::URL_LEN];
+    if (!flat_json_copy_string(value, url, sizeof(url))) return false;
+    for (; *schemes != NULL; schemes++) {
+        if (strncmp(url, *schemes, strlen(*schemes)) == 0) {
+            strcpy(out, url);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_field(void *ctx, const char *key, size_t key_len, const FlatJsonValue &value) {
+    ConfigParse &parse = *(ConfigParse *)ctx;
+    DeviceConfig &config = *parse.config;
+    static const char *const HTTP_SCHEMES[] = {"https://", "http://", NULL};
+    static const char *const MQTT_SCHEMES[] = {"mqtts://", "mqtt://", NULL};
+    uint32_t number;
+    bool ok;
+    if (flat_json_key_is(key, key_len, "config_version")) {
+        ok = parse_integer(value, 1, UINT32_MAX, config.version);
+        parse.has_version = ok;
+    } else if (flat_json_key_is(key, key_len, "sample_period_ms")) {
+        ok = parse_integer(value, DeviceConfig::MIN_SAMPLE_PERIOD_MS, DeviceConfig::MAX_SAMPLE_PERIOD_MS, number);
+        // Periods shorter than a tick would make the sampler spin
+        ok = ok && pdMS_TO_TICKS(number) > 0;
+        if (ok) config.sample_period_ms = number;
+    } else if (flat_json_key_is(key, key_len, "batch_size")) {
+        ok = parse_integer(value, DeviceConfig::MIN_BATCH_SIZE, DeviceConfig::MAX_BATCH_SIZE, number);
+        if (ok) config.batch_size = number;
+    } else if (flat_json_key_is(key, key_len, "accel_range")) {
+        ok = parse_integer(value, 0, 3, number);
+        if (ok) config.accel_range = number;
+    } else if (flat_json_key_is(key, key_len, "gyro_range")) {
+        ok = parse_integer(value, 0, 3, number);
+        if (ok) config.gyro_range = number;
+    } else if (flat_json_key_is(key, key_len, "channels")) {
+        ok = parse_integer(value, 0x01, 0x7F, number);
+        if (ok) config.channels = number;
+    } else if (flat_json_key_is(key, key_len, "upload_mode")) {
+        ok = false;
+        for (uint8_t mode = 0; mode < sizeof(UPLOAD_MODE_NAMES) / sizeof(UPLOAD_MODE_NAMES[0]); mode++) {
+            if (value.type == FlatJsonValue::STRING && value.len == strlen(UPLOAD_MODE_NAMES[mode]) &&
+                memcmp(value.start, UPLOAD_MODE_NAMES[mode], value.len) == 0) {
+                config.upload_mode = (UploadMode)mode;
+                ok = true;
+            }
+        }
+    } else if (flat_json_key_is(key, key_len, "upload_url")) {
+        ok = parse_url(value, HTTP_SCHEMES, config.upload_url);
+    } else if (flat_json_key_is(key, key_len, "lock_url")) {
+        ok = parse_url(value, HTTP_SCHEMES, config.lock_url);
+    } else if (flat_json_key_is(key, key_len, "mqtt_uri")) {
+        ok = parse_url(value, MQTT_SCHEMES, config.mqtt_uri);
+    } else {
+        snprintf(parse.error, parse.error_len, "unknown field %.*s", (int)key_len, key);
+        return false;
+    }
+    if (!ok) snprintf(parse.error, parse.error_len, "invalid %.*s", (int)key_len, key);
+    return ok;
+}
+
+static bool find_version(void *ctx, const char *key, size_t key_len, const FlatJsonValue &value) {
+    if (!flat_json_key_is(key, key_len, "config_version")) return true;
+    *(bool *)ctx = true;
+    return false;
+}
+
+bool is_config_document(const char *json, size_t len) {
+    bool found = false;
+    flat_json_parse(json, len, find_version, &found);
+    return found;
+}
+
+esp_err_t parse_config(const char *json, size_t len, const DeviceConfig &base, uint32_t min_version,
+                       DeviceConfig &out, char *error, size_t error_len) {
+    out = base;
+    ConfigParse parse = {&out, false, error, error_len};
+    error[0] = '\0';
+    esp_err_t err = flat_json_parse(json, len, parse_field, &parse);
+    if (err == ESP_ERR_INVALID_ARG) snprintf(error, error_len, "malformed document");
+    if (err != ESP_OK) return ESP_ERR_INVALID_ARG;
+    if (!parse.has_version) {
+        snprintf(error, error_len, "missing config_version");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (out.version <= min_version) {
+        snprintf(error, error_len, "config_version %lu is not above %lu", out.version, min_version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    return ESP_OK;
+}
+
+const char *upload_mode_name(UploadMode mode) {
+    return UPLOAD_MODE_NAMES[mode];
+}
+
+bool config_urls_equal(const DeviceConfig &a, const DeviceConfig &b) {
+    return strcmp(a.upload_url, b.upload_url) == 0 && strcmp(a.lock_url, b.lock_url) == 0 &&
+           strcmp(a.mqtt_uri, b.mqtt_uri) == 0;
+}
+
+ConfigStore::ConfigStore() {
+}
+
+esp_err_t ConfigStore::init(const DeviceConfig &defaults) {
+    lock = xSemaphoreCreateMutex();
+    if (lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_OK) {
+        size_t len = sizeof(stored);
+        err = nvs_get_blob(handle, BLOB_KEY, &stored, &len);
+        if (err == ESP_OK && len != sizeof(stored)) err = ESP_ERR_INVALID_SIZE;
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        // First boot, or the layout changed with a firmware update
+        ESP_LOGI(TAG, "No stored config (%s), using the defaults", esp_err_to_name(err));
+        stored = {};
+        stored.current = defaults;
+        stored.previous = defaults;
+        return ESP_OK;
+    }
+    if (stored.state == TRIAL) {
+        stored.state = TRIAL_BOOTED;
+        ESP_LOGW(TAG, "Config %lu is on trial", stored.current.version);
+        write();
+        return ESP_OK;
+    }
+    if (stored.state == TRIAL_BOOTED) {
+        ESP_LOGW(TAG, "Config %lu was never confirmed, rolling back to %lu", stored.current.version,
+                 stored.previous.version);
+        stored.failed_version = stored.current.version;
+        stored.current = stored.previous;
+        stored.state = CONFIRMED;
+        write();
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Loaded config %lu", stored.current.version);
+    return ESP_OK;
+}
+
+esp_err_t ConfigStore::write() {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, BLOB_KEY, &stored, sizeof(stored));
+        if (err == ESP_OK) err = nvs_commit(handle);
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write config: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+DeviceConfig ConfigStore::get_current() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    DeviceConfig config = stored.current;
+    xSemaphoreGive(lock);
+    return config;
+}
+
+DeviceConfig ConfigStore::get_previous() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    DeviceConfig config = stored.previous;
+    xSemaphoreGive(lock);
+    return config;
+}
+
+bool ConfigStore::in_trial() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool trial = stored.state != CONFIRMED;
+    xSemaphoreGive(lock);
+    return trial;
+}
+
+uint32_t ConfigStore::get_failed_version() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t version = stored.failed_version;
+    xSemaphoreGive(lock);
+    return version;
+}
+
+esp_err_t ConfigStore::stage(const DeviceConfig &config) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    // A config replacing one still on trial falls back to the last confirmed one as well
+    if (stored.state == CONFIRMED) stored.previous = stored.current;
+    stored.current = config;
+    stored.state = TRIAL;
+    esp_err_t err = write();
+    xSemaphoreGive(lock);
+    return err;
+}
+
+esp_err_t ConfigStore::confirm(uint32_t version) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (stored.state != CONFIRMED && stored.current.version == version) {
+        stored.state = CONFIRMED;
+        stored.previous = stored.current;
+        err = write();
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
+
+esp_err_t ConfigStore::rollback(uint32_t version) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (stored.state != CONFIRMED && stored.current.version == version) {
+        stored.failed_version = stored.current.version;
+        stored.current = stored.previous;
+        stored.state = CONFIRMED;
+        err = write();
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+enum UploadMode : uint8_t {
+    UPLOAD_MODE_AUTO,   // streaming transport while connected, HTTPS as the fallback
+    UPLOAD_MODE_HTTP,   // HTTPS only
+    UPLOAD_MODE_STREAM, // streaming transport only, batches wait in the backlog while it is down
+};
+
+// Settings the server can change at runtime with a config document
+struct DeviceConfig {
+    static const size_t URL_LEN = 128;
+    static const uint16_t MIN_SAMPLE_PERIOD_MS = 1;
+    static const uint16_t MAX_SAMPLE_PERIOD_MS = 1000;
+    static const uint16_t MIN_BATCH_SIZE = 10;
+    // About 63 KB per batch with every channel enabled. The encoder's buffer for a config is checked
+    // against the largest free heap block when the config arrives.
+    static const uint16_t MAX_BATCH_SIZE = 400;
+
+    uint32_t version;
+    uint16_t sample_period_ms;
+    uint16_t batch_size;
+    uint8_t accel_range;
+    uint8_t gyro_range;
+    uint8_t channels;
+    UploadMode upload_mode;
+    // Read once at boot, a change takes effect after the next restart
+    char upload_url[URL_LEN];
+    char lock_url[URL_LEN];
+    char mqtt_uri[URL_LEN];
+};
+
+// A config document is a flat JSON object with a config_version and any of the DeviceConfig fields:
+//     {"config_version":7,"sample_period_ms":2,"batch_size":300,"accel_range":1,"gyro_range":0,
+//      "channels":7,"upload_mode":"auto","upload_url":"https://...","lock_url":"...","mqtt_uri":"mqtts://..."}
+// Fields left out keep their value from `base`. The document is rejected as a whole if any field is
+// unknown or out of range, or if config_version is not above `min_version`. `error` gets the reason.
+bool is_config_document(const char *json, size_t len);
+esp_err_t parse_config(const char *json, size_t len, const DeviceConfig &base, uint32_t min_version,
+                       DeviceConfig &out, char *error, size_t error_len);
+const char *upload_mode_name(UploadMode mode);
+// The URLs are only read at boot, a config that changes them needs a restart to take effect
+bool config_urls_equal(const DeviceConfig &a, const DeviceConfig &b);
+
+// Keeps the active config and the last confirmed one in NVS, in a single blob so an update is atomic.
+// A new config is staged on trial and becomes the fallback only once confirm() is called, i.e. after it
+// has proven to work. A trial config gets one restart (URL changes need it); if it is still unconfirmed
+// at the following boot, or rollback() is called, the last confirmed config is restored and its version
+// is remembered as failed so the same document is not applied again. confirm() and rollback() name the
+// version they decide on and return ESP_ERR_INVALID_STATE, changing nothing, unless that config is the
+// one on trial; a decision that raced with a newer stage() or was already taken has no effect.
+class ConfigStore {
+  private:
+    const char *TAG = "ConfigStore";
+    static constexpr const char *NAMESPACE = "config";
+    enum State : uint8_t { CONFIRMED, TRIAL, TRIAL_BOOTED };
+    struct Stored {
+        State state;
+        uint32_t failed_version;
+        DeviceConfig current;
+        DeviceConfig previous;
+    };
+    Stored stored = {};
+    SemaphoreHandle_t lock = NULL;
+    esp_err_t write();
+
+  public:
+    ConfigStore();
+    // Loads the stored config, `defaults` if there is none. Expects NVS to be initialised.
+    esp_err_t init(const DeviceConfig &defaults);
+    DeviceConfig get_current();
+    DeviceConfig get_previous();
+    bool in_trial();
+    uint32_t get_failed_version();
+    esp_err_t stage(const DeviceConfig &config);
+    esp_err_t confirm(uint32_t version);
+    esp_err_t rollback(uint32_t version);
+};
@@ -0,0 +1,135 @@
+#include "flat_json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Longest number token accepted, more than enough for a double
+static const size_t NUMBER_LEN = 32;
+
+static size_t skip_space(const char *json, size_t len, size_t pos) {
+    while (pos < len && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r')) pos++;
+    return pos;
+}
+
+// Leaves `pos` on the closing quote, false if the string is not terminated
+static bool scan_string(const char *json, size_t len, size_t &pos) {
+    while (pos < len && json[pos] != '"') {
+        if ((unsigned char)json[pos] < 0x20) return false;
+        pos += json[pos] == '\\' ? 2 : 1;
+    }
+    return pos < len;
+}
+
+// Whitespace and the NUL terminator some senders include in the length may follow the object
+static bool at_end(const char *json, size_t len, size_t pos) {
+    pos = skip_space(json, len, pos);
+    return pos == len || (pos == len - 1 && json[pos] == '\0');
+}
+
+static bool match_literal(const char *json, size_t len, size_t pos, const char *literal) {
+    size_t literal_len = strlen(literal);
+    return len - pos >= literal_len && memcmp(json + pos, literal, literal_len) == 0;
+}
+
+static bool parse_value(const char *json, size_t len, size_t &pos, FlatJsonValue &value) {
+    value.start = json + pos;
+    if (json[pos] == '"') {
+        size_t start = ++pos;
+        if (!scan_string(json, len, pos)) return false;
+        value.type = FlatJsonValue::STRING;
+        value.start = json + start;
+        value.len = pos++ - start;
+        return true;
+    }
+    if (match_literal(json, len, pos, "true") || match_literal(json, len, pos, "false")) {
+        value.type = FlatJsonValue::BOOL;
+        value.boolean = json[pos] == 't';
+        value.len = value.boolean ? 4 : 5;
+        pos += value.len;
+        return true;
+    }
+    if (match_literal(json, len, pos, "null")) {
+        value.type = FlatJsonValue::NUL;
+        value.len = 4;
+        pos += 4;
+        return true;
+    }
+    size_t start = pos;
+    while (pos < len && strchr("+-.eE0123456789", json[pos]) != NULL && json[pos] != '\0') pos++;
+    if (pos == start || pos - start >= NUMBER_LEN) return false;
+    char number[NUMBER_LEN];
+    memcpy(number, json + start, pos - start);
+    number[pos - start] = '\0';
+    char *end;
+    value.type = FlatJsonValue::NUMBER;
+    value.number = strtod(number, &end);
+    value.len = pos - start;
+    return *end == '\0';
+}
+
+esp_err_t flat_json_parse(const char *json, size_t len, flat_json_field_cb_t field, void *ctx) {
+    size_t pos = skip_space(json, len, 0);
+    if (pos >= len || json[pos++] != '{') return ESP_ERR_INVALID_ARG;
+    pos = skip_space(json, len, pos);
+    if (pos < len && json[pos] == '}') return at_end(json, len, pos + 1) ? ESP_OK : ESP_ERR_INVALID_ARG;
+    while (true) {
+        if (pos >= len || json[pos++] != '"') return ESP_ERR_INVALID_ARG;
+        size_t key_start = pos;
+        if (!scan_string(json, len, pos)) return ESP_ERR_INVALID_ARG;
+        size_t key_len = pos++ - key_start;
+        pos = skip_space(json, len, pos);
+        if (pos >= len || json[pos++] != ':') return ESP_ERR_INVALID_ARG;
+        pos = skip_space(json, len, pos);
+        FlatJsonValue value;
+        if (pos >= len || !parse_value(json, len, pos, value)) return ESP_ERR_INVALID_ARG;
+        if (!field(ctx, json + key_start, key_len, value)) return ESP_ERR_INVALID_STATE;
+        pos = skip_space(json, len, pos);
+        if (pos >= len) return ESP_ERR_INVALID_ARG;
+        if (json[pos] == '}') break;
+        if (json[pos++] != ',') return ESP_ERR_INVALID_ARG;
+        pos = skip_space(json, len, pos);
+    }
+    return at_end(json, len, pos + 1) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+bool flat_json_key_is(const char *key, size_t key_len, const char *name) {
+    return strlen(name) == key_len && memcmp(key, name, key_len) == 0;
+}
+
+bool flat_json_copy_string(const FlatJsonValue &value, char *buf, size_t len) {
+    if (value.type != FlatJsonValue::STRING || len == 0) return false;
+    size_t out = 0;
+    for (size_t i = 0; i < value.len; i++) {
+        char c = value.start[i];
+        if (c == '\\') {
+            c = value.start[++i];
+            switch (c) {
+            case 'n':
+                c = '\n';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            default:
+                return false;
+            }
+        }
+        if (out + 1 >= len) return false;
+        buf[out++] = c;
+    }
+    buf[out] = '\0';
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// A value of a flat JSON object. Strings point into the input, between the quotes and still escaped.
+struct FlatJsonValue {
+    enum Type : uint8_t { STRING, NUMBER, BOOL, NUL };
+    Type type;
+    const char *start;
+    size_t len;
+    double number;
+    bool boolean;
+};
+
+// Called for every member, return false to stop parsing
+typedef bool (*flat_json_field_cb_t)(void *ctx, const char *key, size_t key_len, const FlatJsonValue &value);
+
+// Parses {"key": value, ...} where every value is a string, number, true, false or null. Nested objects
+// and arrays are rejected. Nothing is allocated and the input does not have to be NUL-terminated, so
+// documents straight from an MQTT event or an HTTP response can be parsed in place.
+// Returns ESP_ERR_INVALID_ARG on a syntax error, ESP_ERR_INVALID_STATE if the callback stopped parsing.
+esp_err_t flat_json_parse(const char *json, size_t len, flat_json_field_cb_t field, void *ctx);
+bool flat_json_key_is(const char *key, size_t key_len, const char *name);
+// Unescapes a string value into `buf`, false if it does not fit or uses \u escapes
+bool flat_json_copy_string(const FlatJsonValue &value, char *buf, size_t len);
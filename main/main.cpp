@@ -5,147 +5,780 @@
 #include "esp_log.h"
 #include "esp_sntp.h"
 #include "esp_spiffs.h"
+#include "esp_system.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "nvs_flash.h"
+#include "capture.h"
+#include "device_config.h"
 #include "gy_neo6mv2.h"
 #include "mpu6050.h"
+#include "mpu6050_convert.h"
+#include "position_filter.h"
+#include "sample_ring.h"
+#include "trace.h"
+#include "track_index.h"
+#include "transport.h"
+#include "upload_backlog.h"
 #include "utils.h"
 #include "wifi_station.h"
 #include <cJSON.h>
+#include <sdkconfig.h>
 #include <string.h>
 
+#ifdef CONFIG_SENSOR_CAPTURE_MODE
+static const bool capture_mode = true;
+static const uint8_t DEFAULT_CHANNEL_MASK = CONFIG_SENSOR_CAPTURE_CHANNEL_MASK;
+// xTaskDelayUntil asserts on a period of zero ticks
+static_assert(pdMS_TO_TICKS(CONFIG_SENSOR_CAPTURE_SAMPLE_PERIOD_MS) > 0,
+              "CONFIG_SENSOR_CAPTURE_SAMPLE_PERIOD_MS is shorter than a tick, raise CONFIG_FREERTOS_HZ");
+#else
+static const bool capture_mode = false;
+static const uint8_t DEFAULT_CHANNEL_MASK = CONFIG_SENSOR_CHANNEL_MASK;
+#endif
+
 WifiStation station;
 MPU6050 mpu;
 GY_NEO6MV2 gps;
+TrackIndex track_index;
+CaptureStream capture;
 static portMUX_TYPE gps_spinlock = portMUX_INITIALIZER_UNLOCKED;
 esp_vfs_spiffs_conf_t spiffs_conf;
 
-QueueHandle_t data_queue;
+UploadBacklog backlog;
+ConfigStore config_store;
 
 struct Data {
     MPU6050_data mpu_data;
     GY_NEO6MV2_data gps_data;
+    int64_t gps_time_us;
+    uint32_t gps_sequence;
 };
 
 Data data;
 
+// Compact raw sample handed from the real-time sampler to the encoder
+struct Sample {
+    uint32_t sequence;
+    int64_t timestamp_us;
+    uint8_t raw[MPU6050_RAW_DATA_LEN];
+    uint8_t flags;
+    uint8_t config_generation; // settings the sample was taken with, see applied_configs
+};
+
+// The burst read failed, raw is zeroed
+static const uint8_t SAMPLE_FLAG_I2C_ERROR = 0x01;
+// First sample after a bus recovery, samples were lost while the device was re-initialised
+static const uint8_t SAMPLE_FLAG_RECOVERED = 0x02;
+
+// Used until the server pushes a config document
+static const uint16_t DEFAULT_SAMPLE_PERIOD_MS = 5;
+static_assert(pdMS_TO_TICKS(DEFAULT_SAMPLE_PERIOD_MS) > 0, "The default sample period is shorter than a tick");
+static const uint16_t DEFAULT_BATCH_SIZE = 200;
+static const uint8_t DEFAULT_ACCEL_RANGE = 2;
+// Timestamp, position, flags and newline, plus one field per enabled channel
+static const int BATCH_LINE_BASE_LEN = 60;
+static const int BATCH_CHANNEL_LEN = 14;
+// Track tag and schema line at the start of a batch
+static const int BATCH_PREAMBLE_LEN = 128;
+static const int ENCODE_CHUNK = 32;
+// Peak-to-peak acceleration on any axis that flags a batch window for early upload
+static const float WINDOW_EVENT_RANGE = 4.0f;
+static const int UPLOAD_RETRY_MS = 1000;
+// Minimum movement before a new interpolated position is written out
+static const float POSITION_EMIT_DISTANCE = 1.0f;
+// Absorbs about 0.4 s of capture frames at 1 kHz
+static const int CAPTURE_TX_BUFFER_SIZE = 16384;
+// Ephemerides of the satellites in view take about 30 s each to download after the first fix
+static const int64_t GPS_AID_FIRST_REQUEST_US = 120 * 1000000LL;
+static const int64_t GPS_AID_REQUEST_INTERVAL_US = 30 * 60 * 1000000LL;
+// The polled AID messages take a few seconds to arrive at 9600 baud
+static const int64_t GPS_AID_SAVE_DELAY_US = 10 * 1000000LL;
+// A burst read takes about 0.4 ms at 400 kHz, anything much longer means the bus is stuck
+static const uint32_t SAMPLE_READ_TIMEOUT_MS = 5;
+
+static SampleRing<Sample, 512> sample_ring;
+// Channel mask and ranges are fixed once the tasks start, the schema frame is encoded up front
+static uint8_t capture_channels = MPU6050_CHANNEL_ALL;
+static uint8_t capture_schema[CAPTURE_SCHEMA_LEN];
+static size_t capture_schema_len = 0;
+static TaskHandle_t encode_task_handle = NULL;
+// Every config the sampler applies gets the next generation. The encoder lags behind by at most the sample
+// ring, and the sampler holds back a new config rather than reuse a slot the encoder may still read.
+static const uint8_t CONFIG_SLOTS = 4;
+static DeviceConfig applied_configs[CONFIG_SLOTS];
+static bool applied_rollback[CONFIG_SLOTS];
+static volatile uint8_t encoder_generation = 0;
+// Accepted config waiting for the sampler, and the newest accepted one that config documents build on
+static portMUX_TYPE config_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static DeviceConfig pending_config;
+static bool pending_rollback = false;
+static volatile bool config_pending = false;
+static DeviceConfig latest_config;
+// Newest config the sensor refused outside a rollback, it was never staged so the store does not know it
+static uint32_t rejected_config_version = 0;
+static bool config_trial = false;
+static uint32_t config_trial_version = 0;
+static int64_t config_trial_deadline_us = 0;
+static volatile UploadMode upload_mode = UPLOAD_MODE_AUTO;
+// URLs are only read at boot
+static DeviceConfig boot_config;
+// A new config is rolled back unless a batch recorded with it is acknowledged within this time
+static const int64_t CONFIG_TRIAL_US = 5 * 60 * 1000000LL;
+// Longest vUpload waits for a document, so the trial deadline is checked while there is nothing to send
+static const uint32_t CONFIG_TRIAL_CHECK_MS = 1000;
+// Pause before the sampler retries sensor settings the device rejected during a rollback
+static const uint32_t CONFIG_RETRY_MS = 1000;
+static volatile uint32_t sampler_deadline_misses = 0;
+
 extern const uint8_t pem_start[] asm("_binary_fullchain_pem_start");
 extern const uint8_t pem_end[] asm("_binary_fullchain_pem_end");
 
+static const char *const UPLOAD_URL = "https://linux-vm-southeastasia-2.southeastasia.cloudapp.azure.com/api/upload";
+static const char *const LOCK_URL = "https://linux-vm-southeastasia-2.southeastasia.cloudapp.azure.com/api/lock";
+static const char *const MQTT_URI = "mqtts://linux-vm-southeastasia-2.southeastasia.cloudapp.azure.com:8883";
+static const char *const MQTT_TOPIC_PREFIX = "evr";
+
+// Streaming transport used while connected, HTTPS is kept as the fallback
+static Transport *stream_transport = NULL;
+static Transport *http_transport = NULL;
+
+static DeviceConfig default_config() {
+    DeviceConfig config = {};
+    config.sample_period_ms = DEFAULT_SAMPLE_PERIOD_MS;
+    config.batch_size = DEFAULT_BATCH_SIZE;
+    config.accel_range = DEFAULT_ACCEL_RANGE;
+    config.gyro_range = 0;
+    config.channels = DEFAULT_CHANNEL_MASK;
+    config.upload_mode = UPLOAD_MODE_AUTO;
+    strlcpy(config.upload_url, UPLOAD_URL, sizeof(config.upload_url));
+    strlcpy(config.lock_url, LOCK_URL, sizeof(config.lock_url));
+    strlcpy(config.mqtt_uri, MQTT_URI, sizeof(config.mqtt_uri));
+    return config;
+}
+
+// Queues an accepted config for the sampler, replacing one it has not picked up yet
+static void request_config(const DeviceConfig &config, bool rollback) {
+    taskENTER_CRITICAL(&config_spinlock);
+    pending_config = config;
+    pending_rollback = rollback;
+    latest_config = config;
+    config_pending = true;
+    taskEXIT_CRITICAL(&config_spinlock);
+}
+
+// Runs in the sampler between two reads, the sampler owns the I2C bus. If the device rejects the new
+// settings the old ones are restored. `applied` gets the settings the sensor runs with afterwards, which
+// differ from `current` if the restore failed part way as well.
+static bool apply_sensor_config(const DeviceConfig &current, const DeviceConfig &next, DeviceConfig &applied) {
+    esp_err_t err = mpu.set_acceleration_scale_range(next.accel_range);
+    if (err == ESP_OK) err = mpu.set_gyro_scale_range(next.gyro_range);
+    if (err == ESP_OK) err = mpu.set_channels(next.channels);
+    if (err == ESP_OK) {
+        applied = next;
+        return true;
+    }
+    TRACE_E(TRACE_CONFIG_REJECTED, next.version, err);
+    err = mpu.set_acceleration_scale_range(current.accel_range);
+    if (err == ESP_OK) err = mpu.set_gyro_scale_range(current.gyro_range);
+    if (err == ESP_OK) err = mpu.set_channels(current.channels);
+    if (err != ESP_OK) {
+        // The driver only records a setting once it is written, re-initialise the device with those
+        ESP_LOGE("vReadMPU6050", "Failed to restore config %lu: %s", current.version, esp_err_to_name(err));
+        mpu.recover();
+    }
+    applied = current;
+    applied.accel_range = mpu.get_acceleration_scale_range();
+    applied.gyro_range = mpu.get_gyro_scale_range();
+    applied.channels = mpu.get_channels();
+    return false;
+}
+
+// Runs on core 1 and only samples: formatting and batching happen in vEncode on core 0.
+// The burst read is started first and the previous sample is handed over while the bus is busy, so a
+// sample reaches the encoder one period after it was taken. A new config is applied between two reads.
 void vReadMPU6050(void *pvParameters) {
     TickType_t xLastWakeTime = xTaskGetTickCount();
-    const TickType_t xFrequency = pdMS_TO_TICKS(5);
+    TickType_t xFrequency = pdMS_TO_TICKS(capture_mode ? CONFIG_SENSOR_CAPTURE_SAMPLE_PERIOD_MS
+                                                       : applied_configs[0].sample_period_ms);
     struct timeval tv;
+    Sample sample, previous;
+    sample.sequence = 0;
+    bool has_previous = false;
+    uint8_t next_flags = 0;
+    uint8_t generation = 0;
+    static DeviceConfig next, applied;
+    TickType_t config_retry_at = xLastWakeTime;
 
     while (true) {
-        char *str = (char *)malloc(100 * 200);
-        if (str == NULL) {
-            ESP_LOGE("vReadMPU6050", "Failed to allocate memory for string");
-            ESP_LOGI("vReadMPU6050", "Free heap size: %u", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
-            // vTaskDelay(1000 / portTICK_PERIOD_MS);
-            vTaskDelayUntil(&xLastWakeTime, xFrequency);
-            continue;
-        } else {
-            ESP_LOGD("vReadMPU6050", "Allocated memory for string, free heap size: %u", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+        if (config_pending && (uint8_t)(generation - encoder_generation) < CONFIG_SLOTS - 1 &&
+            (int32_t)(xTaskGetTickCount() - config_retry_at) >= 0) {
+            taskENTER_CRITICAL(&config_spinlock);
+            next = pending_config;
+            bool rollback = pending_rollback;
+            config_pending = false;
+            taskEXIT_CRITICAL(&config_spinlock);
+            const DeviceConfig &current = applied_configs[generation % CONFIG_SLOTS];
+            bool accepted = apply_sensor_config(current, next, applied);
+            if (accepted || applied.accel_range != current.accel_range || applied.gyro_range != current.gyro_range ||
+                applied.channels != current.channels) {
+                // A config the sensor only partly took is published like a rollback, it is not put on trial
+                generation++;
+                applied_configs[generation % CONFIG_SLOTS] = applied;
+                applied_rollback[generation % CONFIG_SLOTS] = rollback || !accepted;
+                xFrequency = pdMS_TO_TICKS(applied.sample_period_ms);
+                TRACE_I(TRACE_CONFIG_APPLIED, applied.version, generation);
+            }
+            if (!accepted && rollback) {
+                // The store has rolled back already, keep at it until the sensor runs the restored settings
+                taskENTER_CRITICAL(&config_spinlock);
+                if (!config_pending) {
+                    pending_config = next;
+                    pending_rollback = true;
+                    config_pending = true;
+                }
+                taskEXIT_CRITICAL(&config_spinlock);
+                config_retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_RETRY_MS);
+            } else if (!accepted) {
+                // Config documents build on what the sensor runs, and the rejected version is not accepted again
+                taskENTER_CRITICAL(&config_spinlock);
+                if (!config_pending) latest_config = applied;
+                if (next.version > rejected_config_version) rejected_config_version = next.version;
+                taskEXIT_CRITICAL(&config_spinlock);
+            }
+            // Start the new schedule from here instead of catching up on the time spent reconfiguring
+            xLastWakeTime = xTaskGetTickCount();
+        }
+        sample.sequence++;
+        sample.config_generation = generation;
+        gettimeofday(&tv, NULL);
+        sample.timestamp_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+        esp_err_t err = mpu.start_read();
+        if (has_previous) {
+            if (!sample_ring.push(previous)) {
+                TRACE_W(TRACE_SAMPLE_RING_OVERRUN, previous.sequence, sample_ring.get_overruns());
+            }
+            xTaskNotifyGive(encode_task_handle);
+        }
+        if (err == ESP_OK) {
+            err = mpu.finish_read(sample.raw, SAMPLE_READ_TIMEOUT_MS);
         }
-        uint64_t pos = 0;
-        long long int start = esp_timer_get_time();
-        for (int i = 0; i < 200; i++) {
-            gettimeofday(&tv, NULL);
-            data.mpu_data = mpu.read();
-            std::string latStr = data.gps_data.position.latitude.has_value() ? std::to_string(data.gps_data.position.latitude.value()) : "";
-            std::string lonStr =
-                data.gps_data.position.longitude.has_value() ? std::to_string(data.gps_data.position.longitude.value()) : "";
-            pos += sprintf(str + pos, "%lld.%ld,%f,%f,%f,%s,%s\n", tv.tv_sec, tv.tv_usec, data.mpu_data.accelerometer.x,
-                           data.mpu_data.accelerometer.y, data.mpu_data.accelerometer.z, latStr.c_str(), lonStr.c_str());
-            vTaskDelayUntil(&xLastWakeTime, xFrequency);
+        sample.flags = next_flags;
+        next_flags = 0;
+        if (err != ESP_OK) {
+            sample.flags |= SAMPLE_FLAG_I2C_ERROR;
+            memset(sample.raw, 0, sizeof(sample.raw));
+            TRACE_E(TRACE_I2C_FAULT, sample.sequence, err, mpu.get_fault_count());
+            err = mpu.recover();
+            TRACE_W(TRACE_I2C_RECOVERED, err, mpu.get_fault_count());
+            next_flags = SAMPLE_FLAG_RECOVERED;
+            // Recovery takes a few hundred milliseconds, resume the schedule instead of catching up
+            xLastWakeTime = xTaskGetTickCount();
         }
-        xQueueSend(data_queue, &str, portMAX_DELAY);
-        long long int end = esp_timer_get_time();
-        long long int diff = end - start;
-        if (diff > 1001000) {
-            ESP_LOGW("vReadMPU6050", "Time taken %lld", diff);
+        previous = sample;
+        has_previous = true;
+        if (xTaskDelayUntil(&xLastWakeTime, xFrequency) == pdFALSE) {
+            sampler_deadline_misses++;
+            TRACE_W(TRACE_SAMPLER_DEADLINE_MISS, sampler_deadline_misses);
         }
     }
 }
 
+// Writes ",lat,lon,speed" for the current estimate. Latitude and longitude are left empty unless the
+// position moved by more than POSITION_EMIT_DISTANCE since the last line that carried them.
+static int format_position(char *buf, size_t len, const std::optional<PositionEstimate> &estimate,
+                           std::optional<PositionEstimate> &emitted) {
+    if (!estimate.has_value()) return snprintf(buf, len, ",,,");
+    if (emitted.has_value() && PositionFilter::distance_metres(emitted->latitude, emitted->longitude, estimate->latitude,
+                                                               estimate->longitude) < POSITION_EMIT_DISTANCE) {
+        return snprintf(buf, len, ",,,%.2f", estimate->speed);
+    }
+    emitted = estimate;
+    return snprintf(buf, len, ",%f,%f,%.2f", estimate->latitude, estimate->longitude, estimate->speed);
+}
+
+// Moves pos past what snprintf wrote into a buffer of len bytes. A cut-off write stops at the terminator,
+// so the space left for the next write never wraps around.
+static size_t advance(size_t pos, int written, size_t len) {
+    if (written < 0) return pos;
+    return pos + written < len ? pos + written : len - 1;
+}
+
+// Names the columns of the sample lines, they follow the channel mask
+static int format_schema(char *buf, size_t len, uint8_t channels) {
+    size_t pos = advance(0, snprintf(buf, len, "#schema,time"), len);
+    for (int channel = 0; channel < MPU6050_CHANNEL_COUNT; channel++) {
+        if (!(channels & (1 << channel))) continue;
+        pos = advance(pos, snprintf(buf + pos, len - pos, ",%s", MPU6050::channel_name(channel)), len);
+    }
+    return advance(pos, snprintf(buf + pos, len - pos, ",lat,lon,speed,flags\n"), len);
+}
+
+// Tags a batch with the track segment and chainage of the current GPS position
+static int format_track_tag(char *buf, size_t len, const GY_NEO6MV2_data &gps_data) {
+    if (!gps_data.position.latitude.has_value() || !gps_data.position.longitude.has_value()) return 0;
+    std::optional<TrackPosition> track =
+        track_index.locate(gps_data.position.latitude.value(), gps_data.position.longitude.value());
+    if (!track.has_value()) return 0;
+    return snprintf(buf, len, "#track,%u,%lu,%.1f\n", track->line_id, track->segment_id, track->chainage_m);
+}
+
+static size_t batch_line_len(uint8_t channels) {
+    return BATCH_LINE_BASE_LEN + BATCH_CHANNEL_LEN * __builtin_popcount(channels);
+}
+
+static size_t batch_buffer_len(const DeviceConfig &config) {
+    return UploadBacklog::HEADER_LEN + BATCH_PREAMBLE_LEN + batch_line_len(config.channels) * config.batch_size;
+}
+
+// Hands a finished batch to the backlog
+static void push_batch(char *str, size_t pos, WindowSummary &window, uint32_t config_version, long long int start,
+                       long long int expected) {
+    if (window.range() > WINDOW_EVENT_RANGE) window.flags |= WINDOW_FLAG_EVENT;
+    // Batches can wait in the backlog for minutes, give back the unused tail of the buffer
+    char *shrunk = (char *)realloc(str, pos + 1);
+    backlog.push(shrunk != NULL ? shrunk : str, pos, window, config_version);
+    long long int diff = esp_timer_get_time() - start;
+    TRACE_D(TRACE_BATCH_ENCODED, pos, diff, heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    if (diff > expected + 1000) {
+        ESP_LOGW("vEncode", "Time taken %lld", diff);
+    }
+}
+
+// Called by the encoder at the first sample taken with a new config, after closing the previous batch. A
+// rollback has been stored by check_config_trial() already.
+static void switch_config(const DeviceConfig &config, bool rollback) {
+    upload_mode = config.upload_mode;
+    if (rollback) {
+        ESP_LOGW("vEncode", "Sampling with config %lu again", config.version);
+        return;
+    }
+    config_store.stage(config);
+    taskENTER_CRITICAL(&config_spinlock);
+    config_trial = true;
+    config_trial_version = config.version;
+    config_trial_deadline_us = esp_timer_get_time() + CONFIG_TRIAL_US;
+    taskEXIT_CRITICAL(&config_spinlock);
+    ESP_LOGI("vEncode", "Config %lu: period %u ms, batch %u, ranges %u/%u, channels 0x%02x, upload %s",
+             config.version, config.sample_period_ms, config.batch_size, config.accel_range, config.gyro_range,
+             config.channels, upload_mode_name(config.upload_mode));
+    if (!config_urls_equal(config, boot_config)) {
+        ESP_LOGW("vEncode", "New URLs take effect after a restart");
+    }
+}
+
+void vEncode(void *pvParameters) {
+    char *str = NULL;
+    size_t pos = 0;
+    int count = 0;
+    long long int start = 0;
+    uint32_t reported_overruns = 0;
+    uint32_t reported_misses = 0;
+    static Sample samples[ENCODE_CHUNK];
+    static MPU6050_data converted[ENCODE_CHUNK];
+    static PositionFilter filter;
+    std::optional<PositionEstimate> emitted;
+    uint32_t last_gps_sequence = 0;
+    WindowSummary window;
+    uint8_t generation = 0;
+    const DeviceConfig *config = &applied_configs[0];
+    uint8_t channels = config->channels;
+    size_t buffer_len = batch_buffer_len(*config);
+    size_t line_len = batch_line_len(channels);
+    float values[MPU6050_CHANNEL_COUNT];
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        size_t n;
+        while ((n = sample_ring.pop_bulk(samples, ENCODE_CHUNK)) > 0) {
+            // Convert each run of samples taken with the same ranges in one call
+            for (size_t first = 0, last; first < n; first = last) {
+                last = first + 1;
+                while (last < n && samples[last].config_generation == samples[first].config_generation) last++;
+                const DeviceConfig &ranges = applied_configs[samples[first].config_generation % CONFIG_SLOTS];
+                // Masked like MPU6050::convert_batch, the table has no entry past range 3
+                MPU6050Convert::batch_kernels[ranges.accel_range & 3][ranges.gyro_range & 3](
+                    samples[first].raw, sizeof(Sample), last - first, converted + first);
+            }
+            taskENTER_CRITICAL(&gps_spinlock);
+            GY_NEO6MV2_data gps_data = data.gps_data;
+            int64_t gps_time_us = data.gps_time_us;
+            uint32_t gps_sequence = data.gps_sequence;
+            taskEXIT_CRITICAL(&gps_spinlock);
+
+            for (size_t i = 0; i < n; i++) {
+                const Sample &sample = samples[i];
+                if (sample.config_generation != generation) {
+                    // New settings start with a new batch
+                    if (str != NULL) {
+                        push_batch(str, pos, window, config->version, start,
+                                   (long long int)count * config->sample_period_ms * 1000);
+                        str = NULL;
+                    }
+                    generation = sample.config_generation;
+                    config = &applied_configs[generation % CONFIG_SLOTS];
+                    channels = config->channels;
+                    buffer_len = batch_buffer_len(*config);
+                    line_len = batch_line_len(channels);
+                    encoder_generation = generation;
+                    switch_config(*config, applied_rollback[generation % CONFIG_SLOTS]);
+                }
+                if (gps_data.position.latitude.has_value() && gps_data.position.longitude.has_value() &&
+                    gps_sequence != last_gps_sequence && gps_time_us <= sample.timestamp_us) {
+                    filter.update(gps_time_us, gps_data.position.latitude.value(), gps_data.position.longitude.value());
+                    last_gps_sequence = gps_sequence;
+                }
+                if (!(sample.flags & SAMPLE_FLAG_I2C_ERROR) && (channels & MPU6050_CHANNEL_ACCEL_X)) {
+                    filter.predict(sample.timestamp_us, converted[i].accelerometer.x);
+                }
+
+                // The preamble ran longer than budgeted, end the batch before a line no longer fits
+                if (str != NULL && buffer_len - pos <= line_len) {
+                    ESP_LOGW("vEncode", "Batch full after %d samples", count);
+                    push_batch(str, pos, window, config->version, start,
+                               (long long int)count * config->sample_period_ms * 1000);
+                    str = NULL;
+                }
+                if (str == NULL) {
+                    str = (char *)malloc(buffer_len);
+                    // Give up old raw data before new data, the backlog keeps its summaries
+                    while (str == NULL && backlog.evict()) {
+                        str = (char *)malloc(buffer_len);
+                    }
+                    if (str == NULL) {
+                        ESP_LOGE("vEncode", "Failed to allocate memory for string");
+                        TRACE_E(TRACE_BATCH_ALLOC_FAILED, heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+                        break;
+                    }
+                    // The backlog writes the sequence header in front of the lines
+                    pos = UploadBacklog::HEADER_LEN;
+                    count = 0;
+                    start = esp_timer_get_time();
+                    window.reset(sample.timestamp_us);
+                    pos = advance(pos, format_track_tag(str + pos, buffer_len - pos, gps_data), buffer_len);
+                    pos = advance(pos, snprintf(str + pos, buffer_len - pos, "#config,%lu\n", config->version),
+                                  buffer_len);
+                    pos = advance(pos, format_schema(str + pos, buffer_len - pos, channels), buffer_len);
+                    // Every batch starts with a full position so it can be decoded on its own
+                    emitted.reset();
+                }
+                size_t line_start = pos;
+                pos = advance(pos,
+                              snprintf(str + pos, buffer_len - pos, "%lld.%06lld", sample.timestamp_us / 1000000,
+                                       sample.timestamp_us % 1000000),
+                              buffer_len);
+                if (sample.flags & SAMPLE_FLAG_I2C_ERROR) {
+                    window.flags |= WINDOW_FLAG_SENSOR_FAULT;
+                    // Keep the timestamp so the gap is visible, leave the readings empty
+                    for (int channel = 0; channel < MPU6050_CHANNEL_COUNT; channel++) {
+                        if (channels & (1 << channel)) {
+                            pos = advance(pos, snprintf(str + pos, buffer_len - pos, ","), buffer_len);
+                        }
+                    }
+                } else {
+                    MPU6050::channel_values(converted[i], values);
+                    for (int channel = 0; channel < MPU6050_CHANNEL_COUNT; channel++) {
+                        if (channels & (1 << channel)) {
+                            pos = advance(pos, snprintf(str + pos, buffer_len - pos, ",%f", values[channel]),
+                                          buffer_len);
+                        }
+                    }
+                    // Summarise the enabled accelerometer axes only, a disabled one reads 0 and adds no range
+                    if (channels & MPU6050_CHANNEL_ACCEL) {
+                        window.add(sample.timestamp_us, channels & MPU6050_CHANNEL_ACCEL_X ? values[0] : 0.0f,
+                                   channels & MPU6050_CHANNEL_ACCEL_Y ? values[1] : 0.0f,
+                                   channels & MPU6050_CHANNEL_ACCEL_Z ? values[2] : 0.0f);
+                    }
+                }
+                pos = advance(pos, format_position(str + pos, buffer_len - pos, filter.estimate(), emitted),
+                              buffer_len);
+                // SAMPLE_FLAG_*, empty when none is set
+                pos = advance(pos,
+                              sample.flags != 0 ? snprintf(str + pos, buffer_len - pos, ",%u\n", sample.flags)
+                                                : snprintf(str + pos, buffer_len - pos, ",\n"),
+                              buffer_len);
+                if (pos == buffer_len - 1) {
+                    // Cut off, longer than BATCH_LINE_BASE_LEN allows for. Drop the partial line and end the batch.
+                    ESP_LOGW("vEncode", "Sample line longer than %u bytes dropped", (unsigned)line_len);
+                    push_batch(str, line_start, window, config->version, start,
+                               (long long int)count * config->sample_period_ms * 1000);
+                    str = NULL;
+                    continue;
+                }
+                if (++count < config->batch_size) continue;
+
+                push_batch(str, pos, window, config->version, start,
+                           (long long int)count * config->sample_period_ms * 1000);
+                str = NULL;
+                uint32_t overruns = sample_ring.get_overruns();
+                uint32_t misses = sampler_deadline_misses;
+                if (overruns != reported_overruns || misses != reported_misses) {
+                    ESP_LOGW("vEncode", "Sample ring overruns: %lu, sampler deadline misses: %lu", overruns, misses);
+                    reported_overruns = overruns;
+                    reported_misses = misses;
+                }
+            }
+        }
+    }
+}
+
+// Replaces vEncode in capture mode: frames raw samples and streams them over UART0.
+// Samples lost to ring overruns show up as gaps in the sequence numbers on the host.
+void vCapture(void *pvParameters) {
+    static Sample samples[ENCODE_CHUNK];
+    static uint8_t frames[CAPTURE_SCHEMA_LEN + ENCODE_CHUNK * CAPTURE_SAMPLE_MAX_LEN];
+    uint32_t since_schema = CAPTURE_SCHEMA_INTERVAL;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        size_t n;
+        while ((n = sample_ring.pop_bulk(samples, ENCODE_CHUNK)) > 0) {
+            taskENTER_CRITICAL(&gps_spinlock);
+            GY_NEO6MV2_data gps_data = data.gps_data;
+            taskEXIT_CRITICAL(&gps_spinlock);
+            size_t len = 0;
+            if (since_schema >= CAPTURE_SCHEMA_INTERVAL) {
+                memcpy(frames, capture_schema, capture_schema_len);
+                len = capture_schema_len;
+                since_schema = 0;
+            }
+            for (size_t i = 0; i < n; i++) {
+                len += CaptureStream::encode_sample(frames + len, samples[i].sequence, samples[i].timestamp_us,
+                                                    samples[i].raw, capture_channels, samples[i].flags, gps_data);
+            }
+            since_schema += n;
+            capture.write(frames, len);
+        }
+    }
+}
+
+// Feeds the saved aiding data to the receiver, then keeps it up to date while there is a fix
 void vReadGPS(void *pvParameters) {
+    esp_err_t err = gps.restore_aid();
+    if (err != ESP_OK) {
+        ESP_LOGI("vReadGPS", "No aiding data restored (%s), cold start", esp_err_to_name(err));
+    }
     TickType_t xLastWakeTime = xTaskGetTickCount();
     const TickType_t xFrequency = pdMS_TO_TICKS(1);
+    struct timeval tv;
+    bool has_fixed = false;
+    int64_t next_aid_request_us = 0;
+    int64_t aid_save_us = 0;
     while (true) {
         GY_NEO6MV2_data gps_data = gps.read();
+        int64_t now_us = esp_timer_get_time();
+        bool has_fix = gps_data.position.latitude.has_value() && gps_data.position.longitude.has_value();
+        if (has_fix && !has_fixed) {
+            // The receiver is powered up together with the ESP32, so the boot time is the TTFF start
+            has_fixed = true;
+            TRACE_I(TRACE_GPS_TTFF, now_us / 1000, gps.get_aid_injected());
+            ESP_LOGI("vReadGPS", "First fix after %lld ms (%s)", now_us / 1000,
+                     gps.get_aid_injected() ? "aided" : "unaided");
+            next_aid_request_us = now_us + GPS_AID_FIRST_REQUEST_US;
+        }
+        if (has_fix && now_us >= next_aid_request_us) {
+            gps.request_aid();
+            next_aid_request_us = now_us + GPS_AID_REQUEST_INTERVAL_US;
+            aid_save_us = now_us + GPS_AID_SAVE_DELAY_US;
+        }
+        if (aid_save_us != 0 && now_us >= aid_save_us) {
+            gps.save_aid();
+            aid_save_us = 0;
+        }
+        gettimeofday(&tv, NULL);
         taskENTER_CRITICAL(&gps_spinlock);
         data.gps_data = gps_data;
+        data.gps_time_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+        data.gps_sequence++;
         taskEXIT_CRITICAL(&gps_spinlock);
         xTaskDelayUntil(&xLastWakeTime, xFrequency);
     }
 }
 
+// Validates a config document and hands it to the sampler, which applies it between two reads. Config
+// documents can be large and arrive unsolicited, so they are parsed without allocating.
+static void apply_config_document(const char *payload, size_t len) {
+    taskENTER_CRITICAL(&config_spinlock);
+    DeviceConfig base = latest_config;
+    uint32_t rejected = rejected_config_version;
+    taskEXIT_CRITICAL(&config_spinlock);
+    uint32_t failed = config_store.get_failed_version();
+    if (rejected > failed) failed = rejected;
+    DeviceConfig next;
+    char error[64];
+    esp_err_t err = parse_config(payload, len, base, base.version > failed ? base.version : failed, next, error,
+                                 sizeof(error));
+    if (err != ESP_OK) {
+        ESP_LOGW("config", "Config document rejected: %s", error);
+        TRACE_W(TRACE_CONFIG_REJECTED, next.version, err);
+        return;
+    }
+    // Each batch is a single allocation, one the heap cannot hold would only drop samples
+    size_t buffer_len = batch_buffer_len(next);
+    size_t largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (buffer_len > largest_block) {
+        ESP_LOGW("config", "Config document rejected: batches need %u bytes, the largest free block is %u",
+                 (unsigned)buffer_len, (unsigned)largest_block);
+        TRACE_W(TRACE_CONFIG_REJECTED, next.version, ESP_ERR_NO_MEM);
+        return;
+    }
+    request_config(next, false);
+}
+
+// Applies a command document, polled by vLED, pushed by the streaming transport or returned by an upload
+static void apply_command(const char *payload, size_t len) {
+    if (is_config_document(payload, len)) {
+        apply_config_document(payload, len);
+        return;
+    }
+    cJSON *json = cJSON_ParseWithLength(payload, len);
+    if (json == NULL) {
+        ESP_LOGE("vLED", "Error parsing JSON");
+        return;
+    }
+
+    cJSON *locked = cJSON_GetObjectItemCaseSensitive(json, "locked");
+    if (cJSON_IsBool(locked)) {
+        bool lock_state = cJSON_IsTrue(locked);
+        if (lock_state) {
+            ESP_LOGD("vLED", "Locked");
+            gpio_set_level(GPIO_NUM_2, 1);
+        } else {
+            ESP_LOGD("vLED", "Unlocked");
+            gpio_set_level(GPIO_NUM_2, 0);
+        }
+    }
+
+    // {"ack":<sequence>,"session":"<hex>"}, the highest contiguous sequence the server holds
+    cJSON *ack = cJSON_GetObjectItemCaseSensitive(json, "ack");
+    cJSON *session = cJSON_GetObjectItemCaseSensitive(json, "session");
+    if (cJSON_IsNumber(ack) && ack->valuedouble >= 0 && cJSON_IsString(session)) {
+        backlog.acknowledge(strtoul(session->valuestring, NULL, 16), (uint32_t)ack->valuedouble);
+    }
+
+    if (cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(json, "trace_dump"))) {
+        trace_dump();
+    }
+
+    cJSON_Delete(json);
+}
+
 void vLED(void *pvParameter) {
-    const char *const url = "https://linux-vm-southeastasia-2.southeastasia.cloudapp.azure.com/api/lock";
     // const char *const url = "http://192.168.1.102:8080/upload";
     static esp_http_client_config_t config = {
-        .url = url,
+        .url = boot_config.lock_url,
         .cert_pem = (const char *)pem_start,
         .method = HTTP_METHOD_GET,
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
     while (true) {
         vTaskDelay(pdTICKS_TO_MS(1000));
+        // Commands are pushed while a streaming transport is up, only poll when it is down
+        if (stream_transport != NULL && stream_transport->pushes_commands() && stream_transport->is_connected()) {
+            continue;
+        }
         esp_err_t err = esp_http_client_open(client, 0);
         int content_length = esp_http_client_fetch_headers(client);
-        static char buffer[30] = {};
+        // Large enough for a config document, not just the lock state
+        static char buffer[HttpTransport::RESPONSE_LEN] = {};
         bzero(buffer, sizeof(buffer));
         int read_len = esp_http_client_read_response(client, buffer, sizeof(buffer) - 1);
-        
+        if (read_len < 0) continue;
+
         // ESP_LOGI("vLED", "Read length: %d", read_len);
         buffer[read_len] = '\0'; // Null-terminate JSON
+        apply_command(buffer, read_len);
+    }
+}
 
-        // Parse JSON response
-        // ESP_LOGI("vLED", "Received JSON: %s", buffer);
-        cJSON *json = cJSON_Parse(buffer);
-        if (json == NULL) {
-            ESP_LOGE("vLED", "Error parsing JSON");
-            continue;
-        }
+// Ends the trial of `version`, false if a newer config has replaced it meanwhile
+static bool end_config_trial(uint32_t version) {
+    taskENTER_CRITICAL(&config_spinlock);
+    bool current = config_trial && config_trial_version == version;
+    if (current) config_trial = false;
+    taskEXIT_CRITICAL(&config_spinlock);
+    return current;
+}
 
-        cJSON *locked = cJSON_GetObjectItemCaseSensitive(json, "locked");
-        if (cJSON_IsBool(locked)) {
-            bool lock_state = cJSON_IsTrue(locked);
-            if (lock_state) {
-                ESP_LOGD("vLED", "Locked");
-                gpio_set_level(GPIO_NUM_2, 1);
-            } else {
-                ESP_LOGD("vLED", "Unlocked");
-                gpio_set_level(GPIO_NUM_2, 0);
-            }
+// A config on trial is confirmed once the server acknowledges a batch that carries its #config line, and
+// rolled back if that does not happen in time. New URLs are only used after a restart, so a config that
+// changes them restarts the device once its batch is acknowledged and the backlog has drained, and stays
+// on trial until a batch goes through the new URLs (ConfigStore's TRIAL_BOOTED).
+static void check_config_trial() {
+    taskENTER_CRITICAL(&config_spinlock);
+    bool trial = config_trial;
+    uint32_t version = config_trial_version;
+    bool expired = esp_timer_get_time() >= config_trial_deadline_us;
+    taskEXIT_CRITICAL(&config_spinlock);
+    if (!trial) return;
+
+    if (backlog.get_acknowledged_config() >= version) {
+        DeviceConfig current = config_store.get_current();
+        // A newer config was staged meanwhile, its own trial follows
+        if (current.version != version) return;
+        if (!config_urls_equal(current, boot_config)) {
+            // Batches not acknowledged yet would be lost, wait for them unless time is up
+            if (backlog.get_raw_pending() > 0 && !expired) return;
+            TRACE_W(TRACE_CONFIG_RESTART, version);
+            ESP_LOGW("vUpload", "Config %lu works, restarting to switch to its URLs", version);
+            esp_restart();
         }
+        // A failed write is logged by the store; the config still counts as confirmed until the next boot
+        if (!end_config_trial(version) || config_store.confirm(version) == ESP_ERR_INVALID_STATE) return;
+        TRACE_I(TRACE_CONFIG_CONFIRMED, version);
+        ESP_LOGI("vUpload", "Config %lu confirmed", version);
+        return;
+    }
 
-        cJSON_Delete(json);
+    if (!expired || !end_config_trial(version)) return;
+    // Stored before the sampler gets to it, the sensor may refuse the old settings as well. A failed write
+    // still rolls back in memory, and the unconfirmed trial left in NVS is rolled back at a later boot.
+    if (config_store.rollback(version) == ESP_ERR_INVALID_STATE) return;
+    DeviceConfig previous = config_store.get_current();
+    TRACE_W(TRACE_CONFIG_ROLLBACK, version, previous.version);
+    ESP_LOGW("vUpload", "No batch with config %lu was acknowledged, rolling back to %lu", version, previous.version);
+    if (!config_urls_equal(previous, boot_config)) {
+        // On trial after a restart for new URLs, restart again to go back to the old ones
+        TRACE_W(TRACE_CONFIG_RESTART, previous.version);
+        esp_restart();
     }
+    request_config(previous, true);
 }
 
+// Uploads whatever the backlog hands out next. Documents stay in the backlog until the server acknowledges
+// them, failed and unacknowledged ones are handed out again. An HTTPS server that answers without an
+// acknowledgement, like the original endpoint, is taken to have stored the document.
 void vUpload(void *pvParameter) {
-    const char *const url = "https://linux-vm-southeastasia-2.southeastasia.cloudapp.azure.com/api/upload";
-    // const char *const url = "http://192.168.1.102:8080/upload";
-    static esp_http_client_config_t config = {
-        .url = url,
-        .cert_pem = (const char *)pem_start,
-        .method = HTTP_METHOD_POST,
-        // .timeout_ms = 800,
-        .event_handler = NULL,
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
     while (true) {
-        char *str = NULL;
-        xQueueReceive(data_queue, &str, portMAX_DELAY);
-        int len = strlen(str);
-        esp_http_client_open(client, len);
-        esp_http_client_write(client, str, len);
-        esp_err_t err = esp_http_client_perform(client);
-        free(str);
+        UploadItem item;
+        if (!backlog.next(item, pdMS_TO_TICKS(CONFIG_TRIAL_CHECK_MS))) {
+            check_config_trial();
+            continue;
+        }
+        esp_err_t err = ESP_FAIL;
+        UploadMode mode = upload_mode;
+        if (mode != UPLOAD_MODE_HTTP && stream_transport->is_connected()) {
+            err = stream_transport->send_batch(item.data, item.len);
+            TRACE_I(TRACE_UPLOAD_DONE, item.len, err, 0);
+        }
+        bool delivered = false;
+        if (err != ESP_OK && mode != UPLOAD_MODE_STREAM) {
+            uint32_t acknowledgements = backlog.get_acknowledgements();
+            err = http_transport->send_batch(item.data, item.len);
+            TRACE_I(TRACE_UPLOAD_DONE, item.len, err, 1);
+            // A 2xx without an acknowledgement comes from a server that stores what it accepts
+            delivered = err == ESP_OK && backlog.get_acknowledgements() == acknowledgements;
+        }
+        if (delivered) {
+            backlog.delivered(item);
+        } else {
+            backlog.complete(item, err == ESP_OK);
+        }
+        check_config_trial();
+        if (err != ESP_OK) {
+            vTaskDelay(pdMS_TO_TICKS(UPLOAD_RETRY_MS));
+        }
     }
 }
 
@@ -165,12 +798,33 @@ void wait_for_time_sync(void) {
 
 extern "C" void app_main(void) {
     // esp_log_level_set("*", ESP_LOG_DEBUG);
+    trace_init();
     print_chip_info();
 
     int uart_buffer_size = 2048;
-    uart_driver_install(UART_NUM_0, uart_buffer_size, uart_buffer_size, 10, NULL, 0);
-    station.init();
-    station.connect(UART_NUM_0);
+    if (capture_mode) {
+        // UART0 carries the binary stream from here on, keep log output out of it
+        uart_driver_install(UART_NUM_0, uart_buffer_size, CAPTURE_TX_BUFFER_SIZE, 10, NULL, 0);
+        esp_log_level_set("*", ESP_LOG_NONE);
+        // Normally done by the Wi-Fi station, the GPS aiding data lives in NVS
+        nvs_flash_init();
+        ESP_ERROR_CHECK(capture.init(UART_NUM_0, CONFIG_SENSOR_CAPTURE_BAUD_RATE));
+    } else {
+        uart_driver_install(UART_NUM_0, uart_buffer_size, uart_buffer_size, 10, NULL, 0);
+        station.init();
+        station.connect(UART_NUM_0);
+    }
+
+    // Capture mode is configured at build time only
+    boot_config = default_config();
+    if (!capture_mode && config_store.init(boot_config) == ESP_OK) {
+        boot_config = config_store.get_current();
+        if (config_store.in_trial()) {
+            config_trial = true;
+            config_trial_version = boot_config.version;
+            config_trial_deadline_us = esp_timer_get_time() + CONFIG_TRIAL_US;
+        }
+    }
 
     i2c_master_bus_handle_t bus_handle;
     i2c_master_bus_config_t i2c_mst_config = {.i2c_port = I2C_NUM_0,
@@ -178,12 +832,24 @@ extern "C" void app_main(void) {
                                               .scl_io_num = GPIO_NUM_22,
                                               .clk_source = I2C_CLK_SRC_DEFAULT,
                                               .glitch_ignore_cnt = 7,
+                                              .trans_queue_depth = 4,
                                               .flags = {
                                                   .enable_internal_pullup = true,
                                               }};
     ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_mst_config, &bus_handle));
-    mpu.init(bus_handle);
-    mpu.set_acceleration_scale_range(2);
+    mpu.init(bus_handle, true);
+    mpu.set_acceleration_scale_range(boot_config.accel_range);
+    mpu.set_gyro_scale_range(boot_config.gyro_range);
+    if (mpu.set_channels(boot_config.channels) != ESP_OK) {
+        ESP_LOGE("app_main", "Failed to set channel mask 0x%02x", boot_config.channels);
+    }
+    applied_configs[0] = boot_config;
+    applied_configs[0].channels = mpu.get_channels();
+    latest_config = applied_configs[0];
+    upload_mode = boot_config.upload_mode;
+    capture_channels = mpu.get_channels();
+    capture_schema_len = CaptureStream::encode_schema(capture_schema, capture_channels,
+                                                      mpu.get_acceleration_scale_range(), mpu.get_gyro_scale_range());
     uart_config_t gps_uart_config = {
         .baud_rate = 9600,
         .data_bits = UART_DATA_8_BITS,
@@ -195,10 +861,11 @@ extern "C" void app_main(void) {
     ESP_ERROR_CHECK(uart_set_pin(UART_NUM_1, GPIO_NUM_18, GPIO_NUM_19, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
     uart_driver_install(UART_NUM_1, uart_buffer_size, uart_buffer_size, 10, NULL, 0);
     gps.init(UART_NUM_1);
-    data.gps_data = gps.read();
-    data_queue = xQueueCreate(1000, sizeof(char *));
-    if (data_queue == NULL) {
-        ESP_LOGE("app_main", "Failed to create queue");
+    track_index.init();
+    static char device_id[UploadBacklog::DEVICE_ID_LEN + 1];
+    get_device_id(device_id, sizeof(device_id));
+    if (backlog.init(device_id) != ESP_OK) {
+        ESP_LOGE("app_main", "Failed to create upload backlog");
     }
     // spiffs_conf = {
     //     .base_path = "/spiffs",
@@ -219,14 +886,25 @@ extern "C" void app_main(void) {
     // }
     // esp_spiffs_format(spiffs_conf.partition_label);
     // ESP_LOGI("app_main", "SPIFFS mounted");
-    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    esp_sntp_setservername(0, "pool.ntp.org");
-    esp_sntp_setservername(1, "time.google.com");
-    esp_sntp_init();
-    wait_for_time_sync();
+    if (!capture_mode) {
+        esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        esp_sntp_setservername(0, "pool.ntp.org");
+        esp_sntp_setservername(1, "time.google.com");
+        esp_sntp_init();
+        wait_for_time_sync();
+        http_transport = new HttpTransport(boot_config.upload_url, (const char *)pem_start);
+        http_transport->set_command_callback(apply_command);
+        ESP_ERROR_CHECK(http_transport->start());
+        stream_transport =
+            new MqttTransport(boot_config.mqtt_uri, (const char *)pem_start, MQTT_TOPIC_PREFIX, device_id);
+        stream_transport->set_command_callback(apply_command);
+        if (stream_transport->start() != ESP_OK) {
+            ESP_LOGW("app_main", "Streaming transport unavailable, using HTTPS only");
+        }
+    }
     ESP_LOGW("app_main", "RAM left %lu", esp_get_free_heap_size());
-    static StaticTask_t xTaskBuffer1, xTaskBuffer2, xTaskBuffer3, xTaskBuffer4;
-    static StackType_t xStack1[4096], xStack2[4096], xStack3[4096], xStack4[4096];
+    static StaticTask_t xTaskBuffer1, xTaskBuffer2, xTaskBuffer3, xTaskBuffer4, xTaskBuffer5;
+    static StackType_t xStack1[4096], xStack2[4096], xStack3[4096], xStack4[4096], xStack5[4096];
     gpio_config_t io_conf = {};
     io_conf.intr_type = GPIO_INTR_DISABLE;
     io_conf.mode = GPIO_MODE_OUTPUT;
@@ -234,8 +912,15 @@ extern "C" void app_main(void) {
     io_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
     io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
     gpio_config(&io_conf);
+    if (capture_mode) {
+        encode_task_handle = xTaskCreateStaticPinnedToCore(vCapture, "Capture", 4096, NULL, 5, xStack5, &xTaskBuffer5, 0);
+    } else {
+        encode_task_handle = xTaskCreateStaticPinnedToCore(vEncode, "Encode", 4096, NULL, 5, xStack5, &xTaskBuffer5, 0);
+    }
     xTaskCreateStaticPinnedToCore(vReadMPU6050, "ReadMPU6050", 4096, NULL, 5, xStack1, &xTaskBuffer1, 1);
     xTaskCreateStaticPinnedToCore(vReadGPS, "ReadGPS", 4096, NULL, 4, xStack2, &xTaskBuffer2, 1);
-    xTaskCreateStaticPinnedToCore(vUpload, "UploadFile", 4096, NULL, 5, xStack3, &xTaskBuffer3, 0);
-    xTaskCreateStaticPinnedToCore(vLED, "vLED", 4096, NULL, 4, xStack4, &xTaskBuffer4, 0);
+    if (!capture_mode) {
+        xTaskCreateStaticPinnedToCore(vUpload, "UploadFile", 4096, NULL, 5, xStack3, &xTaskBuffer3, 0);
+        xTaskCreateStaticPinnedToCore(vLED, "vLED", 4096, NULL, 4, xStack4, &xTaskBuffer4, 0);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "position_filter.h"
+
+#include <math.h>
+
+static const double METRES_PER_DEGREE = 111319.49;
+
+PositionFilter::PositionFilter() {
+}
+
+void PositionFilter::reset() {
+    *this = PositionFilter();
+}
+
+void PositionFilter::offset_metres(double latitude, double longitude, float &east, float &north) const {
+    east = (longitude - anchor_longitude) * cos(anchor_latitude * M_PI / 180.0) * METRES_PER_DEGREE;
+    north = (latitude - anchor_latitude) * METRES_PER_DEGREE;
+}
+
+// Moves the anchor to (latitude, longitude) shifted by (east, north) metres
+void PositionFilter::rebase(double latitude, double longitude, float east, float north) {
+    anchor_latitude = latitude + north / METRES_PER_DEGREE;
+    anchor_longitude = longitude + east / (cos(latitude * M_PI / 180.0) * METRES_PER_DEGREE);
+}
+
+float PositionFilter::distance_metres(double latitude0, double longitude0, double latitude1, double longitude1) {
+    double east = (longitude1 - longitude0) * cos(latitude0 * M_PI / 180.0) * METRES_PER_DEGREE;
+    double north = (latitude1 - latitude0) * METRES_PER_DEGREE;
+    return sqrt(east * east + north * north);
+}
+
+void PositionFilter::predict(int64_t time_us, float accel_x) {
+    if (!initialised) return;
+    float dt = (time_us - last_time_us) * 1e-6f;
+    last_time_us = time_us;
+    interval_accel_sum += accel_x;
+    interval_samples++;
+    if (dt <= 0.0f || dt > 1.0f) return;
+
+    // x = F x + B u, with the along-track acceleration sign * (accel_x - bias)
+    float half_dt2 = 0.5f * dt * dt;
+    float accel = accel_sign * (accel_x - x[2]);
+    x[0] += x[1] * dt + half_dt2 * accel;
+    x[1] += dt * accel;
+
+    // P = F P F^T + Q, the constant-velocity model needs more process noise to follow acceleration
+    float accel_variance = accel_sign != 0.0f ? ACCEL_VARIANCE : UNMODELLED_ACCEL_VARIANCE;
+    float F[3][3] = {{1.0f, dt, -accel_sign * half_dt2}, {0.0f, 1.0f, -accel_sign * dt}, {0.0f, 0.0f, 1.0f}};
+    float FP[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            FP[i][j] = F[i][0] * P[0][j] + F[i][1] * P[1][j] + F[i][2] * P[2][j];
+        }
+    }
+    float G[3] = {half_dt2, dt, 0.0f};
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            P[i][j] = FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + FP[i][2] * F[j][2] + accel_variance * G[i] * G[j];
+        }
+    }
+    P[2][2] += BIAS_DRIFT * dt;
+}
+
+void PositionFilter::update(int64_t time_us, double latitude, double longitude) {
+    if (!initialised) {
+        anchor_latitude = last_fix_latitude = latitude;
+        anchor_longitude = last_fix_longitude = longitude;
+        x[0] = x[1] = x[2] = 0.0f;
+        P[0][0] = GPS_VARIANCE;
+        P[1][1] = 4.0f;
+        P[2][2] = 0.25f;
+        last_time_us = last_fix_us = time_us;
+        initialised = true;
+        return;
+    }
+    float dt = (time_us - last_fix_us) * 1e-6f;
+
+    // Heading follows the direction of motion between fixes, keeping its sign continuous
+    float last_east, last_north, east, north;
+    offset_metres(last_fix_latitude, last_fix_longitude, last_east, last_north);
+    offset_metres(latitude, longitude, east, north);
+    float move_east = east - last_east;
+    float move_north = north - last_north;
+    float moved = sqrtf(move_east * move_east + move_north * move_north);
+    if (moved > MIN_HEADING_DISTANCE) {
+        float new_east = move_east / moved;
+        float new_north = move_north / moved;
+        if (heading_valid) {
+            if (new_east * heading_east + new_north * heading_north < 0.0f) {
+                new_east = -new_east;
+                new_north = -new_north;
+            }
+            // Smooth out GPS noise, the heading error is what drifts the dead-reckoned position sideways
+            new_east = heading_east + HEADING_SMOOTHING * (new_east - heading_east);
+            new_north = heading_north + HEADING_SMOOTHING * (new_north - heading_north);
+            float norm = sqrtf(new_east * new_east + new_north * new_north);
+            new_east /= norm;
+            new_north /= norm;
+        }
+        // Re-anchor at the current estimate so that s stays consistent with the new heading
+        rebase(anchor_latitude, anchor_longitude, x[0] * heading_east, x[0] * heading_north);
+        x[0] = 0.0f;
+        if (!heading_valid && dt > 0.0f) {
+            x[1] = moved / dt;
+        }
+        heading_east = new_east;
+        heading_north = new_north;
+        heading_valid = true;
+        offset_metres(latitude, longitude, east, north);
+    }
+    if (dt > 0.0f) {
+        learn_accel_sign((move_east * heading_east + move_north * heading_north) / dt, dt);
+    }
+    last_fix_latitude = latitude;
+    last_fix_longitude = longitude;
+    last_fix_us = time_us;
+
+    if (!heading_valid) {
+        // Not moved yet: hold the position at the fix
+        anchor_latitude = latitude;
+        anchor_longitude = longitude;
+        x[0] = x[1] = 0.0f;
+        return;
+    }
+
+    // Scalar Kalman update with H = [1 0 0]
+    float z = east * heading_east + north * heading_north;
+    float innovation = z - x[0];
+    float S = P[0][0] + GPS_VARIANCE;
+    float K[3] = {P[0][0] / S, P[1][0] / S, P[2][0] / S};
+    for (int i = 0; i < 3; i++) {
+        x[i] += K[i] * innovation;
+    }
+    float P0[3] = {P[0][0], P[0][1], P[0][2]};
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            P[i][j] -= K[i] * P0[j];
+        }
+    }
+
+    // Take the cross-track position from GPS: anchor the along-track estimate on the fix
+    rebase(latitude, longitude, -z * heading_east, -z * heading_north);
+}
+
+// Learns which way the sensor X axis points along the heading. Over each fix interval the mean
+// accelerometer reading is accel_sign * gps_accel + bias, so the sign of the correlation between the two
+// gives the mounting direction and the intercept gives the gravity bias.
+void PositionFilter::learn_accel_sign(float gps_speed, float dt) {
+    float accel_mean = interval_samples > 0 ? interval_accel_sum / interval_samples : 0.0f;
+    interval_accel_sum = 0.0f;
+    interval_samples = 0;
+    if (heading_valid && last_gps_speed_valid && accel_sign == 0.0f && dt < 5.0f) {
+        float gps_accel = (gps_speed - last_gps_speed) / dt;
+        regression_count++;
+        sum_gps_accel += gps_accel;
+        sum_accel += accel_mean;
+        sum_products += gps_accel * accel_mean;
+        sum_gps_accel_sq += gps_accel * gps_accel;
+        sum_accel_sq += accel_mean * accel_mean;
+        float covariance = sum_products - sum_gps_accel * sum_accel / regression_count;
+        float gps_variance = sum_gps_accel_sq - sum_gps_accel * sum_gps_accel / regression_count;
+        float accel_variance = sum_accel_sq - sum_accel * sum_accel / regression_count;
+        if (regression_count >= MIN_REGRESSION_COUNT && gps_variance > 0.0f && accel_variance > 0.0f) {
+            float correlation = covariance / sqrtf(gps_variance * accel_variance);
+            if (fabsf(correlation) > MIN_CORRELATION) {
+                accel_sign = correlation > 0.0f ? 1.0f : -1.0f;
+                x[2] = (sum_accel - accel_sign * sum_gps_accel) / regression_count;
+            }
+        }
+    }
+    last_gps_speed = gps_speed;
+    last_gps_speed_valid = heading_valid;
+}
+
+std::optional<PositionEstimate> PositionFilter::estimate() const {
+    if (!initialised || last_time_us - last_fix_us > MAX_DEAD_RECKONING_US) return std::nullopt;
+    PositionEstimate estimate;
+    float east = x[0] * heading_east;
+    float north = x[0] * heading_north;
+    estimate.latitude = anchor_latitude + north / METRES_PER_DEGREE;
+    estimate.longitude = anchor_longitude + east / (cos(anchor_latitude * M_PI / 180.0) * METRES_PER_DEGREE);
+    estimate.speed = fabsf(x[1]);
+    estimate.gps_outage = last_time_us - last_fix_us > OUTAGE_US;
+    return estimate;
+}
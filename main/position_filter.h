@@ -0,0 +1,69 @@
+#pragma once
+
+#include <optional>
+#include <stdint.h>
+
+struct PositionEstimate {
+    double latitude;
+    double longitude;
+    float speed;     // m/s
+    bool gps_outage; // no fix for more than OUTAGE_US, position is dead-reckoned
+};
+
+// Along-track Kalman filter bridging 1 Hz GPS fixes with the 200 Hz accelerometer.
+// State is [s, v, b]: distance from the anchor along the track heading, speed, and accelerometer bias
+// (gravity leaking into the X axis through mounting tilt or track gradient). Cross-track position is
+// taken from GPS at every fix, so the filter only has to model motion along the rails.
+class PositionFilter {
+  private:
+    static constexpr int64_t OUTAGE_US = 2000000;
+    static constexpr int64_t MAX_DEAD_RECKONING_US = 120000000;
+    static constexpr float GPS_VARIANCE = 25.0f;    // (5 m)^2
+    static constexpr float ACCEL_VARIANCE = 0.25f;  // (0.5 m/s^2)^2
+    static constexpr float UNMODELLED_ACCEL_VARIANCE = 1.0f;
+    static constexpr float BIAS_DRIFT = 1e-4f;      // bias random walk, (m/s^2)^2 per second
+    static constexpr float MIN_HEADING_DISTANCE = 5.0f;
+    static constexpr float HEADING_SMOOTHING = 0.2f;
+    static constexpr uint32_t MIN_REGRESSION_COUNT = 30;
+    static constexpr float MIN_CORRELATION = 0.3f;
+
+    bool initialised = false;
+    bool heading_valid = false;
+    double anchor_latitude = 0.0;
+    double anchor_longitude = 0.0;
+    double last_fix_latitude = 0.0;
+    double last_fix_longitude = 0.0;
+    float heading_east = 1.0f;
+    float heading_north = 0.0f;
+    float x[3] = {};
+    float P[3][3] = {};
+    int64_t last_time_us = 0;
+    int64_t last_fix_us = 0;
+
+    // Mounting direction of the sensor X axis relative to the heading, learned from GPS.
+    // Until it is known (accel_sign == 0) the filter runs a constant-velocity model.
+    float accel_sign = 0.0f;
+    float interval_accel_sum = 0.0f;
+    uint32_t interval_samples = 0;
+    // Running sums for regressing the interval accelerometer mean on the GPS acceleration
+    uint32_t regression_count = 0;
+    float sum_gps_accel = 0.0f;
+    float sum_accel = 0.0f;
+    float sum_products = 0.0f;
+    float sum_gps_accel_sq = 0.0f;
+    float sum_accel_sq = 0.0f;
+    float last_gps_speed = 0.0f;
+    bool last_gps_speed_valid = false;
+
+    void offset_metres(double latitude, double longitude, float &east, float &north) const;
+    void learn_accel_sign(float gps_speed, float dt);
+    void rebase(double latitude, double longitude, float east, float north);
+
+  public:
+    PositionFilter();
+    void reset();
+    void predict(int64_t time_us, float accel_x);
+    void update(int64_t time_us, double latitude, double longitude);
+    std::optional<PositionEstimate> estimate() const;
+    static float distance_metres(double latitude0, double longitude0, double latitude1, double longitude1);
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single-producer/single-consumer ring buffer.
+// The producer only writes `head`, the consumer only writes `tail`, so no locks are needed
+// as long as exactly one task pushes and exactly one task pops.
+template <typename T, size_t N> class SampleRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SampleRing capacity must be a power of two");
+
+  private:
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr size_t MASK = N - 1;
+    // Keep the producer and consumer indices on separate cache lines to avoid false sharing
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};
+    alignas(CACHE_LINE) std::atomic<uint32_t> overruns{0};
+    alignas(CACHE_LINE) T buffer[N];
+
+  public:
+    // Producer side. Returns false and counts an overrun if the ring is full.
+    bool push(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N) {
+            overruns.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        buffer[h & MASK] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        item = buffer[t & MASK];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Pops up to `max` items into `out` and returns how many were popped.
+    size_t pop_bulk(T *out, size_t max) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t available = head.load(std::memory_order_acquire) - t;
+        size_t count = available < max ? available : max;
+        for (size_t i = 0; i < count; i++) {
+            out[i] = buffer[(t + i) & MASK];
+        }
+        tail.store(t + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    uint32_t get_overruns() const {
+        return overruns.load(std::memory_order_relaxed);
+    }
+};
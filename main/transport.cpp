@@ -0,0 +1,137 @@
+#include "transport.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+
+HttpTransport::HttpTransport(const char *url, const char *cert_pem) {
+    config = {};
+    config.url = url;
+    config.cert_pem = cert_pem;
+    config.method = HTTP_METHOD_POST;
+}
+
+esp_err_t HttpTransport::start() {
+    client = esp_http_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to initialise HTTP client");
+        return ESP_FAIL;
+    }
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    return ESP_OK;
+}
+
+// HTTP has no persistent session, a request is attempted whenever a batch is sent
+bool HttpTransport::is_connected() {
+    return client != NULL;
+}
+
+esp_err_t HttpTransport::send_batch(const char *data, size_t len) {
+    esp_err_t err = esp_http_client_open(client, len);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "POST failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    int written = esp_http_client_write(client, data, len);
+    if (written != (int)len) {
+        ESP_LOGW(TAG, "POST interrupted after %d of %u bytes", written, len);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    // Content length, or a negative value if the response headers could not be read
+    int64_t content_len = esp_http_client_fetch_headers(client);
+    if (content_len < 0) {
+        ESP_LOGW(TAG, "No response: %lld", content_len);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    int status = esp_http_client_get_status_code(client);
+    char response[RESPONSE_LEN];
+    int read_len = esp_http_client_read_response(client, response, sizeof(response) - 1);
+    esp_http_client_close(client);
+    if (status < 200 || status >= 300) {
+        ESP_LOGW(TAG, "POST returned status %d", status);
+        return ESP_FAIL;
+    }
+    if (read_len > 0 && command_callback != nullptr) {
+        response[read_len] = '\0';
+        command_callback(response, read_len);
+    }
+    return ESP_OK;
+}
+
+MqttTransport::MqttTransport(const char *uri, const char *cert_pem, const char *topic_prefix, const char *device_id) {
+    snprintf(data_topic, sizeof(data_topic), "%s/%s/data", topic_prefix, device_id);
+    snprintf(command_topic, sizeof(command_topic), "%s/%s/cmd", topic_prefix, device_id);
+    config.broker.address.uri = uri;
+    config.broker.verification.certificate = cert_pem;
+    config.credentials.client_id = device_id;
+    config.session.keepalive = 30;
+    config.network.reconnect_timeout_ms = 2000;
+}
+
+esp_err_t MqttTransport::start() {
+    client = esp_mqtt_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to initialise MQTT client");
+        return ESP_FAIL;
+    }
+    esp_err_t err = esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, &event_handler, this);
+    if (err == ESP_OK) err = esp_mqtt_client_start(client);
+    if (err != ESP_OK) {
+        // The caller falls back to HTTP
+        ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
+        esp_mqtt_client_destroy(client);
+        client = NULL;
+    }
+    return err;
+}
+
+bool MqttTransport::is_connected() {
+    return connected;
+}
+
+// Returns ESP_OK once the QoS 1 publish is queued in the client's outbox, without waiting for the PUBACK.
+// The broker may still lose it, but the document stays in the backlog until the server acknowledges it on
+// the command topic and is handed out again otherwise, so waiting for MQTT_EVENT_PUBLISHED would only add
+// a round trip per batch.
+esp_err_t MqttTransport::send_batch(const char *data, size_t len) {
+    if (!connected) return ESP_ERR_INVALID_STATE;
+    int msg_id = esp_mqtt_client_publish(client, data_topic, data, len, 1, 0);
+    if (msg_id < 0) {
+        ESP_LOGW(TAG, "Publish failed");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void MqttTransport::event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    MqttTransport *self = (MqttTransport *)arg;
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(self->TAG, "Connected, subscribing to %s", self->command_topic);
+        esp_mqtt_client_subscribe(self->client, self->command_topic, 1);
+        self->connected = true;
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGW(self->TAG, "Disconnected");
+        self->connected = false;
+        break;
+    case MQTT_EVENT_DATA:
+        // Commands are small, ignore anything that arrives fragmented
+        if (event->current_data_offset == 0 && event->data_len == event->total_data_len &&
+            self->command_callback != nullptr) {
+            self->command_callback(event->data, event->data_len);
+        }
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGE(self->TAG, "MQTT error");
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_http_client.h"
+#include "mqtt_client.h"
+
+// Called with a JSON command document pushed by the server, e.g. {"locked":true}
+typedef void (*transport_command_cb_t)(const char *payload, size_t len);
+
+// Carries sensor batches upstream and, for streaming transports, commands downstream
+class Transport {
+  protected:
+    transport_command_cb_t command_callback = nullptr;
+
+  public:
+    virtual ~Transport() = default;
+    virtual esp_err_t start() = 0;
+    virtual bool is_connected() = 0;
+    // ESP_OK means the batch was handed to the server or, for MQTT, queued for it. Delivery is only known
+    // from the server's acknowledgement (main/upload_backlog.h).
+    virtual esp_err_t send_batch(const char *data, size_t len) = 0;
+    // True if commands arrive through the command callback instead of having to be polled
+    virtual bool pushes_commands() = 0;
+    void set_command_callback(transport_command_cb_t callback) {
+        command_callback = callback;
+    }
+};
+
+// One HTTPS POST per batch. The response body, e.g. an acknowledgement, is passed to the command callback.
+class HttpTransport : public Transport {
+  private:
+    const char *TAG = "HttpTransport";
+    esp_http_client_config_t config;
+    esp_http_client_handle_t client = NULL;
+
+  public:
+    // Room for a config document in place of the acknowledgement, also used for polled commands
+    static const int RESPONSE_LEN = 512;
+    HttpTransport(const char *url, const char *cert_pem);
+    esp_err_t start() override;
+    bool is_connected() override;
+    esp_err_t send_batch(const char *data, size_t len) override;
+    bool pushes_commands() override {
+        return false;
+    }
+};
+
+// Persistent MQTT over TLS connection. Batches are published with QoS 1 on <prefix>/<device>/data and
+// commands are received on <prefix>/<device>/cmd.
+class MqttTransport : public Transport {
+  private:
+    const char *TAG = "MqttTransport";
+    static const int TOPIC_LEN = 64;
+    esp_mqtt_client_config_t config = {};
+    esp_mqtt_client_handle_t client = NULL;
+    char data_topic[TOPIC_LEN];
+    char command_topic[TOPIC_LEN];
+    volatile bool connected = false;
+    static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+  public:
+    MqttTransport(const char *uri, const char *cert_pem, const char *topic_prefix, const char *device_id);
+    esp_err_t start() override;
+    bool is_connected() override;
+    esp_err_t send_batch(const char *data, size_t len) override;
+    bool pushes_commands() override {
+        return true;
+    }
+};
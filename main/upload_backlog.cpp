@@ -0,0 +1,406 @@
+#include "upload_backlog.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "freertos/task.h"
+#include "trace.h"
+
+void WindowSummary::reset(int64_t time_us) {
+    start_us = time_us;
+    duration_ms = 0;
+    count = 0;
+    flags = 0;
+    for (int i = 0; i < 3; i++) {
+        min[i] = INFINITY;
+        max[i] = -INFINITY;
+        mean[i] = 0.0f;
+    }
+}
+
+void WindowSummary::add(int64_t time_us, float x, float y, float z) {
+    const float values[3] = {x, y, z};
+    count++;
+    for (int i = 0; i < 3; i++) {
+        if (values[i] < min[i]) min[i] = values[i];
+        if (values[i] > max[i]) max[i] = values[i];
+        mean[i] += (values[i] - mean[i]) / count;
+    }
+    duration_ms = (time_us - start_us) / 1000;
+}
+
+void WindowSummary::merge(const WindowSummary &other) {
+    int64_t end_us = start_us + (int64_t)duration_ms * 1000;
+    int64_t other_end_us = other.start_us + (int64_t)other.duration_ms * 1000;
+    if (other.start_us < start_us) start_us = other.start_us;
+    duration_ms = ((other_end_us > end_us ? other_end_us : end_us) - start_us) / 1000;
+    uint32_t total = count + other.count;
+    for (int i = 0; i < 3; i++) {
+        if (other.min[i] < min[i]) min[i] = other.min[i];
+        if (other.max[i] > max[i]) max[i] = other.max[i];
+        if (total > 0) mean[i] = (mean[i] * count + other.mean[i] * other.count) / total;
+    }
+    count = total;
+    flags |= other.flags;
+}
+
+// Largest peak-to-peak range over the three axes
+float WindowSummary::range() const {
+    if (count == 0) return 0.0f;
+    float largest = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        if (max[i] - min[i] > largest) largest = max[i] - min[i];
+    }
+    return largest;
+}
+
+UploadBacklog::UploadBacklog() {
+}
+
+esp_err_t UploadBacklog::init(const char *device_id) {
+    if (strlen(device_id) != DEVICE_ID_LEN) {
+        ESP_LOGE(TAG, "Device ID must be %d characters", (int)DEVICE_ID_LEN);
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->device_id = device_id;
+    session = esp_random();
+    lock = xSemaphoreCreateMutex();
+    available = xSemaphoreCreateBinary();
+    if (lock == NULL || available == NULL) {
+        ESP_LOGE(TAG, "Failed to create semaphores");
+        return ESP_ERR_NO_MEM;
+    }
+    uint32_t offset = 0;
+    for (int level = 0; level < LEVELS; level++) {
+        levels[level].ring = &summary_pool[offset];
+        offset += LEVEL_CONFIG[level].capacity;
+    }
+    ESP_LOGI(TAG, "Upload session %08lx", session);
+    return ESP_OK;
+}
+
+void UploadBacklog::append_summary(int level, const WindowSummary &summary) {
+    Level &l = levels[level];
+    uint32_t capacity = LEVEL_CONFIG[level].capacity;
+    l.ring[l.head % capacity] = summary;
+    l.head++;
+    // The ring overwrote the oldest pending summary, the level above still covers it
+    if (l.head - l.cursor > capacity) l.cursor = l.head - capacity;
+}
+
+// Folds a batch summary into the coarse levels, completing windows as they fill up. Level 0 only
+// receives the summaries of evicted batches, the others are covered by the raw data.
+void UploadBacklog::add_summary(const WindowSummary &summary) {
+    for (int level = 1; level < LEVELS; level++) {
+        Level &l = levels[level];
+        if (l.partial_batches == 0) {
+            l.partial = summary;
+        } else {
+            l.partial.merge(summary);
+        }
+        if (++l.partial_batches < LEVEL_CONFIG[level].window_batches) continue;
+        append_summary(level, l.partial);
+        l.partial_batches = 0;
+    }
+}
+
+UploadBacklog::Document *UploadBacklog::free_slot() {
+    for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+        if (documents[i].state == FREE) return &documents[i];
+    }
+    return NULL;
+}
+
+void UploadBacklog::release(Document &document) {
+    free(document.data);
+    if (!document.summary) raw_pending--;
+    document = {};
+}
+
+void UploadBacklog::release_acknowledged(Document &document) {
+    if (document.config_version > acknowledged_config) acknowledged_config = document.config_version;
+    release(document);
+}
+
+// Only batches that never went out can be evicted, a sent sequence has to be delivered eventually
+bool UploadBacklog::evict_locked() {
+    Document *victim = NULL;
+    for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+        Document &document = documents[i];
+        if (document.state != QUEUED || document.has_sequence || document.summary) continue;
+        if (victim == NULL) {
+            victim = &document;
+            continue;
+        }
+        // Prefer unflagged batches, then the oldest
+        bool flagged = document.window.flags != 0, victim_flagged = victim->window.flags != 0;
+        if (flagged != victim_flagged ? !flagged : document.id < victim->id) victim = &document;
+    }
+    if (victim == NULL) return false;
+    TRACE_W(TRACE_BACKLOG_EVICTED, victim->id, victim->window.flags, raw_pending);
+    append_summary(0, victim->window);
+    release(*victim);
+    evictions++;
+    behind = true;
+    return true;
+}
+
+void UploadBacklog::push(char *data, size_t len, const WindowSummary &summary, uint32_t config_version) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    add_summary(summary);
+    if (raw_pending >= RAW_CAPACITY) evict_locked();
+    Document *document = raw_pending < RAW_CAPACITY ? free_slot() : NULL;
+    if (document != NULL) {
+        *document = {data, len, next_id++, 0, false, false, QUEUED, 0, summary, config_version};
+        raw_pending++;
+    } else {
+        // Every slot is waiting for an acknowledgement
+        TRACE_E(TRACE_BACKLOG_DROPPED, raw_pending);
+        ESP_LOGE(TAG, "Batch dropped, %u batches wait for an acknowledgement", (unsigned)raw_pending);
+        append_summary(0, summary);
+        free(data);
+        behind = true;
+    }
+    if (raw_pending > BEHIND_THRESHOLD) behind = true;
+    if (!behind) {
+        // The raw batches cover these windows
+        for (int level = 0; level < LEVELS; level++) {
+            levels[level].cursor = levels[level].head;
+        }
+    }
+    xSemaphoreGive(lock);
+    xSemaphoreGive(available);
+}
+
+bool UploadBacklog::evict() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool evicted = evict_locked();
+    xSemaphoreGive(lock);
+    return evicted;
+}
+
+// Turns the next chunk of pending summaries, coarsest level first, into a document
+void UploadBacklog::queue_summaries() {
+    for (int level = LEVELS - 1; level >= 0; level--) {
+        Level &l = levels[level];
+        if (l.cursor == l.head) continue;
+        Document *document = free_slot();
+        if (document == NULL) return;
+        char *data = (char *)malloc(HEADER_LEN + SUMMARY_TEXT_LEN);
+        if (data == NULL) return;
+        WindowSummary chunk[SUMMARY_CHUNK];
+        uint32_t count = l.head - l.cursor;
+        if (count > SUMMARY_CHUNK) count = SUMMARY_CHUNK;
+        for (uint32_t i = 0; i < count; i++) {
+            chunk[i] = l.ring[(l.cursor + i) % LEVEL_CONFIG[level].capacity];
+        }
+        size_t len = HEADER_LEN + format_summaries(data + HEADER_LEN, SUMMARY_TEXT_LEN, level, chunk, count);
+        char *shrunk = (char *)realloc(data, len);
+        *document = {shrunk != NULL ? shrunk : data, len, next_id++, 0, false, true, QUEUED, 0, {}};
+        l.cursor += count;
+        return;
+    }
+}
+
+void UploadBacklog::write_header(Document &document) {
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)document.data + HEADER_LEN, document.len - HEADER_LEN);
+    char header[HEADER_LEN + 1];
+    snprintf(header, sizeof(header), "#batch,%s,%08lx,%010lu,%08lx\n", device_id, session, document.sequence, crc);
+    memcpy(document.data, header, HEADER_LEN);
+}
+
+// Documents to resend go first, oldest sequence first, so the acknowledged range can advance. Then
+// summaries while behind, then flagged batches, then the newest.
+bool UploadBacklog::select(UploadItem &item) {
+    Document *best = NULL;
+    Document *oldest = NULL;
+    bool has_summary = false;
+    for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+        Document &document = documents[i];
+        if (document.has_sequence && (oldest == NULL || document.sequence < oldest->sequence)) oldest = &document;
+        if (document.state != QUEUED) continue;
+        has_summary |= document.summary && !document.has_sequence;
+        if (document.has_sequence && (best == NULL || document.sequence < best->sequence)) best = &document;
+    }
+    // Acknowledgements are cumulative, so only the first gap is known to be missing. Resend just that
+    // document; the acknowledgement it draws covers whatever the server already holds after it.
+    if (best == NULL && oldest != NULL && oldest->state == SENT &&
+        xTaskGetTickCount() - oldest->sent_at > pdMS_TO_TICKS(ACK_TIMEOUT_MS)) {
+        best = oldest;
+        resends++;
+    }
+    if (best == NULL) {
+        if (behind && !has_summary) queue_summaries();
+        for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+            Document &document = documents[i];
+            if (document.state != QUEUED) continue;
+            if (best == NULL) {
+                best = &document;
+                continue;
+            }
+            bool flagged = document.window.flags != 0, best_flagged = best->window.flags != 0;
+            if (document.summary != best->summary) {
+                if (document.summary) best = &document;
+            } else if (document.summary ? document.id < best->id
+                                        : flagged != best_flagged ? flagged : document.id > best->id) {
+                best = &document;
+            }
+        }
+    }
+    if (best == NULL) return false;
+    if (!best->has_sequence) {
+        best->sequence = next_sequence++;
+        best->has_sequence = true;
+        write_header(*best);
+    }
+    best->state = IN_FLIGHT;
+    item.data = best->data;
+    item.len = best->len;
+    item.sequence = best->sequence;
+    return true;
+}
+
+bool UploadBacklog::next(UploadItem &item, TickType_t timeout) {
+    while (true) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool found = select(item);
+        xSemaphoreGive(lock);
+        if (found) return true;
+        // Wake up for resends even if nothing new is pushed
+        TickType_t wait = timeout < pdMS_TO_TICKS(ACK_TIMEOUT_MS) ? timeout : pdMS_TO_TICKS(ACK_TIMEOUT_MS);
+        if (xSemaphoreTake(available, wait) != pdTRUE && wait == timeout) return false;
+    }
+}
+
+void UploadBacklog::complete(const UploadItem &item, bool sent) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+        Document &document = documents[i];
+        if (document.state != IN_FLIGHT || document.sequence != item.sequence) continue;
+        if (has_acknowledged && document.sequence <= acknowledged) {
+            // The acknowledgement arrived while the document was still being sent
+            release_acknowledged(document);
+        } else if (sent) {
+            document.state = SENT;
+            document.sent_at = xTaskGetTickCount();
+            limit_unacknowledged();
+        } else {
+            document.state = QUEUED;
+            behind = true;
+        }
+        break;
+    }
+    update_behind();
+    xSemaphoreGive(lock);
+}
+
+void UploadBacklog::delivered(const UploadItem &item) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+        Document &document = documents[i];
+        if (document.state != IN_FLIGHT || document.sequence != item.sequence) continue;
+        release_acknowledged(document);
+        break;
+    }
+    update_behind();
+    xSemaphoreGive(lock);
+}
+
+// Without acknowledgements the oldest sent document would never leave, releases it once too many wait
+void UploadBacklog::limit_unacknowledged() {
+    while (true) {
+        Document *oldest = NULL;
+        size_t waiting = 0;
+        for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+            Document &document = documents[i];
+            if (document.state != SENT) continue;
+            waiting++;
+            if (oldest == NULL || document.sequence < oldest->sequence) oldest = &document;
+        }
+        if (waiting <= MAX_UNACKNOWLEDGED) return;
+        TRACE_W(TRACE_BACKLOG_UNACKNOWLEDGED, oldest->sequence);
+        release(*oldest);
+    }
+}
+
+void UploadBacklog::acknowledge(uint32_t session, uint32_t sequence) {
+    if (session != this->session) return;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    acknowledgements++;
+    if (!has_acknowledged || sequence > acknowledged) {
+        acknowledged = sequence;
+        has_acknowledged = true;
+    }
+    for (int i = 0; i < DOCUMENT_CAPACITY; i++) {
+        Document &document = documents[i];
+        // A document being sent is released by complete(), the uploader still holds its buffer
+        if (document.state == FREE || document.state == IN_FLIGHT || !document.has_sequence) continue;
+        if (document.sequence <= acknowledged) release_acknowledged(document);
+    }
+    TRACE_D(TRACE_UPLOAD_ACK, acknowledged, raw_pending);
+    update_behind();
+    xSemaphoreGive(lock);
+}
+
+void UploadBacklog::update_behind() {
+    if (!behind || raw_pending > 0) return;
+    for (int level = 0; level < LEVELS; level++) {
+        if (levels[level].cursor != levels[level].head) return;
+    }
+    ESP_LOGI(TAG, "Backlog drained");
+    behind = false;
+}
+
+uint32_t UploadBacklog::get_acknowledged_config() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t version = acknowledged_config;
+    xSemaphoreGive(lock);
+    return version;
+}
+
+uint32_t UploadBacklog::get_acknowledgements() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t count = acknowledgements;
+    xSemaphoreGive(lock);
+    return count;
+}
+
+size_t UploadBacklog::get_raw_pending() {
+    return raw_pending;
+}
+
+uint32_t UploadBacklog::get_session() {
+    return session;
+}
+
+uint32_t UploadBacklog::get_evictions() {
+    return evictions;
+}
+
+uint32_t UploadBacklog::get_resends() {
+    return resends;
+}
+
+// Writes "#summary,<level>" followed by one line per window:
+// start,duration_ms,count,flags,min x/y/z,max x/y/z,mean x/y/z
+size_t UploadBacklog::format_summaries(char *buf, size_t len, uint8_t level, const WindowSummary *summaries,
+                                       size_t count) {
+    size_t pos = snprintf(buf, len, "#summary,%u\n", level);
+    for (size_t i = 0; i < count && pos < len; i++) {
+        const WindowSummary &s = summaries[i];
+        if (s.count == 0) {
+            pos += snprintf(buf + pos, len - pos, "%lld.%06lld,%lu,0,%u,,,,,,,,,\n", s.start_us / 1000000,
+                            s.start_us % 1000000, s.duration_ms, s.flags);
+            continue;
+        }
+        pos += snprintf(buf + pos, len - pos, "%lld.%06lld,%lu,%lu,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                        s.start_us / 1000000, s.start_us % 1000000, s.duration_ms, s.count, s.flags, s.min[0],
+                        s.min[1], s.min[2], s.max[0], s.max[1], s.max[2], s.mean[0], s.mean[1], s.mean[2]);
+    }
+    return pos < len ? pos : len - 1;
+}
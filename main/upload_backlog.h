@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// The window contained samples that could not be read from the sensor
+static const uint8_t WINDOW_FLAG_SENSOR_FAULT = 0x01;
+// The acceleration range in the window exceeded the event threshold, e.g. a rough joint or hard braking
+static const uint8_t WINDOW_FLAG_EVENT = 0x02;
+
+// Min/max/mean of the accelerometer axes over a time window
+struct WindowSummary {
+    int64_t start_us;
+    uint32_t duration_ms;
+    uint32_t count;
+    uint8_t flags;
+    float min[3];
+    float max[3];
+    float mean[3];
+
+    void reset(int64_t time_us);
+    void add(int64_t time_us, float x, float y, float z);
+    void merge(const WindowSummary &other);
+    float range() const;
+};
+
+// A document handed to the uploader, owned by the backlog until acknowledge() covers its sequence
+struct UploadItem {
+    const char *data;
+    size_t len;
+    uint32_t sequence;
+};
+
+// Replaces a FIFO of batches. Every batch is also folded into a pyramid of window summaries (10 and 60
+// batches per window). While the uploader keeps up, summaries are dropped and batches go out as they come.
+// Once it falls behind, next() hands out the pending summaries coarsest level first, so the whole gap is
+// covered quickly, then raw batches with flagged windows first and newest first. When memory runs out the
+// oldest unflagged raw batch is evicted and its own summary takes its place on level 0.
+//
+// Every document starts with a fixed-width header line:
+//     #batch,<device id>,<session>,<sequence>,<crc32>
+// The sequence is assigned when a document is first sent, so sequences are contiguous in send order. The
+// session is random per boot and the CRC-32 covers everything after the header. The server acknowledges
+// the highest contiguous sequence it holds, which also acknowledges the config versions the covered batches
+// were recorded with. Documents stay here until acknowledged; the oldest one is resent with the same
+// sequence when no acknowledgement covers it within ACK_TIMEOUT_MS. A server that does not acknowledge
+// reports delivery through delivered() instead, and past MAX_UNACKNOWLEDGED sent documents the oldest is
+// released unacknowledged, so such a server cannot fill every slot.
+class UploadBacklog {
+  private:
+    const char *TAG = "UploadBacklog";
+    static const int LEVELS = 3;
+    static const int DOCUMENT_CAPACITY = 64;
+    // The remaining slots are kept for summary documents
+    static const size_t RAW_CAPACITY = 60;
+    // More pending batches than this means the uploader is not keeping up
+    static const size_t BEHIND_THRESHOLD = 2;
+    static const uint32_t ACK_TIMEOUT_MS = 10000;
+    // Sent documents waiting for an acknowledgement, three timeouts' worth of batches at the default rate
+    static const size_t MAX_UNACKNOWLEDGED = 30;
+    // Window summaries per document, keeps the formatted text within SUMMARY_TEXT_LEN
+    static const size_t SUMMARY_CHUNK = 24;
+    static const size_t SUMMARY_TEXT_LEN = 4096;
+    struct LevelConfig {
+        uint32_t window_batches;
+        uint32_t capacity;
+    };
+    static constexpr LevelConfig LEVEL_CONFIG[LEVELS] = {{1, 120}, {10, 60}, {60, 120}};
+    static constexpr uint32_t SUMMARY_CAPACITY =
+        LEVEL_CONFIG[0].capacity + LEVEL_CONFIG[1].capacity + LEVEL_CONFIG[2].capacity;
+
+    enum DocumentState : uint8_t { FREE, QUEUED, IN_FLIGHT, SENT };
+    struct Document {
+        char *data; // header followed by the payload
+        size_t len;
+        uint32_t id;       // push order
+        uint32_t sequence; // assigned on the first send
+        bool has_sequence;
+        bool summary;
+        DocumentState state;
+        TickType_t sent_at;
+        WindowSummary window;
+        uint32_t config_version; // zero for summaries
+    };
+    struct Level {
+        WindowSummary *ring;
+        uint32_t head;   // summaries written, the ring holds head - capacity .. head - 1
+        uint32_t cursor; // first summary not uploaded yet
+        WindowSummary partial;
+        uint32_t partial_batches;
+    };
+
+    Document documents[DOCUMENT_CAPACITY] = {};
+    size_t raw_pending = 0;
+    uint32_t next_id = 0;
+    uint32_t next_sequence = 0;
+    // Highest contiguous sequence the server holds
+    uint32_t acknowledged = 0;
+    bool has_acknowledged = false;
+    uint32_t acknowledged_config = 0;
+    uint32_t acknowledgements = 0;
+    uint32_t session = 0;
+    const char *device_id = NULL;
+    WindowSummary summary_pool[SUMMARY_CAPACITY];
+    Level levels[LEVELS] = {};
+    bool behind = false;
+    uint32_t evictions = 0;
+    uint32_t resends = 0;
+    SemaphoreHandle_t lock = NULL;
+    SemaphoreHandle_t available = NULL;
+
+    void append_summary(int level, const WindowSummary &summary);
+    void add_summary(const WindowSummary &summary);
+    Document *free_slot();
+    bool evict_locked();
+    void queue_summaries();
+    void write_header(Document &document);
+    bool select(UploadItem &item);
+    void release(Document &document);
+    void release_acknowledged(Document &document);
+    void limit_unacknowledged();
+    void update_behind();
+
+  public:
+    static const size_t DEVICE_ID_LEN = 12;
+    // "#batch," device id ",xxxxxxxx,dddddddddd,xxxxxxxx\n"
+    static const size_t HEADER_LEN = 7 + DEVICE_ID_LEN + 1 + 8 + 1 + 10 + 1 + 8 + 1;
+
+    UploadBacklog();
+    esp_err_t init(const char *device_id);
+    // Takes ownership of `data`, which must come from malloc and start with HEADER_LEN bytes left free.
+    // `config_version` is the config the batch was recorded with.
+    void push(char *data, size_t len, const WindowSummary &summary, uint32_t config_version);
+    // Frees the oldest unflagged batch that was never sent, false if there is nothing to evict
+    bool evict();
+    bool next(UploadItem &item, TickType_t timeout);
+    void complete(const UploadItem &item, bool sent);
+    // The server took the document without acknowledging it, e.g. a 2xx with an empty body
+    void delivered(const UploadItem &item);
+    // Releases every document up to and including `sequence`, acknowledgements for other sessions are stale
+    void acknowledge(uint32_t session, uint32_t sequence);
+    // Highest config version of an acknowledged batch, zero before the first
+    uint32_t get_acknowledged_config();
+    // Acknowledgements received for this session, to tell whether a response carried one
+    uint32_t get_acknowledgements();
+    size_t get_raw_pending();
+    uint32_t get_session();
+    uint32_t get_evictions();
+    uint32_t get_resends();
+    static size_t format_summaries(char *buf, size_t len, uint8_t level, const WindowSummary *summaries,
+                                   size_t count);
+};
@@ -7,6 +7,7 @@
 #include "driver/uart.h"
 #include "esp_chip_info.h"
 #include "esp_flash.h"
+#include "esp_mac.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -41,6 +42,13 @@ void print_chip_info() {
            esp_get_minimum_free_heap_size());
 }
 
+// Device ID derived from the factory-programmed base MAC address
+void get_device_id(char *buf, size_t len) {
+    uint8_t mac[6];
+    esp_efuse_mac_get_default(mac);
+    snprintf(buf, len, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
 void get_string_from_uart(uart_port_t uart_num, char *buf,
                           size_t len, bool echo) {
     int index = 0;
@@ -3,4 +3,5 @@
 #include "driver/uart.h"
 
 void print_chip_info();
+void get_device_id(char *buf, size_t len);
 void get_string_from_uart(uart_port_t uart_num, char *buf, size_t len, bool echo);
\ No newline at end of file
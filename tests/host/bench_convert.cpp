@@ -0,0 +1,50 @@
+// Cost per sample of the scalar MPU6050::convert against the batch kernels, on bursts laid out with the
+// stride of the sample ring
+#include "host_test.h"
+#include "mpu6050.h"
+#include "mpu6050_convert.h"
+#include "sim_i2c.h"
+
+#include <random>
+
+static const size_t CHUNK = 64;
+static const size_t STRIDE = 32;
+static const size_t ROUNDS = 200000;
+
+int main() {
+    i2c_master_bus_handle_t bus = sim_i2c_bus();
+    // Static like the firmware's instance, the driver never releases its handles
+    static MPU6050 mpu;
+    mpu.init(bus);
+    mpu.set_acceleration_scale_range(2);
+    mpu.set_gyro_scale_range(1);
+
+    static uint8_t bursts[CHUNK * STRIDE];
+    std::mt19937 random(6050);
+    for (uint8_t &byte : bursts) {
+        byte = random();
+    }
+    static MPU6050_data out[CHUNK];
+    static MPU6050_fixed_data fixed[CHUNK];
+
+    double scalar = time_per_call_ns(ROUNDS, [&](size_t) {
+        for (size_t i = 0; i < CHUNK; i++) {
+            out[i] = mpu.convert(bursts + i * STRIDE);
+        }
+        keep(out);
+    });
+    double batch = time_per_call_ns(ROUNDS, [&](size_t) {
+        mpu.convert_batch(bursts, STRIDE, CHUNK, out);
+        keep(out);
+    });
+    double batch_fixed = time_per_call_ns(ROUNDS, [&](size_t) {
+        mpu.convert_batch_fixed(bursts, STRIDE, CHUNK, fixed);
+        keep(fixed);
+    });
+
+    printf("%zu samples per call, ns per sample (host, not the ESP32)\n", CHUNK);
+    printf("convert:             %6.2f\n", scalar / CHUNK);
+    printf("convert_batch:       %6.2f (%.1fx)\n", batch / CHUNK, scalar / batch);
+    printf("convert_batch_fixed: %6.2f (%.1fx)\n", batch_fixed / CHUNK, scalar / batch_fixed);
+    return 0;
+}
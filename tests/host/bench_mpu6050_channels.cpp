@@ -0,0 +1,64 @@
+// What the channel mask saves per sample on the simulated 400 kHz bus: the full 14-byte burst against the
+// minimal burst covering the enabled channels, and the capture frame that goes out on the UART. Also checks
+// that the minimal burst packs to the same words as the full one.
+#include "capture.h"
+#include "host_test.h"
+#include "mpu6050.h"
+#include "sim_i2c.h"
+
+#include <random>
+#include <string.h>
+
+static const int READS = 2000;
+static const double CAPTURE_BAUD = 921600;
+static const uint8_t MASKS[] = {0x7F, 0x77, 0x70, 0x07, 0x04};
+
+// Bus time per read, with the packed words of the last one
+static double bus_us_per_read(MPU6050 &mpu, uint8_t mask, uint8_t packed[MPU6050_RAW_DATA_LEN]) {
+    uint8_t raw[MPU6050_RAW_DATA_LEN];
+    sim_i2c_reset_stats();
+    for (int i = 0; i < READS; i++) {
+        CHECK(mpu.read_raw(raw) == ESP_OK);
+        MPU6050::pack_channels(mask, raw, packed);
+    }
+    return sim_i2c_bus_time_us() / READS;
+}
+
+int main() {
+    i2c_master_bus_handle_t bus = sim_i2c_bus();
+    // Static like the firmware's instance, the driver never releases its handles
+    static MPU6050 mpu;
+    mpu.init(bus, true);
+
+    uint8_t burst[MPU6050_RAW_DATA_LEN];
+    std::mt19937 random(36);
+    for (uint8_t &byte : burst) {
+        byte = random();
+    }
+    sim_mpu6050_set_burst(burst);
+
+    printf("%d reads per mask, bus at 400 kHz, capture UART at %.0f baud\n", READS, CAPTURE_BAUD);
+    printf("%-6s%8s%14s%14s%10s%10s%14s\n", "mask", "burst B", "full bus us", "min bus us", "saved", "frame B",
+           "UART max Hz");
+    GY_NEO6MV2_data no_fix;
+    for (uint8_t mask : MASKS) {
+        uint8_t expected[MPU6050_RAW_DATA_LEN], full_packed[MPU6050_RAW_DATA_LEN], min_packed[MPU6050_RAW_DATA_LEN];
+        CHECK(mpu.set_channels(MPU6050_CHANNEL_ALL) == ESP_OK);
+        double full_us = bus_us_per_read(mpu, mask, full_packed);
+        CHECK(mpu.set_channels(mask) == ESP_OK);
+        double min_us = bus_us_per_read(mpu, mask, min_packed);
+        size_t packed_len = MPU6050::pack_channels(mask, burst, expected);
+        CHECK(packed_len == 2 * (size_t)__builtin_popcount(mask));
+        CHECK(memcmp(full_packed, expected, packed_len) == 0);
+        CHECK(memcmp(min_packed, expected, packed_len) == 0);
+
+        uint8_t frame[CAPTURE_SAMPLE_MAX_LEN];
+        size_t frame_len = CaptureStream::encode_sample(frame, 0, 0, burst, mask, 0, no_fix);
+        // 8N1, ten bit times per byte
+        double uart_hz = CAPTURE_BAUD / (frame_len * 10);
+        printf("0x%02x  %8u%14.1f%14.1f%9.0f%%%10zu%14.0f\n", mask, mpu.get_burst_len(), full_us, min_us,
+               100 * (1 - min_us / full_us), frame_len, uart_hz);
+        CHECK(min_us <= full_us);
+    }
+    return host_test_result();
+}
@@ -0,0 +1,49 @@
+// Cost of one trace event against logging the same event the way ESP_LOGx does: a timestamped line
+// formatted with vsnprintf and written out (to /dev/null here, to the UART on the device), and against a
+// log call that is filtered out at runtime after its arguments have been evaluated.
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host_test.h"
+#include "trace.h"
+
+#include <stdarg.h>
+
+static const size_t ITERATIONS = 2000000;
+
+static FILE *sink;
+static esp_log_level_t runtime_level = ESP_LOG_INFO;
+
+// What esp_log_write() does for an enabled level: prefix, format, write
+static void log_line(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (level > runtime_level) return;
+    char line[160];
+    int len = snprintf(line, sizeof(line), "I (%lu) %s: ", (unsigned long)(esp_timer_get_time() / 1000), tag);
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(line + len, sizeof(line) - len, format, args);
+    va_end(args);
+    fwrite(line, 1, len, sink);
+    fputc('\n', sink);
+}
+
+int main() {
+    sink = fopen("/dev/null", "w");
+    trace_init();
+
+    double trace = time_per_call_ns(ITERATIONS, [](size_t i) { TRACE_I(TRACE_UPLOAD_DONE, (uint32_t)i, 0, 1); });
+    double log = time_per_call_ns(ITERATIONS, [](size_t i) {
+        log_line(ESP_LOG_INFO, "vUpload", "upload done bytes=%u err=%d transport=%u", (unsigned)i, 0, 1);
+    });
+    double filtered = time_per_call_ns(ITERATIONS, [](size_t i) {
+        log_line(ESP_LOG_DEBUG, "vUpload", "upload done bytes=%u err=%d transport=%u", (unsigned)i, 0, 1);
+    });
+    double compiled_out = time_per_call_ns(ITERATIONS, [](size_t i) { TRACE_D(TRACE_UPLOAD_DONE, (uint32_t)i); });
+
+    printf("ns per event (host, not the ESP32)\n");
+    printf("TRACE_I, 3 args:                  %6.1f\n", trace);
+    printf("formatted log line, 3 args:       %6.1f (%.0fx)\n", log, log / trace);
+    printf("log filtered at runtime:          %6.1f\n", filtered);
+    printf("TRACE_D above TRACE_LEVEL:        %6.1f\n", compiled_out);
+    fclose(sink);
+    return 0;
+}
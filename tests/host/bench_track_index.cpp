@@ -0,0 +1,92 @@
+// TrackIndex::locate on an index built by tools/track_index_builder.py from the synthetic network of
+// make_track_network.py. Checks every answer against the query file, then times hits and misses.
+#include "host_test.h"
+#include "track_index.h"
+
+#include <math.h>
+#include <vector>
+
+struct Query {
+    double latitude;
+    double longitude;
+    int line_id; // -1 where no line is within range
+    double chainage_m;
+};
+
+static std::vector<uint8_t> read_file(const char *path) {
+    std::vector<uint8_t> data;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    return data;
+}
+
+static std::vector<Query> read_queries(const char *path) {
+    std::vector<Query> queries;
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return queries;
+    Query q;
+    while (fscanf(f, "%lf,%lf,%d,%lf", &q.latitude, &q.longitude, &q.line_id, &q.chainage_m) == 4) {
+        queries.push_back(q);
+    }
+    fclose(f);
+    return queries;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s track_index.bin queries.csv\n", argv[0]);
+        return 2;
+    }
+    std::vector<uint8_t> blob = read_file(argv[1]);
+    std::vector<Query> queries = read_queries(argv[2]);
+    CHECK(!blob.empty());
+    CHECK(!queries.empty());
+
+    TrackIndex index;
+    CHECK(!index.is_loaded());
+    CHECK(!index.locate(queries[0].latitude, queries[0].longitude).has_value());
+    CHECK(index.load(blob.data(), blob.size() / 2) == ESP_ERR_INVALID_SIZE);
+    CHECK(index.load(blob.data(), blob.size()) == ESP_OK);
+    CHECK(index.is_loaded());
+
+    std::vector<Query> hits, misses;
+    double worst_chainage_error = 0;
+    for (const Query &q : queries) {
+        std::optional<TrackPosition> position = index.locate(q.latitude, q.longitude);
+        if (q.line_id < 0) {
+            CHECK(!position.has_value());
+            misses.push_back(q);
+            continue;
+        }
+        CHECK(position.has_value());
+        if (!position.has_value()) continue;
+        CHECK(position->line_id == q.line_id);
+        CHECK(position->offset_m <= 21.0f);
+        worst_chainage_error = fmax(worst_chainage_error, fabs(position->chainage_m - q.chainage_m));
+        hits.push_back(q);
+    }
+    CHECK(worst_chainage_error < 2.0);
+    CHECK(!index.locate(0.0, 0.0).has_value());
+
+    const size_t rounds = 50;
+    double hit_ns = time_per_call_ns(rounds * hits.size(), [&](size_t i) {
+        const Query &q = hits[i % hits.size()];
+        keep(index.locate(q.latitude, q.longitude));
+    });
+    double miss_ns = time_per_call_ns(rounds * misses.size(), [&](size_t i) {
+        const Query &q = misses[i % misses.size()];
+        keep(index.locate(q.latitude, q.longitude));
+    });
+
+    printf("index of %zu bytes, %zu hits and %zu misses, worst chainage error %.2f m\n", blob.size(), hits.size(),
+           misses.size(), worst_chainage_error);
+    printf("locate hit:  %7.1f ns (host, not the ESP32)\n", hit_ns);
+    printf("locate miss: %7.1f ns\n", miss_ns);
+    return host_test_result();
+}
@@ -0,0 +1,192 @@
+// Draining the upload backlog after a connectivity outage, in simulated time. The real UploadBacklog is
+// compared with the oldest-first queue it replaced, with the same number of raw batches in memory. One
+// batch is produced per second throughout; the uplink sends one document at a time, each costing a fixed
+// request overhead plus its size over the bandwidth, and the server acknowledges it right away.
+//
+// Reported in seconds after the link comes back:
+//   coverage    every second of the outage is covered by a raw batch or a summary
+//   recent      the last batch produced before reconnecting is visible at full resolution
+//   drained     nothing is pending any more
+#include "host_test.h"
+#include "upload_backlog.h"
+
+#include <deque>
+#include <set>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+static const int LEAD_IN_S = 10;
+static const double HORIZON_S = 1800;
+static const double BANDWIDTH = 40000;
+static const double REQUEST_OVERHEAD_S = 0.25;
+static const size_t BATCH_BYTES = 11000;
+// RAW_CAPACITY in upload_backlog.h
+static const size_t RAW_CAPACITY = 60;
+static const int OUTAGES_S[] = {60, 300, 900};
+
+static const char *DEVICE_ID = "a0b1c2d3e4f5";
+
+struct Document {
+    std::string body;
+    std::set<int> covered;
+    bool raw;
+};
+
+// data_queue before the backlog: oldest first, batches that do not fit are dropped on arrival
+class Fifo {
+  private:
+    std::deque<int> queue;
+
+  public:
+    size_t dropped = 0;
+
+    void push(int batch, bool flagged) {
+        if (queue.size() >= RAW_CAPACITY) {
+            dropped++;
+        } else {
+            queue.push_back(batch);
+        }
+    }
+
+    bool next(Document &document) {
+        if (queue.empty()) return false;
+        document = {std::string(BATCH_BYTES, 'x'), {queue.front()}, true};
+        queue.pop_front();
+        return true;
+    }
+};
+
+class Progressive {
+  private:
+    UploadBacklog &backlog;
+
+  public:
+    size_t dropped = 0;
+
+    explicit Progressive(UploadBacklog &backlog) : backlog(backlog) {
+    }
+
+    void push(int batch, bool flagged) {
+        int64_t start_us = (int64_t)batch * 1000000;
+        WindowSummary window;
+        window.reset(start_us);
+        window.add(start_us, 0.0f, 0.0f, 9.8f);
+        window.add(start_us + 990000, 0.0f, 0.0f, 9.8f);
+        if (flagged) window.flags |= WINDOW_FLAG_EVENT;
+        char *data = (char *)malloc(UploadBacklog::HEADER_LEN + BATCH_BYTES);
+        memset(data + UploadBacklog::HEADER_LEN, 'x', BATCH_BYTES);
+        snprintf(data + UploadBacklog::HEADER_LEN, BATCH_BYTES, "raw,%d\n", batch);
+        backlog.push(data, UploadBacklog::HEADER_LEN + BATCH_BYTES, window, 1);
+        dropped = backlog.get_evictions();
+    }
+
+    // Summary lines cover the batches from their start to the end of their duration
+    bool next(Document &document) {
+        UploadItem item;
+        if (!backlog.next(item, 0)) return false;
+        document.body.assign(item.data + UploadBacklog::HEADER_LEN, item.len - UploadBacklog::HEADER_LEN);
+        document.covered.clear();
+        int batch;
+        document.raw = sscanf(document.body.c_str(), "raw,%d", &batch) == 1;
+        if (document.raw) {
+            document.covered.insert(batch);
+        } else {
+            for (size_t pos = document.body.find('\n') + 1; pos < document.body.size();
+                 pos = document.body.find('\n', pos) + 1) {
+                long long seconds, micros;
+                unsigned long duration;
+                if (sscanf(document.body.c_str() + pos, "%lld.%lld,%lu", &seconds, &micros, &duration) != 3) break;
+                for (long long b = seconds; b <= seconds + (long long)(micros / 1000 + duration) / 1000; b++) {
+                    document.covered.insert(b);
+                }
+            }
+        }
+        backlog.complete(item, true);
+        backlog.acknowledge(backlog.get_session(), item.sequence);
+        return true;
+    }
+};
+
+struct Result {
+    double coverage = -1, recent = -1, drained = -1;
+    int gap_lost = 0;
+    size_t raw_lost = 0;
+};
+
+template <typename Strategy> static Result simulate(Strategy &strategy, int outage_s) {
+    int reconnect = LEAD_IN_S + outage_s;
+    std::set<int> flagged = {LEAD_IN_S + outage_s / 5, LEAD_IN_S + outage_s / 2, LEAD_IN_S + outage_s * 4 / 5};
+    std::set<int> covered, full;
+    Result result;
+    double now = 0, next_batch = 0;
+    int batch = 0;
+    Document document;
+    while (now < reconnect + HORIZON_S) {
+        while (next_batch <= now) {
+            strategy.push(batch, flagged.count(batch) > 0);
+            batch++;
+            next_batch += 1;
+        }
+        bool connected = now >= reconnect || now < LEAD_IN_S;
+        if (!connected || !strategy.next(document)) {
+            if (connected && result.drained < 0 && batch > reconnect) result.drained = now - reconnect;
+            now = next_batch;
+            continue;
+        }
+        now += REQUEST_OVERHEAD_S + (document.body.size() + UploadBacklog::HEADER_LEN) / BANDWIDTH;
+        covered.insert(document.covered.begin(), document.covered.end());
+        if (document.raw) full.insert(document.covered.begin(), document.covered.end());
+        if (now < reconnect) continue;
+        bool gap_covered = true;
+        for (int b = LEAD_IN_S; b < reconnect; b++) {
+            gap_covered &= covered.count(b) > 0;
+        }
+        if (result.coverage < 0 && gap_covered) result.coverage = now - reconnect;
+        if (result.recent < 0 && full.count(reconnect - 1)) result.recent = now - reconnect;
+    }
+    for (int b = LEAD_IN_S; b < reconnect; b++) {
+        result.gap_lost += covered.count(b) == 0;
+    }
+    result.raw_lost = strategy.dropped;
+    return result;
+}
+
+static std::string cell(double seconds) {
+    char text[16];
+    if (seconds < 0) return "never";
+    snprintf(text, sizeof(text), "%.1f", seconds);
+    return text;
+}
+
+static void print(const char *name, const Result &result) {
+    printf("%-14s%10s%10s%10s%10d%10zu\n", name, cell(result.coverage).c_str(), cell(result.recent).c_str(),
+           cell(result.drained).c_str(), result.gap_lost, result.raw_lost);
+}
+
+int main() {
+    printf("%.0f kB/s, %.0f ms per request, %zu B batches, raw capacity %zu\n", BANDWIDTH / 1000,
+           REQUEST_OVERHEAD_S * 1000, BATCH_BYTES, RAW_CAPACITY);
+    const size_t runs = sizeof(OUTAGES_S) / sizeof(OUTAGES_S[0]);
+    for (size_t run = 0; run < runs; run++) {
+        int outage_s = OUTAGES_S[run];
+        printf("\noutage %d s\n%-14s%10s%10s%10s%10s%10s\n", outage_s, "strategy", "coverage", "recent", "drained",
+               "gap lost", "raw lost");
+        Fifo fifo;
+        Result fifo_result = simulate(fifo, outage_s);
+        print("fifo", fifo_result);
+        // A fresh backlog per run, static like the firmware's instance
+        static UploadBacklog backlogs[runs];
+        UploadBacklog &backlog = backlogs[run];
+        CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+        Progressive progressive(backlog);
+        Result result = simulate(progressive, outage_s);
+        print("progressive", result);
+
+        // The whole gap is covered, and sooner than the queue shows the newest data
+        CHECK(result.gap_lost == 0);
+        CHECK(result.coverage >= 0 && result.recent >= 0 && result.drained >= 0);
+        CHECK(fifo_result.recent < 0 || result.recent <= fifo_result.recent);
+    }
+    return host_test_result();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <stdio.h>
+
+// Minimal checks for the host tests. A failed CHECK prints its location and the test keeps going, so
+// one run reports every failure; return host_test_result() from main().
+inline int host_test_failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                   \
+            host_test_failures++;                                                                                      \
+        }                                                                                                              \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tolerance)                                                                                    \
+    do {                                                                                                               \
+        double _a = (a), _b = (b);                                                                                     \
+        if (!(_a - _b <= (tolerance) && _b - _a <= (tolerance))) {                                                     \
+            fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %g vs %g\n", __FILE__, __LINE__, #a, #b, _a, _b);       \
+            host_test_failures++;                                                                                      \
+        }                                                                                                              \
+    } while (0)
+
+inline int host_test_result() {
+    if (host_test_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", host_test_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
+
+// Wall-clock nanoseconds per call of `body`, which is run `iterations` times
+template <typename F> double time_per_call_ns(size_t iterations, F body) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        body(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+// Keeps the optimiser from dropping a computation whose result is otherwise unused
+template <typename T> inline void keep(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Write a synthetic track network for bench_track_index.
+
+Parallel east-west lines that wander north and south, split into 100 m segments, as GeoJSON for
+tools/track_index_builder.py, plus a CSV of query points: points a few metres off a known line with the
+chainage the index should report, and points far from every line that must not match.
+"""
+
+import argparse
+import json
+import math
+import random
+
+METRES_PER_DEGREE = 111319.49
+LINES = 16
+LINE_SPACING_DEG = 0.02
+LINE_LENGTH_M = 40000.0
+SEGMENT_M = 100.0
+AMPLITUDE_M = 300.0
+WAVELENGTH_M = 8000.0
+ORIGIN = (60.0, 24.0)
+
+
+def segment_length_m(lat0, lon0, lat1, lon1):
+    # Same approximation as the index builder
+    x_scale = math.cos(math.radians((lat0 + lat1) / 2))
+    return math.hypot((lon1 - lon0) * x_scale * METRES_PER_DEGREE, (lat1 - lat0) * METRES_PER_DEGREE)
+
+
+def line_vertices(line):
+    base_lat = ORIGIN[0] + line * LINE_SPACING_DEG
+    x_scale = METRES_PER_DEGREE * math.cos(math.radians(base_lat))
+    vertices = []
+    for i in range(int(LINE_LENGTH_M / SEGMENT_M) + 1):
+        x = i * SEGMENT_M
+        y = AMPLITUDE_M * math.sin(2 * math.pi * x / WAVELENGTH_M + line)
+        vertices.append((base_lat + y / METRES_PER_DEGREE, ORIGIN[1] + x / x_scale))
+    return vertices
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("geojson")
+    parser.add_argument("queries")
+    parser.add_argument("--count", type=int, default=20000, help="number of query points")
+    args = parser.parse_args()
+
+    rng = random.Random(28)
+    lines = [line_vertices(line) for line in range(LINES)]
+    features = [{
+        "type": "Feature",
+        "properties": {"line_id": 100 + line},
+        "geometry": {"type": "LineString", "coordinates": [[lon, lat] for lat, lon in vertices]},
+    } for line, vertices in enumerate(lines)]
+    with open(args.geojson, "w") as f:
+        json.dump({"type": "FeatureCollection", "features": features}, f)
+
+    with open(args.queries, "w") as f:
+        for _ in range(args.count):
+            if rng.random() < 0.1:
+                # Half way between two lines, more than 1 km from either
+                line = rng.randrange(LINES - 1)
+                lat = ORIGIN[0] + (line + 0.5) * LINE_SPACING_DEG
+                lon = ORIGIN[1] + rng.uniform(0.05, 0.6)
+                f.write(f"{lat:.9f},{lon:.9f},-1,0\n")
+                continue
+            line = rng.randrange(LINES)
+            vertices = lines[line]
+            # Stay away from the ends, where the nearest point is the end vertex rather than a projection
+            i = rng.randrange(1, len(vertices) - 2)
+            t = rng.random()
+            (lat0, lon0), (lat1, lon1) = vertices[i], vertices[i + 1]
+            chainage = sum(segment_length_m(*vertices[j], *vertices[j + 1]) for j in range(i))
+            chainage += t * segment_length_m(lat0, lon0, lat1, lon1)
+            # Up to 20 m either side of the track
+            x_scale = math.cos(math.radians(lat0))
+            dx, dy = (lon1 - lon0) * x_scale, lat1 - lat0
+            norm = math.hypot(dx, dy)
+            offset = rng.uniform(-20.0, 20.0) / METRES_PER_DEGREE
+            lat = lat0 + t * (lat1 - lat0) + dx / norm * offset
+            lon = lon0 + t * (lon1 - lon0) - dy / norm * offset / x_scale
+            f.write(f"{lat:.9f},{lon:.9f},{100 + line},{chainage:.3f}\n")
+
+
+if __name__ == "__main__":
+    main()
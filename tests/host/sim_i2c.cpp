@@ -0,0 +1,256 @@
+#include "sim_i2c.h"
+
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+static const uint8_t MPU6050_ADDR = 0x68;
+static const uint8_t ACCEL_XOUT_H = 0x3B;
+static const uint8_t PWR_MGMT_1 = 0x6B;
+static const uint8_t WHO_AM_I = 0x75;
+static const double SCL_HZ = 400000.0;
+
+struct i2c_master_bus_t {
+    int unused;
+};
+
+struct i2c_master_dev_t {
+    uint16_t address;
+    i2c_master_callback_t on_trans_done;
+    void *arg;
+    // Removed with transfers still queued, which the real driver would complete on the freed handle
+    bool removed;
+};
+
+static i2c_master_bus_t bus;
+static uint8_t registers[128];
+static double bus_bits = 0;
+static size_t data_bytes = 0;
+
+static void power_on_reset() {
+    memset(registers, 0, sizeof(registers));
+    registers[PWR_MGMT_1] = 0x40;
+    registers[WHO_AM_I] = MPU6050_ADDR;
+}
+
+static struct Init {
+    Init() {
+        power_on_reset();
+    }
+} init;
+
+i2c_master_bus_handle_t sim_i2c_bus() {
+    return &bus;
+}
+
+void sim_mpu6050_set_burst(const uint8_t raw[14]) {
+    memcpy(registers + ACCEL_XOUT_H, raw, 14);
+}
+
+uint8_t sim_mpu6050_register(uint8_t reg) {
+    return registers[reg & 0x7F];
+}
+
+double sim_i2c_bus_time_us() {
+    return bus_bits / SCL_HZ * 1e6;
+}
+
+size_t sim_i2c_data_bytes() {
+    return data_bytes;
+}
+
+void sim_i2c_reset_stats() {
+    bus_bits = 0;
+    data_bytes = 0;
+}
+
+// START, address byte and ACK for each phase, 9 bits per data byte, STOP
+static void account(size_t write_size, size_t read_size) {
+    bus_bits += 1 + 9 + write_size * 9;
+    if (read_size > 0) bus_bits += 1 + 9 + read_size * 9;
+    bus_bits += 1;
+    data_bytes += write_size + read_size;
+}
+
+// A transfer the driver has accepted but not finished. The register access happens on completion, so a
+// held read writes into its buffer whenever it is finally let through.
+struct Pending {
+    i2c_master_dev_handle_t dev;
+    std::vector<uint8_t> write;
+    uint8_t *read_buffer;
+    size_t read_size;
+    i2c_master_event_t event;
+};
+
+static std::deque<Pending> queue;
+static int fail_count = 0;
+static i2c_master_event_t fail_event = I2C_EVENT_DONE;
+static bool hold_next = false;
+static bool hung = false;
+static bool stuck = false;
+static size_t devices_added = 0;
+static size_t aborted = 0;
+static size_t resets_while_busy = 0;
+static size_t removed_while_busy = 0;
+
+void sim_i2c_fail_next(int count, i2c_master_event_t event) {
+    fail_count = count;
+    fail_event = event;
+}
+
+void sim_i2c_hold_next(bool hang) {
+    hold_next = true;
+    hung = hang;
+}
+
+void sim_i2c_set_stuck(bool value) {
+    stuck = value;
+}
+
+size_t sim_i2c_devices_added() {
+    return devices_added;
+}
+
+size_t sim_i2c_aborted_transfers() {
+    return aborted;
+}
+
+size_t sim_i2c_resets_while_busy() {
+    return resets_while_busy;
+}
+
+size_t sim_i2c_removed_while_busy() {
+    return removed_while_busy;
+}
+
+static bool has_queued(i2c_master_dev_handle_t dev) {
+    for (const Pending &transfer : queue) {
+        if (transfer.dev == dev) return true;
+    }
+    return false;
+}
+
+// Performs the register access and reports the outcome. Without a callback the driver is synchronous and
+// reports it as the return value.
+static esp_err_t complete(const Pending &transfer) {
+    i2c_master_dev_handle_t dev = transfer.dev;
+    if (dev->removed) {
+        // A use after free on the target, counted by sim_i2c_removed_while_busy()
+        if (!has_queued(dev)) delete dev;
+        return ESP_OK;
+    }
+    account(transfer.write.size(), transfer.read_size);
+    i2c_master_event_t event = transfer.event;
+    if (event == I2C_EVENT_DONE && dev->address != MPU6050_ADDR) event = I2C_EVENT_NACK;
+    if (event == I2C_EVENT_DONE) {
+        uint8_t reg = transfer.write[0] & 0x7F;
+        if (transfer.read_size > 0) {
+            for (size_t i = 0; i < transfer.read_size; i++) {
+                transfer.read_buffer[i] = registers[(reg + i) & 0x7F];
+            }
+        } else if (reg == PWR_MGMT_1 && transfer.write.size() > 1 && (transfer.write[1] & 0x80)) {
+            power_on_reset();
+        } else {
+            for (size_t i = 1; i < transfer.write.size(); i++) {
+                registers[(reg + i - 1) & 0x7F] = transfer.write[i];
+            }
+        }
+    }
+    if (dev->on_trans_done == NULL) {
+        return event == I2C_EVENT_DONE ? ESP_OK : event == I2C_EVENT_TIMEOUT ? ESP_ERR_TIMEOUT : ESP_ERR_INVALID_STATE;
+    }
+    i2c_master_event_data_t data = {.event = event};
+    dev->on_trans_done(dev, &data, dev->arg);
+    return ESP_OK;
+}
+
+// Lets held transfers through in order, unless the one at the front hangs
+static void drain() {
+    while (!queue.empty() && !hung) {
+        Pending transfer = queue.front();
+        queue.pop_front();
+        complete(transfer);
+    }
+}
+
+static esp_err_t submit(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size,
+                        uint8_t *read_buffer, size_t read_size) {
+    Pending transfer = {dev, std::vector<uint8_t>(write_buffer, write_buffer + write_size), read_buffer, read_size,
+                        I2C_EVENT_DONE};
+    if (stuck) {
+        transfer.event = I2C_EVENT_TIMEOUT;
+    } else if (fail_count > 0) {
+        fail_count--;
+        transfer.event = fail_event;
+    }
+    // Only the asynchronous driver queues, the synchronous one blocks until the transfer ends
+    if (dev->on_trans_done == NULL) return complete(transfer);
+    drain();
+    if (hold_next || !queue.empty()) {
+        hold_next = false;
+        queue.push_back(transfer);
+        return ESP_OK;
+    }
+    return complete(transfer);
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle, const i2c_device_config_t *config,
+                                    i2c_master_dev_handle_t *dev) {
+    if (bus_handle != &bus || config == NULL || dev == NULL) return ESP_ERR_INVALID_ARG;
+    *dev = new i2c_master_dev_t{config->device_address, NULL, NULL, false};
+    devices_added++;
+    return ESP_OK;
+}
+
+// Like the driver, this does not cancel the transfers still queued for the device. They complete later
+// with a callback into the freed handle; here the handle is kept until then and the removal is counted.
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t dev) {
+    if (has_queued(dev)) {
+        removed_while_busy++;
+        dev->removed = true;
+        return ESP_OK;
+    }
+    delete dev;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t dev, const i2c_master_event_callbacks_t *cbs,
+                                              void *arg) {
+    dev->on_trans_done = cbs->on_trans_done;
+    dev->arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size,
+                              int xfer_timeout_ms) {
+    if (write_size == 0) return ESP_ERR_INVALID_ARG;
+    return submit(dev, write_buffer, write_size, NULL, 0);
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size,
+                                      uint8_t *read_buffer, size_t read_size, int xfer_timeout_ms) {
+    if (write_size == 0 || read_size == 0) return ESP_ERR_INVALID_ARG;
+    return submit(dev, write_buffer, write_size, read_buffer, read_size);
+}
+
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus_handle, int timeout_ms) {
+    drain();
+    return queue.empty() ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Aborts the transfer on the wire and the ones queued behind it. They complete with I2C_EVENT_TIMEOUT and
+// leave their read buffers alone.
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t bus_handle) {
+    if (!queue.empty()) resets_while_busy++;
+    stuck = false;
+    hung = false;
+    while (!queue.empty()) {
+        Pending transfer = queue.front();
+        queue.pop_front();
+        transfer.event = I2C_EVENT_TIMEOUT;
+        aborted++;
+        complete(transfer);
+    }
+    return ESP_OK;
+}
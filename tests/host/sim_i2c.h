@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver/i2c_master.h"
+
+// Simulated 400 kHz I2C bus with one MPU6050 behind it, implementing the i2c_master_* functions for the
+// host tests. Transfers complete synchronously; with a registered on_trans_done callback the completion is
+// delivered from inside the call, like the driver's ISR would, unless a fault below holds it back.
+i2c_master_bus_handle_t sim_i2c_bus();
+
+// Register file of the simulated MPU6050. The 14-byte burst at ACCEL_XOUT_H is what start_read() returns.
+void sim_mpu6050_set_burst(const uint8_t raw[14]);
+uint8_t sim_mpu6050_register(uint8_t reg);
+
+// Bus time of all transfers so far at 400 kHz including start, address and stop bits, and data bytes moved
+double sim_i2c_bus_time_us();
+size_t sim_i2c_data_bytes();
+void sim_i2c_reset_stats();
+
+// Fault injection. The next count transfers end with event (I2C_EVENT_NACK or I2C_EVENT_TIMEOUT).
+void sim_i2c_fail_next(int count, i2c_master_event_t event);
+// Holds the completion of the next asynchronous transfer, and of the ones queued behind it. They complete
+// on the next submission or i2c_master_bus_wait_all_done(); with hang they never do, wait_all_done times
+// out and only i2c_master_bus_reset() aborts them.
+void sim_i2c_hold_next(bool hang);
+// A slave holding SDA low: every transfer times out until i2c_master_bus_reset()
+void sim_i2c_set_stuck(bool stuck);
+size_t sim_i2c_devices_added();
+// Transfers aborted by i2c_master_bus_reset(), resets issued while a transfer was in flight, and devices
+// removed while one of their transfers was (the driver would later call back into the freed handle)
+size_t sim_i2c_aborted_transfers();
+size_t sim_i2c_resets_while_busy();
+size_t sim_i2c_removed_while_busy();
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Host stand-in for the ESP-IDF I2C master driver API. The implementation is the simulated bus in
+// sim_i2c.cpp.
+typedef struct i2c_master_bus_t *i2c_master_bus_handle_t;
+typedef struct i2c_master_dev_t *i2c_master_dev_handle_t;
+
+typedef enum {
+    I2C_ADDR_BIT_LEN_7,
+    I2C_ADDR_BIT_LEN_10,
+} i2c_addr_bit_len_t;
+
+typedef struct {
+    i2c_addr_bit_len_t dev_addr_length;
+    uint16_t device_address;
+    uint32_t scl_speed_hz;
+    uint32_t scl_wait_us;
+} i2c_device_config_t;
+
+typedef enum {
+    I2C_EVENT_ALIVE,
+    I2C_EVENT_DONE,
+    I2C_EVENT_NACK,
+    I2C_EVENT_TIMEOUT,
+} i2c_master_event_t;
+
+typedef struct {
+    i2c_master_event_t event;
+} i2c_master_event_data_t;
+
+typedef bool (*i2c_master_callback_t)(i2c_master_dev_handle_t dev, const i2c_master_event_data_t *event_data,
+                                      void *arg);
+
+typedef struct {
+    i2c_master_callback_t on_trans_done;
+} i2c_master_event_callbacks_t;
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus, const i2c_device_config_t *config,
+                                    i2c_master_dev_handle_t *dev);
+esp_err_t i2c_master_bus_rm_device(i2c_master_dev_handle_t dev);
+esp_err_t i2c_master_register_event_callbacks(i2c_master_dev_handle_t dev, const i2c_master_event_callbacks_t *cbs,
+                                              void *arg);
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size,
+                              int xfer_timeout_ms);
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t dev, const uint8_t *write_buffer, size_t write_size,
+                                      uint8_t *read_buffer, size_t read_size, int xfer_timeout_ms);
+esp_err_t i2c_master_bus_wait_all_done(i2c_master_bus_handle_t bus, int timeout_ms);
+esp_err_t i2c_master_bus_reset(i2c_master_bus_handle_t bus);
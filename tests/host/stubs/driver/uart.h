@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in for the parts of the ESP-IDF UART driver the firmware uses. Each port is a pair of byte
+// queues: what the firmware writes can be taken by the test, what the test feeds is what it reads.
+// Reads return what is queued without waiting.
+typedef enum {
+    UART_NUM_0,
+    UART_NUM_1,
+    UART_NUM_2,
+    UART_NUM_MAX,
+} uart_port_t;
+
+esp_err_t uart_set_baudrate(uart_port_t uart_num, uint32_t baud_rate);
+esp_err_t uart_flush(uart_port_t uart_num);
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size);
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait);
+
+// Test side: bytes the firmware wrote since the last call, and bytes for it to read
+size_t host_uart_take_tx(uart_port_t uart_num, uint8_t *out, size_t max_len);
+void host_uart_feed_rx(uart_port_t uart_num, const uint8_t *data, size_t len);
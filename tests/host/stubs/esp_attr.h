@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for esp_attr.h, placement attributes have no meaning on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define __NOINIT_ATTR
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host stand-in for esp_cpu.h. The core ID is per thread and set by the test, 0 by default.
+int esp_cpu_get_core_id();
+void host_set_core_id(int core);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for esp_random.h, a fixed-seed generator so runs are repeatable
+uint32_t esp_random();
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for esp_rom_crc.h. CRC-32 as the ROM computes it, the same as zlib.crc32 for a zero seed.
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
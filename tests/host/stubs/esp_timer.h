@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for esp_timer.h: microseconds of real time since the first call
+int64_t esp_timer_get_time();
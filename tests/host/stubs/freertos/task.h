@@ -0,0 +1,10 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in: ticks are milliseconds of real time since the first call
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+// Moves xTaskGetTickCount() forward without waiting, for timeouts measured in ticks
+void host_advance_ticks(TickType_t ticks);
@@ -0,0 +1,322 @@
+// Host implementations of the ESP-IDF and FreeRTOS functions declared in the stand-in headers
+#include "driver/uart.h"
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+        return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:
+        return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:
+        return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_READ_ONLY:
+        return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+        return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_HANDLE:
+        return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+static std::map<std::string, esp_log_level_t> log_levels;
+
+esp_log_level_t esp_log_level_get(const char *tag) {
+    auto level = log_levels.find(tag);
+    if (level == log_levels.end()) level = log_levels.find("*");
+    return level == log_levels.end() ? ESP_LOG_INFO : level->second;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    log_levels[tag] = level;
+}
+
+void host_log(esp_log_level_t level, const char *tag, const char *format, ...) {
+    static const bool verbose = getenv("HOST_LOG_VERBOSE") != NULL;
+    if (level > ESP_LOG_WARN && !verbose) return;
+    static const char LETTERS[] = "NEWIDV";
+    fprintf(stderr, "%c (%s) ", LETTERS[level], tag);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+struct host_semaphore {
+    std::mutex mutex;
+    std::condition_variable available;
+    bool given;
+};
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return new host_semaphore{{}, {}, false};
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new host_semaphore{{}, {}, true};
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (ticks == portMAX_DELAY) {
+        semaphore->available.wait(lock, [&] { return semaphore->given; });
+    } else if (!semaphore->available.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS),
+                                              [&] { return semaphore->given; })) {
+        return pdFALSE;
+    }
+    semaphore->given = false;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->given) return pdFALSE;
+    semaphore->given = true;
+    semaphore->available.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken) {
+    if (woken != NULL) *woken = pdFALSE;
+    return xSemaphoreGive(semaphore);
+}
+
+static const auto boot_time = std::chrono::steady_clock::now();
+static thread_local int core_id = 0;
+static esp_reset_reason_t reset_reason = ESP_RST_POWERON;
+
+int esp_cpu_get_core_id() {
+    return core_id;
+}
+
+void host_set_core_id(int core) {
+    core_id = core;
+}
+
+esp_reset_reason_t esp_reset_reason() {
+    return reset_reason;
+}
+
+void host_set_reset_reason(esp_reset_reason_t reason) {
+    reset_reason = reason;
+}
+
+uint32_t esp_random() {
+    static std::mt19937 random(0xE5D32);
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    return random();
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+int64_t esp_timer_get_time() {
+    auto elapsed = std::chrono::steady_clock::now() - boot_time;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+static std::atomic<TickType_t> tick_offset(0);
+
+TickType_t xTaskGetTickCount() {
+    auto elapsed = std::chrono::steady_clock::now() - boot_time;
+    return (TickType_t)(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / portTICK_PERIOD_MS) +
+           tick_offset;
+}
+
+void host_advance_ticks(TickType_t ticks) {
+    tick_offset += ticks;
+}
+
+struct host_uart {
+    std::mutex mutex;
+    std::deque<uint8_t> tx, rx;
+};
+
+static host_uart uarts[UART_NUM_MAX];
+
+esp_err_t uart_set_baudrate(uart_port_t uart_num, uint32_t baud_rate) {
+    return uart_num < UART_NUM_MAX && baud_rate > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// Discards the unread input, like the driver
+esp_err_t uart_flush(uart_port_t uart_num) {
+    if (uart_num >= UART_NUM_MAX) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(uarts[uart_num].mutex);
+    uarts[uart_num].rx.clear();
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size) {
+    if (uart_num >= UART_NUM_MAX) return -1;
+    const uint8_t *bytes = (const uint8_t *)src;
+    std::lock_guard<std::mutex> lock(uarts[uart_num].mutex);
+    uarts[uart_num].tx.insert(uarts[uart_num].tx.end(), bytes, bytes + size);
+    return size;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait) {
+    if (uart_num >= UART_NUM_MAX) return -1;
+    host_uart &uart = uarts[uart_num];
+    std::lock_guard<std::mutex> lock(uart.mutex);
+    size_t n = std::min((size_t)length, uart.rx.size());
+    std::copy(uart.rx.begin(), uart.rx.begin() + n, (uint8_t *)buf);
+    uart.rx.erase(uart.rx.begin(), uart.rx.begin() + n);
+    return n;
+}
+
+size_t host_uart_take_tx(uart_port_t uart_num, uint8_t *out, size_t max_len) {
+    host_uart &uart = uarts[uart_num];
+    std::lock_guard<std::mutex> lock(uart.mutex);
+    size_t n = std::min(max_len, uart.tx.size());
+    std::copy(uart.tx.begin(), uart.tx.begin() + n, out);
+    uart.tx.erase(uart.tx.begin(), uart.tx.begin() + n);
+    return n;
+}
+
+void host_uart_feed_rx(uart_port_t uart_num, const uint8_t *data, size_t len) {
+    host_uart &uart = uarts[uart_num];
+    std::lock_guard<std::mutex> lock(uart.mutex);
+    uart.rx.insert(uart.rx.end(), data, data + len);
+}
+
+// Namespace -> key -> blob. Handles start at 1, like the driver zero is never valid.
+struct host_nvs_handle {
+    std::string name;
+    bool writable;
+};
+
+static std::mutex nvs_mutex;
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs_namespaces;
+static std::map<nvs_handle_t, host_nvs_handle> nvs_handles;
+static nvs_handle_t nvs_next_handle = 1;
+static esp_err_t nvs_write_error = ESP_OK;
+static size_t nvs_writes = 0;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    if (open_mode == NVS_READONLY && nvs_namespaces.count(name) == 0) return ESP_ERR_NVS_NOT_FOUND;
+    nvs_namespaces[name];
+    *out_handle = nvs_next_handle++;
+    nvs_handles[*out_handle] = {name, open_mode == NVS_READWRITE};
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_handles.erase(handle);
+}
+
+// Like the real one: a NULL out_value asks for the length, a short buffer is an error
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto open = nvs_handles.find(handle);
+    if (open == nvs_handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    auto &blobs = nvs_namespaces[open->second.name];
+    auto blob = blobs.find(key);
+    if (blob == blobs.end()) return ESP_ERR_NVS_NOT_FOUND;
+    if (out_value != NULL) {
+        if (*length < blob->second.size()) return ESP_ERR_NVS_INVALID_LENGTH;
+        std::copy(blob->second.begin(), blob->second.end(), (uint8_t *)out_value);
+    }
+    *length = blob->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto open = nvs_handles.find(handle);
+    if (open == nvs_handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!open->second.writable) return ESP_ERR_NVS_READ_ONLY;
+    if (nvs_write_error != ESP_OK) return nvs_write_error;
+    const uint8_t *bytes = (const uint8_t *)value;
+    nvs_namespaces[open->second.name][key].assign(bytes, bytes + length);
+    nvs_writes++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    if (nvs_handles.count(handle) == 0) return ESP_ERR_NVS_INVALID_HANDLE;
+    return nvs_write_error;
+}
+
+void host_nvs_erase_all() {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_namespaces.clear();
+}
+
+void host_nvs_fail_writes(esp_err_t err) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    nvs_write_error = err;
+}
+
+size_t host_nvs_write_count() {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    return nvs_writes;
+}
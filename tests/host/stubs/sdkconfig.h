@@ -0,0 +1,4 @@
+#pragma once
+
+// Host stand-in for the generated sdkconfig.h. Options left undefined take the defaults the firmware
+// falls back to; tests define the ones they need before including firmware headers.
@@ -0,0 +1,104 @@
+// The batch conversion kernels (mpu6050_convert.h) against the scalar MPU6050::convert, for every range
+// combination and for bursts laid out with the stride of the sample ring
+#include "host_test.h"
+#include "mpu6050.h"
+#include "mpu6050_convert.h"
+#include "sim_i2c.h"
+
+#include <math.h>
+#include <random>
+#include <string.h>
+
+static const size_t COUNT = 512;
+static const size_t STRIDE = 32;
+
+static double tolerance(double expected) {
+    return 1e-5 * fmax(1.0, fabs(expected));
+}
+
+static void check_same(const MPU6050_data &expected, const MPU6050_data &actual) {
+    CHECK_NEAR(actual.accelerometer.x, expected.accelerometer.x, tolerance(expected.accelerometer.x));
+    CHECK_NEAR(actual.accelerometer.y, expected.accelerometer.y, tolerance(expected.accelerometer.y));
+    CHECK_NEAR(actual.accelerometer.z, expected.accelerometer.z, tolerance(expected.accelerometer.z));
+    CHECK_NEAR(actual.gyroscope.x, expected.gyroscope.x, tolerance(expected.gyroscope.x));
+    CHECK_NEAR(actual.gyroscope.y, expected.gyroscope.y, tolerance(expected.gyroscope.y));
+    CHECK_NEAR(actual.gyroscope.z, expected.gyroscope.z, tolerance(expected.gyroscope.z));
+    CHECK_NEAR(actual.temperature, expected.temperature, tolerance(expected.temperature));
+}
+
+// Q16.16 truncates, so allow one LSB on top of the float tolerance
+static void check_same(const MPU6050_data &expected, const MPU6050_fixed_data &actual) {
+    const double lsb = 1.0 / (1 << MPU6050Convert::FRAC_BITS);
+    MPU6050_data converted;
+    converted.accelerometer.x = actual.accelerometer[0] * lsb;
+    converted.accelerometer.y = actual.accelerometer[1] * lsb;
+    converted.accelerometer.z = actual.accelerometer[2] * lsb;
+    converted.gyroscope.x = actual.gyroscope[0] * lsb;
+    converted.gyroscope.y = actual.gyroscope[1] * lsb;
+    converted.gyroscope.z = actual.gyroscope[2] * lsb;
+    converted.temperature = actual.temperature * lsb;
+    CHECK_NEAR(converted.accelerometer.x, expected.accelerometer.x, tolerance(expected.accelerometer.x) + 2 * lsb);
+    CHECK_NEAR(converted.accelerometer.y, expected.accelerometer.y, tolerance(expected.accelerometer.y) + 2 * lsb);
+    CHECK_NEAR(converted.accelerometer.z, expected.accelerometer.z, tolerance(expected.accelerometer.z) + 2 * lsb);
+    CHECK_NEAR(converted.gyroscope.x, expected.gyroscope.x, tolerance(expected.gyroscope.x) + 2 * lsb);
+    CHECK_NEAR(converted.gyroscope.y, expected.gyroscope.y, tolerance(expected.gyroscope.y) + 2 * lsb);
+    CHECK_NEAR(converted.gyroscope.z, expected.gyroscope.z, tolerance(expected.gyroscope.z) + 2 * lsb);
+    CHECK_NEAR(converted.temperature, expected.temperature, tolerance(expected.temperature) + 2 * lsb);
+}
+
+int main() {
+    i2c_master_bus_handle_t bus = sim_i2c_bus();
+    // Static like the firmware's instance, the driver never releases its handles
+    static MPU6050 mpu;
+    mpu.init(bus);
+
+    // Random bursts plus the extremes of every word
+    static uint8_t bursts[COUNT * STRIDE];
+    std::mt19937 random(6050);
+    for (uint8_t &byte : bursts) {
+        byte = random();
+    }
+    memset(bursts, 0x80, 14);
+    memset(bursts + STRIDE, 0x7F, 14);
+    memset(bursts + 2 * STRIDE, 0x00, 14);
+    memset(bursts + 3 * STRIDE, 0xFF, 14);
+
+    static MPU6050_data batch[COUNT], table[COUNT];
+    static MPU6050_fixed_data fixed[COUNT];
+    for (uint8_t accel_range = 0; accel_range < 4; accel_range++) {
+        for (uint8_t gyro_range = 0; gyro_range < 4; gyro_range++) {
+            CHECK(mpu.set_acceleration_scale_range(accel_range) == ESP_OK);
+            CHECK(mpu.set_gyro_scale_range(gyro_range) == ESP_OK);
+            CHECK(mpu.get_acceleration_scale_range() == accel_range);
+            CHECK(mpu.get_gyro_scale_range() == gyro_range);
+            mpu.convert_batch(bursts, STRIDE, COUNT, batch);
+            mpu.convert_batch_fixed(bursts, STRIDE, COUNT, fixed);
+            MPU6050Convert::batch_kernels[accel_range][gyro_range](bursts, STRIDE, COUNT, table);
+            for (size_t i = 0; i < COUNT; i++) {
+                MPU6050_data expected = mpu.convert(bursts + i * STRIDE);
+                check_same(expected, batch[i]);
+                check_same(expected, table[i]);
+                check_same(expected, fixed[i]);
+            }
+        }
+    }
+
+    // Packed 14-byte bursts, as read_raw() returns them
+    uint8_t packed[4 * MPU6050_RAW_DATA_LEN];
+    for (int i = 0; i < 4; i++) {
+        memcpy(packed + i * MPU6050_RAW_DATA_LEN, bursts + i * STRIDE, MPU6050_RAW_DATA_LEN);
+    }
+    mpu.convert_batch(packed, MPU6050_RAW_DATA_LEN, 4, batch);
+    for (int i = 0; i < 4; i++) {
+        check_same(mpu.convert(bursts + i * STRIDE), batch[i]);
+    }
+
+    // A burst read through the simulated bus converts to the same values
+    sim_mpu6050_set_burst(bursts + 7 * STRIDE);
+    uint8_t raw[MPU6050_RAW_DATA_LEN];
+    CHECK(mpu.read_raw(raw) == ESP_OK);
+    CHECK(memcmp(raw, bursts + 7 * STRIDE, MPU6050_RAW_DATA_LEN) == 0);
+    check_same(mpu.convert(bursts + 7 * STRIDE), mpu.read());
+
+    return host_test_result();
+}
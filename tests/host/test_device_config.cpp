@@ -0,0 +1,420 @@
+// Config documents (device_config.h): parse_config() against malformed, unknown-field, out-of-range and
+// stale documents, checked not to allocate and fuzzed with random mutations. ConfigStore through trial,
+// restart and rollback on the stand-in NVS, and the acknowledged config version UploadBacklog reports.
+#include "device_config.h"
+#include "host_test.h"
+#include "nvs.h"
+#include "upload_backlog.h"
+
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// From <sanitizer/allocator_interface.h>, which not every toolchain ships with the runtime
+#if defined(__SANITIZE_ADDRESS__)
+extern "C" int __sanitizer_install_malloc_and_free_hooks(void (*malloc_hook)(const volatile void *, size_t),
+                                                         void (*free_hook)(const volatile void *));
+#define COUNT_ALLOCATIONS 1
+#endif
+
+static const char *FULL_DOCUMENT =
+    "{\"config_version\":7,\"sample_period_ms\":2,\"batch_size\":300,\"accel_range\":1,\"gyro_range\":3,"
+    "\"channels\":7,\"upload_mode\":\"stream\",\"upload_url\":\"https://example.com/upload\","
+    "\"lock_url\":\"http:\\/\\/example.com\\/lock\",\"mqtt_uri\":\"mqtts://broker.example.com\"}";
+
+static DeviceConfig defaults() {
+    DeviceConfig config = {};
+    config.sample_period_ms = 10;
+    config.batch_size = 100;
+    config.channels = 0x77;
+    config.upload_mode = UPLOAD_MODE_AUTO;
+    strcpy(config.upload_url, "https://default.example.com/upload");
+    strcpy(config.lock_url, "https://default.example.com/lock");
+    strcpy(config.mqtt_uri, "mqtts://default.example.com");
+    return config;
+}
+
+static DeviceConfig with_version(uint32_t version) {
+    DeviceConfig config = defaults();
+    config.version = version;
+    return config;
+}
+
+static bool same_config(const DeviceConfig &a, const DeviceConfig &b) {
+    return a.version == b.version && a.sample_period_ms == b.sample_period_ms && a.batch_size == b.batch_size &&
+           a.accel_range == b.accel_range && a.gyro_range == b.gyro_range && a.channels == b.channels &&
+           a.upload_mode == b.upload_mode && config_urls_equal(a, b);
+}
+
+#ifdef COUNT_ALLOCATIONS
+static volatile bool counting = false;
+static volatile size_t allocations = 0;
+
+static void count_malloc(const volatile void *, size_t) {
+    if (counting) allocations++;
+}
+
+static void ignore_free(const volatile void *) {
+}
+#endif
+
+// Parses from an exact-size heap copy, so ASan catches reads past the end of the document
+static esp_err_t parse(const std::string &json, const DeviceConfig &base, uint32_t min_version, DeviceConfig &out,
+                       char *error, size_t error_len) {
+    char *copy = (char *)malloc(json.size() + 1);
+    memcpy(copy, json.data(), json.size());
+#ifdef COUNT_ALLOCATIONS
+    counting = true;
+#endif
+    esp_err_t err = parse_config(copy, json.size(), base, min_version, out, error, error_len);
+#ifdef COUNT_ALLOCATIONS
+    counting = false;
+#endif
+    free(copy);
+    return err;
+}
+
+static esp_err_t parse(const std::string &json, uint32_t min_version, DeviceConfig &out, std::string &error) {
+    char buf[64];
+    esp_err_t err = parse(json, defaults(), min_version, out, buf, sizeof(buf));
+    error = buf;
+    return err;
+}
+
+static void test_valid() {
+    DeviceConfig config;
+    std::string error;
+    CHECK(is_config_document(FULL_DOCUMENT, strlen(FULL_DOCUMENT)));
+    CHECK(parse(FULL_DOCUMENT, 6, config, error) == ESP_OK);
+    CHECK(error.empty());
+    CHECK(config.version == 7 && config.sample_period_ms == 2 && config.batch_size == 300);
+    CHECK(config.accel_range == 1 && config.gyro_range == 3 && config.channels == 7);
+    CHECK(config.upload_mode == UPLOAD_MODE_STREAM);
+    CHECK(strcmp(config.upload_url, "https://example.com/upload") == 0);
+    CHECK(strcmp(config.lock_url, "http://example.com/lock") == 0);
+    CHECK(strcmp(config.mqtt_uri, "mqtts://broker.example.com") == 0);
+    CHECK(!config_urls_equal(config, defaults()));
+
+    // Fields left out keep their base value; whitespace and a trailing NUL are accepted
+    std::string partial = " {\n\t\"batch_size\" : 10 ,\"config_version\":1 }\r\n";
+    partial.push_back('\0');
+    CHECK(parse(partial, 0, config, error) == ESP_OK);
+    DeviceConfig expected = with_version(1);
+    expected.batch_size = 10;
+    CHECK(same_config(config, expected));
+    CHECK(config_urls_equal(config, defaults()));
+
+    const char *batch = "#config,3\n#schema,time,ax,ay,az\n";
+    CHECK(!is_config_document(batch, strlen(batch)));
+    const char *ack = "{\"session\":\"0badcafe\",\"sequence\":4}";
+    CHECK(!is_config_document(ack, strlen(ack)));
+}
+
+static void test_rejected() {
+    struct Case {
+        const char *json;
+        esp_err_t err;
+        const char *error;
+    };
+    const std::string long_url = "{\"config_version\":2,\"upload_url\":\"https://" + std::string(120, 'a') + "\"}";
+    const Case cases[] = {
+        // Malformed
+        {"", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"[1]", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2,}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2}}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2} x", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\" 2}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2 \"batch_size\":20}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2,\"upload_url\":\"https://x}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2,\"batch_size\":{\"a\":1}}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":2,\"batch_size\":[20]}", ESP_ERR_INVALID_ARG, "malformed document"},
+        {"{\"config_version\":1e}", ESP_ERR_INVALID_ARG, "malformed document"},
+        // Unknown fields
+        {"{\"config_version\":2,\"colour\":1}", ESP_ERR_INVALID_ARG, "unknown field colour"},
+        {"{\"Config_version\":2}", ESP_ERR_INVALID_ARG, "unknown field Config_version"},
+        // Out of range, fractional or of the wrong type
+        {"{\"config_version\":2,\"sample_period_ms\":0}", ESP_ERR_INVALID_ARG, "invalid sample_period_ms"},
+        {"{\"config_version\":2,\"sample_period_ms\":1001}", ESP_ERR_INVALID_ARG, "invalid sample_period_ms"},
+        {"{\"config_version\":2,\"batch_size\":9}", ESP_ERR_INVALID_ARG, "invalid batch_size"},
+        {"{\"config_version\":2,\"batch_size\":401}", ESP_ERR_INVALID_ARG, "invalid batch_size"},
+        {"{\"config_version\":2,\"batch_size\":20.5}", ESP_ERR_INVALID_ARG, "invalid batch_size"},
+        {"{\"config_version\":2,\"batch_size\":\"20\"}", ESP_ERR_INVALID_ARG, "invalid batch_size"},
+        {"{\"config_version\":2,\"accel_range\":4}", ESP_ERR_INVALID_ARG, "invalid accel_range"},
+        {"{\"config_version\":2,\"gyro_range\":-1}", ESP_ERR_INVALID_ARG, "invalid gyro_range"},
+        {"{\"config_version\":2,\"channels\":0}", ESP_ERR_INVALID_ARG, "invalid channels"},
+        {"{\"config_version\":2,\"channels\":128}", ESP_ERR_INVALID_ARG, "invalid channels"},
+        {"{\"config_version\":2,\"channels\":true}", ESP_ERR_INVALID_ARG, "invalid channels"},
+        {"{\"config_version\":2,\"upload_mode\":\"fast\"}", ESP_ERR_INVALID_ARG, "invalid upload_mode"},
+        {"{\"config_version\":2,\"upload_mode\":null}", ESP_ERR_INVALID_ARG, "invalid upload_mode"},
+        {"{\"config_version\":2,\"upload_url\":\"ftp://x\"}", ESP_ERR_INVALID_ARG, "invalid upload_url"},
+        {"{\"config_version\":2,\"upload_url\":\"https:\\u002f\\u002fx\"}", ESP_ERR_INVALID_ARG, "invalid upload_url"},
+        {"{\"config_version\":2,\"lock_url\":7}", ESP_ERR_INVALID_ARG, "invalid lock_url"},
+        {"{\"config_version\":2,\"mqtt_uri\":\"https://broker\"}", ESP_ERR_INVALID_ARG, "invalid mqtt_uri"},
+        {long_url.c_str(), ESP_ERR_INVALID_ARG, "invalid upload_url"},
+        {"{\"config_version\":0}", ESP_ERR_INVALID_ARG, "invalid config_version"},
+        {"{\"config_version\":4294967296}", ESP_ERR_INVALID_ARG, "invalid config_version"},
+        // Missing or stale version, 5 is the version the device already runs
+        {"{}", ESP_ERR_INVALID_ARG, "missing config_version"},
+        {"{\"batch_size\":20}", ESP_ERR_INVALID_ARG, "missing config_version"},
+        {"{\"config_version\":5}", ESP_ERR_INVALID_VERSION, "config_version 5 is not above 5"},
+        {"{\"config_version\":3,\"batch_size\":20}", ESP_ERR_INVALID_VERSION, "config_version 3 is not above 5"},
+    };
+    for (const Case &c : cases) {
+        DeviceConfig config;
+        std::string error;
+        esp_err_t err = parse(c.json, 5, config, error);
+        if (err != c.err || error != c.error) {
+            fprintf(stderr, "%s: got %s \"%s\"\n", c.json, esp_err_to_name(err), error.c_str());
+        }
+        CHECK(err == c.err);
+        CHECK(error == c.error);
+    }
+
+    // The reason is cut to the buffer and stays terminated
+    DeviceConfig config;
+    char error[8];
+    memset(error, 'x', sizeof(error));
+    CHECK(parse("{\"config_version\":2,\"colour\":1}", defaults(), 0, config, error, sizeof(error)) ==
+          ESP_ERR_INVALID_ARG);
+    CHECK(strcmp(error, "unknown") == 0);
+}
+
+// Two known-good documents as seeds, mutated byte by byte with the characters the parser cares about
+static void test_fuzz() {
+    static const char ALPHABET[] = "{}[]\":,\\ \t\n-+.eE0123456789abfnrtu/";
+    static const int ITERATIONS = 200000;
+    const std::string seeds[] = {FULL_DOCUMENT, "{\"config_version\":2,\"batch_size\":20,\"upload_mode\":\"http\"}"};
+    std::mt19937 random(38);
+    size_t accepted = 0;
+    for (int i = 0; i < ITERATIONS; i++) {
+        std::string json = seeds[random() % 2];
+        int mutations = 1 + random() % 4;
+        for (int m = 0; m < mutations && !json.empty(); m++) {
+            size_t pos = random() % json.size();
+            switch (random() % 5) {
+            case 0:
+                json[pos] = ALPHABET[random() % (sizeof(ALPHABET) - 1)];
+                break;
+            case 1:
+                json.insert(json.begin() + pos, ALPHABET[random() % (sizeof(ALPHABET) - 1)]);
+                break;
+            case 2:
+                json.erase(pos, 1 + random() % 8);
+                break;
+            case 3:
+                json.resize(pos);
+                break;
+            default:
+                json[pos] ^= 1 << (random() % 8);
+                break;
+            }
+        }
+        DeviceConfig base = with_version(random() % 8);
+        uint32_t min_version = random() % 8;
+        DeviceConfig config;
+        char error[1 + 64];
+        size_t error_len = 1 + random() % 64;
+        esp_err_t err = parse(json, base, min_version, config, error, error_len);
+        CHECK(strlen(error) < error_len);
+        if (err != ESP_OK) {
+            CHECK(err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_VERSION);
+            CHECK(error_len == 1 || error[0] != '\0');
+            continue;
+        }
+        accepted++;
+        // Whatever got through is a config the device can run
+        CHECK(error[0] == '\0');
+        CHECK(config.version > min_version);
+        CHECK(config.sample_period_ms >= DeviceConfig::MIN_SAMPLE_PERIOD_MS &&
+              config.sample_period_ms <= DeviceConfig::MAX_SAMPLE_PERIOD_MS);
+        CHECK(config.batch_size >= DeviceConfig::MIN_BATCH_SIZE && config.batch_size <= DeviceConfig::MAX_BATCH_SIZE);
+        CHECK(config.accel_range <= 3 && config.gyro_range <= 3);
+        CHECK(config.channels >= 0x01 && config.channels <= 0x7F);
+        CHECK(config.upload_mode <= UPLOAD_MODE_STREAM);
+        CHECK(strncmp(config.upload_url, "http", 4) == 0 && strlen(config.upload_url) < DeviceConfig::URL_LEN);
+        CHECK(strncmp(config.lock_url, "http", 4) == 0 && strlen(config.lock_url) < DeviceConfig::URL_LEN);
+        CHECK(strncmp(config.mqtt_uri, "mqtt", 4) == 0 && strlen(config.mqtt_uri) < DeviceConfig::URL_LEN);
+    }
+    printf("%d mutated documents, %zu accepted\n", ITERATIONS, accepted);
+    // Mutations that only touch a value must still get through sometimes, or the fuzzer is not reaching
+    // the range checks
+    CHECK(accepted > 0);
+}
+
+// One ConfigStore per simulated boot, static like the firmware's instance since init() creates a mutex
+static ConfigStore &boot() {
+    static ConfigStore stores[16];
+    static size_t boots = 0;
+    ConfigStore &store = stores[boots++];
+    CHECK(store.init(defaults()) == ESP_OK);
+    return store;
+}
+
+static void test_store_trial() {
+    host_nvs_erase_all();
+    ConfigStore &first = boot();
+    CHECK(same_config(first.get_current(), defaults()));
+    CHECK(!first.in_trial());
+    CHECK(first.get_failed_version() == 0);
+
+    // Staged, then confirmed before any restart
+    CHECK(first.stage(with_version(1)) == ESP_OK);
+    CHECK(first.in_trial());
+    CHECK(first.get_current().version == 1 && first.get_previous().version == 0);
+    CHECK(first.confirm(2) == ESP_ERR_INVALID_STATE);
+    CHECK(first.in_trial());
+    CHECK(first.confirm(1) == ESP_OK);
+    CHECK(!first.in_trial());
+    CHECK(first.get_previous().version == 1);
+    size_t writes = host_nvs_write_count();
+    CHECK(first.confirm(1) == ESP_ERR_INVALID_STATE);
+    CHECK(first.rollback(1) == ESP_ERR_INVALID_STATE);
+    CHECK(host_nvs_write_count() == writes);
+
+    ConfigStore &second = boot();
+    CHECK(second.get_current().version == 1 && !second.in_trial());
+
+    // A config that changes the URLs is staged and the device restarts for it: TRIAL -> TRIAL_BOOTED
+    DeviceConfig moved = with_version(2);
+    strcpy(moved.upload_url, "https://moved.example.com/upload");
+    CHECK(second.stage(moved) == ESP_OK);
+    ConfigStore &third = boot();
+    CHECK(third.in_trial());
+    CHECK(same_config(third.get_current(), moved));
+    CHECK(third.get_previous().version == 1);
+
+    // Never confirmed on that boot, so the next one rolls back and remembers the failed version
+    ConfigStore &fourth = boot();
+    CHECK(!fourth.in_trial());
+    CHECK(same_config(fourth.get_current(), with_version(1)));
+    CHECK(fourth.get_failed_version() == 2);
+    CHECK(fourth.confirm(2) == ESP_ERR_INVALID_STATE);
+    ConfigStore &fifth = boot();
+    CHECK(!fifth.in_trial() && fifth.get_current().version == 1 && fifth.get_failed_version() == 2);
+
+    // Confirmed on the trial boot, kept from then on
+    CHECK(fifth.stage(moved) == ESP_OK);
+    ConfigStore &sixth = boot();
+    CHECK(sixth.in_trial());
+    CHECK(sixth.confirm(2) == ESP_OK);
+    ConfigStore &seventh = boot();
+    CHECK(!seventh.in_trial() && same_config(seventh.get_current(), moved));
+    CHECK(seventh.get_previous().version == 2);
+}
+
+static void test_store_rollback() {
+    host_nvs_erase_all();
+    ConfigStore &store = boot();
+    CHECK(store.stage(with_version(1)) == ESP_OK);
+    CHECK(store.confirm(1) == ESP_OK);
+
+    // Rolled back at runtime, persisted before anything else happens
+    CHECK(store.stage(with_version(3)) == ESP_OK);
+    CHECK(store.rollback(2) == ESP_ERR_INVALID_STATE);
+    CHECK(store.rollback(3) == ESP_OK);
+    CHECK(store.get_current().version == 1 && store.get_failed_version() == 3 && !store.in_trial());
+    CHECK(store.rollback(3) == ESP_ERR_INVALID_STATE);
+    CHECK(store.confirm(3) == ESP_ERR_INVALID_STATE);
+    ConfigStore &rebooted = boot();
+    CHECK(rebooted.get_current().version == 1 && rebooted.get_failed_version() == 3 && !rebooted.in_trial());
+
+    // A config staged over one still on trial falls back to the last confirmed one, and a decision on
+    // the replaced trial has no effect
+    CHECK(rebooted.stage(with_version(4)) == ESP_OK);
+    CHECK(rebooted.stage(with_version(5)) == ESP_OK);
+    CHECK(rebooted.get_previous().version == 1);
+    CHECK(rebooted.confirm(4) == ESP_ERR_INVALID_STATE);
+    CHECK(rebooted.rollback(4) == ESP_ERR_INVALID_STATE);
+    CHECK(rebooted.rollback(5) == ESP_OK);
+    CHECK(rebooted.get_current().version == 1 && rebooted.get_failed_version() == 5);
+
+    // A failed write is reported to the caller, the rollback still takes effect in memory
+    host_nvs_fail_writes(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    CHECK(rebooted.stage(with_version(6)) == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    CHECK(rebooted.rollback(6) == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    CHECK(rebooted.get_current().version == 1 && !rebooted.in_trial());
+    host_nvs_fail_writes(ESP_OK);
+
+    // A blob of another size, e.g. from a firmware with a different DeviceConfig, gives the defaults
+    nvs_handle_t handle;
+    CHECK(nvs_open("config", NVS_READWRITE, &handle) == ESP_OK);
+    uint8_t old_blob[100] = {};
+    CHECK(nvs_set_blob(handle, "stored", old_blob, sizeof(old_blob)) == ESP_OK);
+    nvs_close(handle);
+    ConfigStore &updated = boot();
+    CHECK(same_config(updated.get_current(), defaults()) && !updated.in_trial());
+}
+
+static void push(UploadBacklog &backlog, uint32_t config_version) {
+    const char *body = "#config,0\n1.000000,0.0,0.0,1.0\n";
+    size_t len = UploadBacklog::HEADER_LEN + strlen(body);
+    char *data = (char *)malloc(len);
+    memcpy(data + UploadBacklog::HEADER_LEN, body, strlen(body));
+    WindowSummary summary;
+    summary.reset(0);
+    summary.add(1000, 0.0f, 0.0f, 1.0f);
+    backlog.push(data, len, summary, config_version);
+}
+
+static void test_acknowledged_config() {
+    // Static like the firmware's instance, it holds semaphores and a large summary pool
+    static UploadBacklog backlog;
+    CHECK(backlog.init("a0b1c2d3e4f5") == ESP_OK);
+    uint32_t session = backlog.get_session();
+    UploadItem first, second, third;
+
+    push(backlog, 1);
+    CHECK(backlog.next(first, 0));
+    backlog.complete(first, true);
+    push(backlog, 2);
+    CHECK(backlog.next(second, 0));
+    backlog.complete(second, true);
+    CHECK(backlog.get_acknowledged_config() == 0);
+
+    // Sent is not enough, and acknowledgements from another boot are stale
+    backlog.acknowledge(session + 1, second.sequence);
+    CHECK(backlog.get_acknowledged_config() == 0);
+    backlog.acknowledge(session, first.sequence);
+    CHECK(backlog.get_acknowledged_config() == 1);
+    CHECK(backlog.get_raw_pending() == 1);
+
+    // An acknowledgement that arrives while the batch is still being sent counts once it completes
+    push(backlog, 3);
+    CHECK(backlog.next(third, 0));
+    backlog.acknowledge(session, third.sequence);
+    CHECK(backlog.get_acknowledged_config() == 2);
+    backlog.complete(third, true);
+    CHECK(backlog.get_acknowledged_config() == 3);
+    CHECK(backlog.get_raw_pending() == 0);
+
+    // A late acknowledgement of an older batch does not lower it
+    backlog.acknowledge(session, first.sequence);
+    CHECK(backlog.get_acknowledged_config() == 3);
+    UploadItem idle;
+    CHECK(!backlog.next(idle, 0));
+}
+
+int main() {
+#ifdef COUNT_ALLOCATIONS
+    __sanitizer_install_malloc_and_free_hooks(count_malloc, ignore_free);
+#else
+    printf("Not built with AddressSanitizer, allocations are not counted\n");
+#endif
+    test_valid();
+    test_rejected();
+    test_fuzz();
+#ifdef COUNT_ALLOCATIONS
+    // Config documents arrive unsolicited and are parsed without allocating
+    printf("%zu allocations while parsing\n", (size_t)allocations);
+    CHECK(allocations == 0);
+#endif
+    test_store_trial();
+    test_store_rollback();
+    test_acknowledged_config();
+    return host_test_result();
+}
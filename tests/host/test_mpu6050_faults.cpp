@@ -0,0 +1,134 @@
+// MPU6050 error handling and recover() against faults injected into the simulated bus: NACKs, a stuck
+// bus, and asynchronous transfers that complete late or never.
+#include "host_test.h"
+#include "mpu6050.h"
+#include "sim_i2c.h"
+
+#include <string.h>
+
+static const uint8_t ACCEL_CONFIG = 0x1C;
+static const uint8_t GYRO_CONFIG = 0x1B;
+
+static void make_burst(uint8_t seed, uint8_t raw[14]) {
+    for (int i = 0; i < 14; i++) {
+        raw[i] = (uint8_t)(seed * 17 + i);
+    }
+}
+
+// The burst read must return what the sensor holds now
+static bool reads_current(MPU6050 &mpu, uint8_t seed) {
+    uint8_t expected[14], raw[14];
+    make_burst(seed, expected);
+    sim_mpu6050_set_burst(expected);
+    return mpu.read_raw(raw) == ESP_OK && memcmp(raw, expected, 14) == 0;
+}
+
+// recover() resets the device, the configured ranges have to be written back
+static bool ranges_restored(uint8_t accel_range, uint8_t gyro_range) {
+    return (sim_mpu6050_register(ACCEL_CONFIG) >> 3 & 3) == accel_range &&
+           (sim_mpu6050_register(GYRO_CONFIG) >> 3 & 3) == gyro_range;
+}
+
+static void test_nack(MPU6050 &mpu) {
+    uint8_t raw[14];
+    uint32_t faults = mpu.get_fault_count();
+    sim_i2c_fail_next(1, I2C_EVENT_NACK);
+    CHECK(mpu.read_raw(raw) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(mpu.recover() == ESP_OK);
+    CHECK(mpu.get_fault_count() == faults + 1);
+    CHECK(ranges_restored(2, 1));
+    CHECK(reads_current(mpu, 1));
+}
+
+static void test_stuck_bus(MPU6050 &mpu) {
+    uint8_t raw[14];
+    sim_i2c_set_stuck(true);
+    CHECK(mpu.read_raw(raw) == ESP_ERR_TIMEOUT);
+    CHECK(mpu.read_raw(raw) == ESP_ERR_TIMEOUT);
+    CHECK(mpu.recover() == ESP_OK);
+    CHECK(ranges_restored(2, 1));
+    CHECK(reads_current(mpu, 2));
+}
+
+// The burst completes after finish_read() gave up. recover() must let it finish before resetting the
+// bus, and its completion must not be taken for the next read.
+static void test_late_completion(MPU6050 &mpu) {
+    uint8_t raw[14];
+    size_t added = sim_i2c_devices_added();
+    sim_i2c_hold_next(false);
+    CHECK(mpu.start_read() == ESP_OK);
+    CHECK(mpu.finish_read(raw, 5) == ESP_ERR_TIMEOUT);
+    CHECK(mpu.recover() == ESP_OK);
+    CHECK(sim_i2c_resets_while_busy() == 0);
+    CHECK(sim_i2c_removed_while_busy() == 0);
+    CHECK(sim_i2c_devices_added() == added);
+    CHECK(reads_current(mpu, 3));
+    CHECK(reads_current(mpu, 4));
+
+    // Same for a register access that times out inside transfer()
+    sim_i2c_hold_next(false);
+    CHECK(mpu.set_gyro_scale_range(1) == ESP_ERR_TIMEOUT);
+    CHECK(reads_current(mpu, 5));
+    CHECK(mpu.set_gyro_scale_range(1) == ESP_OK);
+}
+
+// The burst never completes: the bus reset aborts it, and only once its completion is in is the device
+// handle replaced. The driver does not cancel transfers of a removed device.
+static void test_hung_transfer(MPU6050 &mpu) {
+    uint8_t raw[14];
+    size_t added = sim_i2c_devices_added();
+    size_t aborted = sim_i2c_aborted_transfers();
+    size_t resets = sim_i2c_resets_while_busy();
+    sim_i2c_hold_next(true);
+    CHECK(mpu.start_read() == ESP_OK);
+    CHECK(mpu.finish_read(raw, 5) == ESP_ERR_TIMEOUT);
+    CHECK(mpu.recover() == ESP_OK);
+    CHECK(sim_i2c_removed_while_busy() == 0);
+    CHECK(sim_i2c_resets_while_busy() == resets + 1);
+    CHECK(sim_i2c_devices_added() == added + 1);
+    CHECK(sim_i2c_aborted_transfers() == aborted + 1);
+    CHECK(ranges_restored(2, 1));
+    CHECK(reads_current(mpu, 6));
+
+    // Same for a register access, whose buffers are the object's own
+    added = sim_i2c_devices_added();
+    sim_i2c_hold_next(true);
+    CHECK(mpu.set_gyro_scale_range(1) == ESP_ERR_TIMEOUT);
+    CHECK(sim_i2c_removed_while_busy() == 0);
+    CHECK(sim_i2c_devices_added() == added + 1);
+    CHECK(sim_i2c_aborted_transfers() == aborted + 2);
+    CHECK(reads_current(mpu, 7));
+    CHECK(mpu.set_gyro_scale_range(1) == ESP_OK);
+    CHECK(ranges_restored(2, 1));
+}
+
+static void test_sync(MPU6050 &mpu) {
+    uint8_t raw[14];
+    sim_i2c_fail_next(1, I2C_EVENT_NACK);
+    CHECK(mpu.read_raw(raw) != ESP_OK);
+    CHECK(mpu.recover() == ESP_OK);
+    CHECK(mpu.get_fault_count() == 1);
+    CHECK(reads_current(mpu, 8));
+}
+
+int main() {
+    i2c_master_bus_handle_t bus = sim_i2c_bus();
+    // Static like the firmware's instance, the driver never releases its handles
+    static MPU6050 mpu;
+    mpu.init(bus, true);
+    CHECK(mpu.set_acceleration_scale_range(2) == ESP_OK);
+    CHECK(mpu.set_gyro_scale_range(1) == ESP_OK);
+    CHECK(reads_current(mpu, 0));
+
+    test_nack(mpu);
+    test_stuck_bus(mpu);
+    test_late_completion(mpu);
+    test_hung_transfer(mpu);
+    CHECK(mpu.get_fault_count() == 4);
+
+    static MPU6050 sync_mpu;
+    sync_mpu.init(bus);
+    CHECK(sync_mpu.set_acceleration_scale_range(2) == ESP_OK);
+    test_sync(sync_mpu);
+    return host_test_result();
+}
@@ -0,0 +1,111 @@
+// PositionFilter on a synthetic drive: a train on straight track with a varying speed, 1 Hz GPS and a 200 Hz
+// accelerometer mounted backwards with a gravity bias. GPS error is mostly a slowly wandering offset, as
+// with a real receiver, plus a little white noise. There are no recorded
+// drives in the repository, so the drive is generated; a 20 s tunnel cuts the GPS after the filter has had
+// time to learn the mounting direction.
+#include "host_test.h"
+#include "position_filter.h"
+
+#include <math.h>
+#include <random>
+
+static const double METRES_PER_DEGREE = 111319.49;
+static const double START_LATITUDE = 60.17;
+static const double START_LONGITUDE = 24.94;
+static const double HEADING = 0.5; // radians north of east
+static const float ACCEL_SIGN = -1.0f;
+static const float ACCEL_BIAS = 0.3f; // m/s^2
+static const int64_t SAMPLE_US = 5000;
+static const int64_t TUNNEL_START_US = 150000000;
+static const int64_t TUNNEL_END_US = 170000000;
+static const int64_t END_US = 200000000;
+static const double GPS_ERROR_M = 3.0;
+static const double GPS_ERROR_CORRELATION_S = 60.0;
+static const double GPS_NOISE_M = 0.3;
+
+struct Truth {
+    double s; // along-track distance, m
+    double v;
+    double a;
+};
+
+// Speed oscillates between 15 and 25 m/s with a 40 s period
+static Truth truth(int64_t time_us) {
+    const double w = 2 * M_PI / 40.0;
+    double t = time_us * 1e-6;
+    return {20.0 * t - 5.0 / w * cos(w * t) + 5.0 / w, 20.0 + 5.0 * sin(w * t), 5.0 * w * cos(w * t)};
+}
+
+static void to_position(double s, double &latitude, double &longitude) {
+    latitude = START_LATITUDE + s * sin(HEADING) / METRES_PER_DEGREE;
+    longitude = START_LONGITUDE + s * cos(HEADING) / (cos(START_LATITUDE * M_PI / 180.0) * METRES_PER_DEGREE);
+}
+
+int main() {
+    std::mt19937 random(29);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::normal_distribution<float> accel_noise(0.0f, 0.3f);
+    PositionFilter filter;
+
+    // First-order Gauss-Markov GPS error per axis
+    const double alpha = exp(-1.0 / GPS_ERROR_CORRELATION_S);
+    double error_east = GPS_ERROR_M * normal(random), error_north = GPS_ERROR_M * normal(random);
+    double last_fix_latitude = 0, last_fix_longitude = 0;
+    double worst_outage_error = 0, held_fix_error = 0, outage_speed_error = 0;
+    double worst_error_before = 0, worst_error_after = 0;
+    bool outage_flagged = false, outage_cleared = true;
+    for (int64_t time_us = 0; time_us <= END_US; time_us += SAMPLE_US) {
+        Truth now = truth(time_us);
+        bool in_tunnel = time_us >= TUNNEL_START_US && time_us < TUNNEL_END_US;
+        if (time_us % 1000000 == 0 && !in_tunnel) {
+            double latitude, longitude;
+            to_position(now.s, latitude, longitude);
+            error_east = alpha * error_east + sqrt(1 - alpha * alpha) * GPS_ERROR_M * normal(random);
+            error_north = alpha * error_north + sqrt(1 - alpha * alpha) * GPS_ERROR_M * normal(random);
+            latitude += (error_north + GPS_NOISE_M * normal(random)) / METRES_PER_DEGREE;
+            longitude +=
+                (error_east + GPS_NOISE_M * normal(random)) / (cos(latitude * M_PI / 180.0) * METRES_PER_DEGREE);
+            filter.update(time_us, latitude, longitude);
+            last_fix_latitude = latitude;
+            last_fix_longitude = longitude;
+        }
+        filter.predict(time_us, ACCEL_SIGN * (float)now.a + ACCEL_BIAS + accel_noise(random));
+
+        std::optional<PositionEstimate> estimate = filter.estimate();
+        CHECK(estimate.has_value());
+        if (!estimate.has_value()) continue;
+        double latitude, longitude;
+        to_position(now.s, latitude, longitude);
+        double error = PositionFilter::distance_metres(latitude, longitude, estimate->latitude, estimate->longitude);
+        if (time_us >= 60000000 && time_us < TUNNEL_START_US) {
+            worst_error_before = fmax(worst_error_before, error);
+        } else if (in_tunnel) {
+            worst_outage_error = fmax(worst_outage_error, error);
+            held_fix_error = PositionFilter::distance_metres(latitude, longitude, last_fix_latitude, last_fix_longitude);
+            outage_speed_error = fmax(outage_speed_error, fabs(estimate->speed - now.v));
+            if (time_us >= TUNNEL_START_US + 3000000) outage_flagged &= estimate->gps_outage;
+            if (time_us == TUNNEL_START_US + 3000000) outage_flagged = estimate->gps_outage;
+        } else if (time_us >= TUNNEL_END_US + 10000000) {
+            worst_error_after = fmax(worst_error_after, error);
+            outage_cleared &= !estimate->gps_outage;
+        }
+    }
+
+    printf("worst error before the tunnel %.1f m, in the tunnel %.1f m (last fix %.0f m behind), %.1f m after\n",
+           worst_error_before, worst_outage_error, held_fix_error, worst_error_after);
+    printf("worst speed error in the tunnel %.2f m/s\n", outage_speed_error);
+    // The GPS offset alone reaches about 10 m on this drive
+    CHECK(worst_error_before < 15.0);
+    // Dead reckoning stays within a small fraction of the distance covered since the last fix
+    CHECK(worst_outage_error < 25.0);
+    CHECK(worst_outage_error < held_fix_error / 10);
+    CHECK(outage_speed_error < 1.0);
+    CHECK(outage_flagged);
+    CHECK(outage_cleared);
+    CHECK(worst_error_after < 15.0);
+
+    // Without a fix for longer than the dead-reckoning limit there is no estimate
+    filter.predict(END_US + 121000000, 0.0f);
+    CHECK(!filter.estimate().has_value());
+    return host_test_result();
+}
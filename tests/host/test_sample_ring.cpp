@@ -0,0 +1,116 @@
+// SampleRing (main/sample_ring.h): ordering, overrun accounting and wrap-around, then a producer and a
+// consumer thread hammering the ring like vReadMPU6050 and vEncode do.
+#include "host_test.h"
+#include "sample_ring.h"
+
+#include <atomic>
+#include <string.h>
+#include <thread>
+
+// Same layout as Sample in main.cpp
+struct TestSample {
+    uint32_t sequence;
+    int64_t timestamp_us;
+    uint8_t raw[14];
+    uint8_t flags;
+    uint8_t config_generation;
+};
+
+static TestSample make_sample(uint32_t sequence) {
+    TestSample sample;
+    sample.sequence = sequence;
+    sample.timestamp_us = (int64_t)sequence * 5000;
+    for (int i = 0; i < 14; i++) {
+        sample.raw[i] = (uint8_t)(sequence * 31 + i);
+    }
+    sample.flags = sequence & 0x03;
+    sample.config_generation = (uint8_t)(sequence >> 4);
+    return sample;
+}
+
+// A torn read would mix the fields of two samples
+static bool is_consistent(const TestSample &sample) {
+    TestSample expected = make_sample(sample.sequence);
+    return sample.timestamp_us == expected.timestamp_us && memcmp(sample.raw, expected.raw, 14) == 0 &&
+           sample.flags == expected.flags && sample.config_generation == expected.config_generation;
+}
+
+static void test_single_thread() {
+    SampleRing<TestSample, 8> ring;
+    TestSample sample;
+    CHECK(ring.capacity() == 8);
+    CHECK(!ring.pop(sample));
+    for (uint32_t i = 0; i < 8; i++) {
+        CHECK(ring.push(make_sample(i)));
+    }
+    CHECK(ring.size() == 8);
+    CHECK(!ring.push(make_sample(8)));
+    CHECK(ring.get_overruns() == 1);
+    CHECK(ring.pop(sample) && sample.sequence == 0);
+
+    TestSample out[16];
+    CHECK(ring.pop_bulk(out, 3) == 3);
+    CHECK(out[0].sequence == 1 && out[2].sequence == 3);
+    CHECK(ring.pop_bulk(out, 16) == 4);
+    CHECK(out[3].sequence == 7);
+    CHECK(ring.pop_bulk(out, 16) == 0);
+
+    // Wrap the indices around the buffer many times
+    uint32_t next_push = 100, next_pop = 100;
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < 5; i++) {
+            CHECK(ring.push(make_sample(next_push++)));
+        }
+        size_t n = ring.pop_bulk(out, 16);
+        CHECK(n == 5);
+        for (size_t i = 0; i < n; i++) {
+            CHECK(out[i].sequence == next_pop++ && is_consistent(out[i]));
+        }
+    }
+    CHECK(ring.get_overruns() == 1);
+}
+
+// The producer never waits, like the sampler: every sample is either received in order or counted as an
+// overrun
+static void test_threads(uint32_t count) {
+    static SampleRing<TestSample, 512> ring;
+    std::atomic<bool> done{false};
+    uint32_t received = 0, out_of_order = 0, torn = 0;
+    std::thread consumer([&] {
+        TestSample out[32];
+        int64_t last = -1;
+        while (true) {
+            bool finished = done.load(std::memory_order_acquire);
+            size_t n = ring.pop_bulk(out, 32);
+            for (size_t i = 0; i < n; i++) {
+                if ((int64_t)out[i].sequence <= last) out_of_order++;
+                if (!is_consistent(out[i])) torn++;
+                last = out[i].sequence;
+            }
+            received += n;
+            if (n == 0) {
+                if (finished) break;
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < count; i++) {
+            ring.push(make_sample(i));
+        }
+        done.store(true, std::memory_order_release);
+    });
+    producer.join();
+    consumer.join();
+    printf("threads: %u pushed, %u received, %u overruns\n", count, received, ring.get_overruns());
+    CHECK(out_of_order == 0);
+    CHECK(torn == 0);
+    CHECK(received + ring.get_overruns() == count);
+    CHECK(ring.size() == 0);
+}
+
+int main() {
+    test_single_thread();
+    test_threads(2000000);
+    return host_test_result();
+}
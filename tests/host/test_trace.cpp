@@ -0,0 +1,126 @@
+// Trace records as trace_dump() prints them: fields, per-core rings, wrap-around, compiled-out levels and
+// the dump of the previous boot's records after a crash
+#include "esp_cpu.h"
+#include "esp_system.h"
+#include "host_test.h"
+#include "trace.h"
+
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t RING_SIZE = 256;
+
+struct DumpedRecord {
+    int core;
+    TraceRecord record;
+};
+
+// Runs `body` with stdout redirected to a temporary file and returns what it printed
+template <typename F> static std::string capture_stdout(F body) {
+    fflush(stdout);
+    FILE *tmp = tmpfile();
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    body();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    std::string output;
+    rewind(tmp);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), tmp)) > 0) {
+        output.append(buf, n);
+    }
+    fclose(tmp);
+    return output;
+}
+
+static std::vector<DumpedRecord> parse_dump(const std::string &output) {
+    std::vector<DumpedRecord> records;
+    size_t start = 0;
+    while (start < output.size()) {
+        size_t end = output.find('\n', start);
+        if (end == std::string::npos) end = output.size();
+        std::string line = output.substr(start, end - start);
+        start = end + 1;
+        int core;
+        char hex[sizeof(TraceRecord) * 2 + 1];
+        if (sscanf(line.c_str(), "TRACE,%d,%48s", &core, hex) != 2 || strlen(hex) != sizeof(hex) - 1) continue;
+        DumpedRecord dumped = {core, {}};
+        uint8_t *bytes = (uint8_t *)&dumped.record;
+        for (size_t i = 0; i < sizeof(TraceRecord); i++) {
+            sscanf(hex + i * 2, "%2hhx", &bytes[i]);
+        }
+        records.push_back(dumped);
+    }
+    return records;
+}
+
+static std::vector<DumpedRecord> dump() {
+    return parse_dump(capture_stdout(trace_dump));
+}
+
+int main() {
+    host_set_reset_reason(ESP_RST_POWERON);
+    std::string output = capture_stdout(trace_init);
+    CHECK(output.find("before the") == std::string::npos);
+    std::vector<DumpedRecord> records = dump();
+    CHECK(records.size() == 1);
+    CHECK(records[0].core == 0 && records[0].record.event == TRACE_BOOT);
+    CHECK(records[0].record.argc == 1 && records[0].record.args[0] == ESP_RST_POWERON);
+
+    // Fields and argument counts
+    TRACE_I(TRACE_CONFIG_APPLIED, 7, 2);
+    TRACE_W(TRACE_I2C_FAULT, 42, (uint32_t)-1, 3);
+    TRACE_E(TRACE_BATCH_ALLOC_FAILED);
+    TRACE_I(TRACE_BACKLOG_EVICTED, 1, 2, 3);
+    trace_emit(TRACE_LEVEL_INFO, TRACE_GPS_FIX, (int32_t)-601700000, 249400000, 5, 6);
+    records = dump();
+    CHECK(records.size() == 6);
+    const TraceRecord &applied = records[1].record;
+    CHECK(applied.event == TRACE_CONFIG_APPLIED && applied.level == TRACE_LEVEL_INFO && applied.argc == 2);
+    CHECK(applied.args[0] == 7 && applied.args[1] == 2);
+    const TraceRecord &fault = records[2].record;
+    CHECK(fault.level == TRACE_LEVEL_WARN && fault.argc == 3 && fault.args[1] == 0xFFFFFFFF);
+    CHECK(records[3].record.argc == 0 && records[3].record.level == TRACE_LEVEL_ERROR);
+    CHECK(records[5].record.argc == 4 && (int32_t)records[5].record.args[0] == -601700000);
+    CHECK(records[5].record.timestamp_us >= records[1].record.timestamp_us);
+
+    // Debug trace points are compiled out at the default level and don't evaluate their arguments
+    int evaluated = 0;
+    TRACE_D(TRACE_GPS_SENTENCE, evaluated++, 0);
+    CHECK(evaluated == 0);
+    CHECK(dump().size() == 6);
+
+    // Each core has its own ring, and a full ring keeps the newest records, oldest first
+    host_set_core_id(1);
+    TRACE_I(TRACE_UPLOAD_ACK, 99, 0);
+    host_set_core_id(0);
+    for (uint32_t i = 0; i < RING_SIZE + 10; i++) {
+        TRACE_I(TRACE_UPLOAD_DONE, i, 0, 0);
+    }
+    records = dump();
+    CHECK(records.size() == RING_SIZE + 1);
+    CHECK(records[0].core == 0 && records[0].record.args[0] == 10);
+    CHECK(records[RING_SIZE - 1].record.args[0] == RING_SIZE + 9);
+    bool in_order = true;
+    for (uint32_t i = 1; i < RING_SIZE; i++) {
+        in_order &= records[i].record.args[0] == records[i - 1].record.args[0] + 1;
+    }
+    CHECK(in_order);
+    CHECK(records[RING_SIZE].core == 1 && records[RING_SIZE].record.event == TRACE_UPLOAD_ACK);
+
+    // After a crash, trace_init dumps the records that survived in .noinit memory before clearing them
+    host_set_reset_reason(ESP_RST_TASK_WDT);
+    output = capture_stdout(trace_init);
+    CHECK(output.find("Trace records from before the crash reset") != std::string::npos);
+    records = parse_dump(output);
+    CHECK(records.size() == RING_SIZE + 1);
+    records = dump();
+    CHECK(records.size() == 1 && records[0].record.args[0] == ESP_RST_TASK_WDT);
+
+    return host_test_result();
+}
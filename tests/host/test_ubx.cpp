@@ -0,0 +1,216 @@
+// UBX framing (gy_neo6mv2.h) and the AID-INI/EPH/ALM round trip: messages read from the receiver, saved
+// to the stand-in NVS, then written back to the receiver by restore_aid() after a "power cycle".
+#include "gy_neo6mv2.h"
+#include "host_test.h"
+#include "nvs.h"
+
+#include <random>
+#include <string.h>
+#include <vector>
+
+static const uart_port_t GPS_UART = UART_NUM_1;
+static const size_t AID_INI_POS_ACC_OFFSET = 12;
+static const size_t AID_INI_FLAGS_OFFSET = 44;
+
+static uint32_t read_le32(const uint8_t *data) {
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void write_le32(uint8_t *data, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        data[i] = value >> (8 * i);
+    }
+}
+
+static std::vector<uint8_t> random_payload(std::mt19937 &random, size_t len) {
+    std::vector<uint8_t> payload(len);
+    for (uint8_t &byte : payload) {
+        byte = random();
+    }
+    return payload;
+}
+
+// Per-satellite AID payload, SV number in the first word
+static std::vector<uint8_t> satellite_payload(std::mt19937 &random, uint32_t svid, size_t len) {
+    std::vector<uint8_t> payload = random_payload(random, len);
+    write_le32(payload.data(), svid);
+    return payload;
+}
+
+static std::vector<uint8_t> frame(uint8_t id, const std::vector<uint8_t> &payload) {
+    std::vector<uint8_t> out(payload.size() + UBX::FRAME_OVERHEAD);
+    size_t len = UBX::encode(out.data(), out.size(), UBX::CLASS_AID, id, payload.data(), payload.size());
+    out.resize(len);
+    return out;
+}
+
+static void feed(const std::vector<uint8_t> &bytes) {
+    host_uart_feed_rx(GPS_UART, bytes.data(), bytes.size());
+}
+
+// read() returns on the next GLL sentence, so every batch of UBX input ends with one
+static void receive(GY_NEO6MV2 &gps) {
+    const char *gll = "$GPGLL,6010.1940,N,02456.3040,E,120000.00,A,A*6C\r\n";
+    host_uart_feed_rx(GPS_UART, (const uint8_t *)gll, strlen(gll));
+    GY_NEO6MV2_data data = gps.read();
+    CHECK(data.position.latitude.has_value() && data.position.longitude.has_value());
+}
+
+// Splits what the firmware wrote to the receiver into UBX messages, NMEA sentences are skipped
+static std::vector<std::vector<uint8_t>> sent_messages() {
+    static uint8_t tx[65536];
+    size_t len = host_uart_take_tx(GPS_UART, tx, sizeof(tx));
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t pos = 0; pos + UBX::FRAME_OVERHEAD <= len;) {
+        if (tx[pos] != 0xB5 || tx[pos + 1] != 0x62) {
+            pos++;
+            continue;
+        }
+        size_t frame_len = (tx[pos + 4] | tx[pos + 5] << 8) + UBX::FRAME_OVERHEAD;
+        frames.emplace_back(tx + pos, tx + pos + frame_len);
+        pos += frame_len;
+    }
+    return frames;
+}
+
+static void test_framing() {
+    std::mt19937 random(37);
+    const uint16_t lengths[] = {0, 1, GPS_aid::ALM_LEN, GPS_aid::INI_LEN, GPS_aid::EPH_LEN};
+    for (uint16_t len : lengths) {
+        std::vector<uint8_t> payload = random_payload(random, len);
+        uint8_t out[GPS_aid::EPH_LEN + UBX::FRAME_OVERHEAD];
+        size_t frame_len = UBX::encode(out, len + UBX::FRAME_OVERHEAD, UBX::CLASS_AID, UBX::ID_AID_EPH,
+                                       payload.data(), len);
+        CHECK(frame_len == len + UBX::FRAME_OVERHEAD);
+        CHECK(UBX::encode(out, len + UBX::FRAME_OVERHEAD - 1, UBX::CLASS_AID, UBX::ID_AID_EPH, payload.data(),
+                          len) == 0);
+
+        UBX_message message;
+        CHECK(UBX::decode(out, frame_len, message));
+        CHECK(message.cls == UBX::CLASS_AID && message.id == UBX::ID_AID_EPH && message.len == len);
+        CHECK(message.payload == out + 6 && (len == 0 || memcmp(message.payload, payload.data(), len) == 0));
+
+        // Any single corrupted byte is caught by the sync, length or checksum check
+        for (size_t i = 0; i < frame_len; i++) {
+            out[i] ^= 0x10;
+            CHECK(!UBX::decode(out, frame_len, message));
+            out[i] ^= 0x10;
+        }
+        CHECK(!UBX::decode(out, frame_len - 1, message));
+        CHECK(!UBX::decode(out, frame_len + 1, message));
+        CHECK(UBX::decode(out, frame_len, message));
+    }
+    UBX_message message;
+    const uint8_t short_frame[] = {0xB5, 0x62, 0x0B, 0x01, 0x00, 0x00, 0x0C};
+    CHECK(!UBX::decode(short_frame, sizeof(short_frame), message));
+}
+
+static void test_round_trip() {
+    std::mt19937 random(6);
+    host_nvs_erase_all();
+    static GY_NEO6MV2 gps;
+    gps.init(GPS_UART);
+    sent_messages();
+
+    // Nothing saved yet
+    CHECK(gps.restore_aid() == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(!gps.get_aid_injected());
+    CHECK(sent_messages().empty());
+
+    // Position known to 50 m, with time flags set that must not be injected after a power cycle
+    std::vector<uint8_t> ini = random_payload(random, GPS_aid::INI_LEN);
+    write_le32(ini.data() + AID_INI_POS_ACC_OFFSET, 5000);
+    write_le32(ini.data() + AID_INI_FLAGS_OFFSET, 0x01 | 0x02 | 0x20 | 0x400);
+    std::vector<uint8_t> eph3 = satellite_payload(random, 3, GPS_aid::EPH_LEN);
+    std::vector<uint8_t> eph17 = satellite_payload(random, 17, GPS_aid::EPH_LEN);
+    std::vector<uint8_t> alm5 = satellite_payload(random, 5, GPS_aid::ALM_LEN);
+    feed(frame(UBX::ID_AID_INI, ini));
+    feed(frame(UBX::ID_AID_EPH, eph3));
+    feed(frame(UBX::ID_AID_EPH, eph17));
+    feed(frame(UBX::ID_AID_ALM, alm5));
+    // No data for SV 7, an out-of-range SV and a frame with a bad checksum are all ignored
+    feed(frame(UBX::ID_AID_EPH, satellite_payload(random, 7, 8)));
+    feed(frame(UBX::ID_AID_ALM, satellite_payload(random, 33, GPS_aid::ALM_LEN)));
+    std::vector<uint8_t> corrupt = frame(UBX::ID_AID_EPH, satellite_payload(random, 9, GPS_aid::EPH_LEN));
+    corrupt[20] ^= 0xFF;
+    feed(corrupt);
+    receive(gps);
+
+    size_t writes = host_nvs_write_count();
+    CHECK(gps.save_aid() == ESP_OK);
+    CHECK(host_nvs_write_count() == writes + 1);
+    // Unchanged data is not written again
+    feed(frame(UBX::ID_AID_EPH, eph3));
+    receive(gps);
+    CHECK(gps.save_aid() == ESP_OK);
+    CHECK(host_nvs_write_count() == writes + 1);
+
+    static GY_NEO6MV2 rebooted;
+    rebooted.init(GPS_UART);
+    sent_messages();
+    CHECK(rebooted.restore_aid() == ESP_OK);
+    CHECK(rebooted.get_aid_injected());
+    std::vector<std::vector<uint8_t>> sent = sent_messages();
+    CHECK(sent.size() == 4);
+    if (sent.size() != 4) return;
+
+    UBX_message message;
+    CHECK(UBX::decode(sent[0].data(), sent[0].size(), message) && message.id == UBX::ID_AID_INI);
+    CHECK(message.len == GPS_aid::INI_LEN);
+    // Only the position flags survive, and the accuracy is widened for a vehicle that may have moved
+    CHECK(read_le32(message.payload + AID_INI_FLAGS_OFFSET) == (0x01 | 0x20));
+    CHECK(read_le32(message.payload + AID_INI_POS_ACC_OFFSET) == 100000);
+    CHECK(memcmp(message.payload, ini.data(), AID_INI_POS_ACC_OFFSET) == 0);
+    CHECK(memcmp(message.payload + 16, ini.data() + 16, AID_INI_FLAGS_OFFSET - 16) == 0);
+
+    CHECK(UBX::decode(sent[1].data(), sent[1].size(), message) && message.id == UBX::ID_AID_EPH);
+    CHECK(message.len == GPS_aid::EPH_LEN && memcmp(message.payload, eph3.data(), GPS_aid::EPH_LEN) == 0);
+    CHECK(UBX::decode(sent[2].data(), sent[2].size(), message) && message.id == UBX::ID_AID_EPH);
+    CHECK(message.len == GPS_aid::EPH_LEN && memcmp(message.payload, eph17.data(), GPS_aid::EPH_LEN) == 0);
+    CHECK(UBX::decode(sent[3].data(), sent[3].size(), message) && message.id == UBX::ID_AID_ALM);
+    CHECK(message.len == GPS_aid::ALM_LEN && memcmp(message.payload, alm5.data(), GPS_aid::ALM_LEN) == 0);
+
+    // The receiver reports no ephemeris for SV 3 any more, so it is not injected on the next start
+    feed(frame(UBX::ID_AID_EPH, satellite_payload(random, 3, 8)));
+    receive(rebooted);
+    CHECK(rebooted.save_aid() == ESP_OK);
+    static GY_NEO6MV2 again;
+    again.init(GPS_UART);
+    sent_messages();
+    CHECK(again.restore_aid() == ESP_OK);
+    sent = sent_messages();
+    CHECK(sent.size() == 3);
+}
+
+static void test_nvs_errors() {
+    static GY_NEO6MV2 gps;
+    gps.init(GPS_UART);
+    std::mt19937 random(60);
+    feed(frame(UBX::ID_AID_EPH, satellite_payload(random, 1, GPS_aid::EPH_LEN)));
+    receive(gps);
+
+    // A failed save keeps the data dirty and is retried
+    host_nvs_fail_writes(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    CHECK(gps.save_aid() == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    host_nvs_fail_writes(ESP_OK);
+    size_t writes = host_nvs_write_count();
+    CHECK(gps.save_aid() == ESP_OK);
+    CHECK(host_nvs_write_count() == writes + 1);
+
+    // A blob of another size, e.g. from a firmware with a different GPS_aid, is not injected
+    nvs_handle_t handle;
+    CHECK(nvs_open("gps_aid", NVS_READWRITE, &handle) == ESP_OK);
+    uint8_t old_blob[100] = {};
+    CHECK(nvs_set_blob(handle, "aid", old_blob, sizeof(old_blob)) == ESP_OK);
+    nvs_close(handle);
+    sent_messages();
+    CHECK(gps.restore_aid() != ESP_OK);
+    CHECK(sent_messages().empty());
+}
+
+int main() {
+    test_framing();
+    test_round_trip();
+    test_nvs_errors();
+    return host_test_result();
+}
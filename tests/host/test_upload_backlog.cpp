@@ -0,0 +1,367 @@
+// UploadBacklog ordering through an outage: batches go out as they come while the uploader keeps up; after
+// an outage the summary pyramid covers the gap coarsest level first, then raw batches flagged first and
+// newest first, with the oldest unflagged batches evicted into level 0. Also the WindowSummary arithmetic
+// and the delivery protocol: the document header, acknowledgements and resends.
+#include "esp_rom_crc.h"
+#include "freertos/task.h"
+#include "host_test.h"
+#include "upload_backlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static const char *DEVICE_ID = "a0b1c2d3e4f5";
+// ACK_TIMEOUT_MS in upload_backlog.h
+static const uint32_t ACK_TIMEOUT_MS = 10000;
+
+// What a document carried: one raw batch, or the summary lines of one level
+struct Received {
+    bool summary;
+    int batch;
+    int level;
+    std::vector<WindowSummary> windows;
+    uint32_t sequence;
+};
+
+// Two samples per one-second batch, x = batch .. batch + 0.5, y = -batch, z = 1
+static WindowSummary batch_window(int batch, bool flagged) {
+    int64_t start_us = (int64_t)batch * 1000000;
+    WindowSummary window;
+    window.reset(start_us);
+    window.add(start_us, batch, -batch, 1.0f);
+    window.add(start_us + 990000, batch + 0.5f, -batch, 1.0f);
+    if (flagged) window.flags |= WINDOW_FLAG_EVENT;
+    return window;
+}
+
+static void push(UploadBacklog &backlog, int batch, bool flagged = false) {
+    char body[32];
+    int body_len = snprintf(body, sizeof(body), "raw,%d\n", batch);
+    char *data = (char *)malloc(UploadBacklog::HEADER_LEN + body_len);
+    memcpy(data + UploadBacklog::HEADER_LEN, body, body_len);
+    backlog.push(data, UploadBacklog::HEADER_LEN + body_len, batch_window(batch, flagged), 1);
+}
+
+static Received decode(const UploadItem &item) {
+    Received received = {};
+    received.sequence = item.sequence;
+    std::string body(item.data + UploadBacklog::HEADER_LEN, item.len - UploadBacklog::HEADER_LEN);
+    if (sscanf(body.c_str(), "raw,%d", &received.batch) == 1) return received;
+    received.summary = true;
+    CHECK(sscanf(body.c_str(), "#summary,%d", &received.level) == 1);
+    for (size_t pos = body.find('\n') + 1; pos < body.size(); pos = body.find('\n', pos) + 1) {
+        WindowSummary s = {};
+        long long seconds, micros;
+        unsigned long duration, count;
+        unsigned flags;
+        int fields = sscanf(body.c_str() + pos, "%lld.%lld,%lu,%lu,%u,%f,%f,%f,%f,%f,%f,%f,%f,%f", &seconds, &micros,
+                            &duration, &count, &flags, &s.min[0], &s.min[1], &s.min[2], &s.max[0], &s.max[1],
+                            &s.max[2], &s.mean[0], &s.mean[1], &s.mean[2]);
+        CHECK(fields == 14);
+        s.start_us = seconds * 1000000 + micros;
+        s.duration_ms = duration;
+        s.count = count;
+        s.flags = flags;
+        received.windows.push_back(s);
+    }
+    return received;
+}
+
+// Sends the next document and has the server acknowledge it
+static bool send_next(UploadBacklog &backlog, Received &received) {
+    UploadItem item;
+    if (!backlog.next(item, 0)) return false;
+    received = decode(item);
+    backlog.complete(item, true);
+    backlog.acknowledge(backlog.get_session(), item.sequence);
+    return true;
+}
+
+static void test_window_summary() {
+    WindowSummary a = batch_window(2, false), b = batch_window(5, true);
+    CHECK(a.count == 2 && a.duration_ms == 990 && a.flags == 0);
+    CHECK_NEAR(a.min[0], 2.0, 1e-6);
+    CHECK_NEAR(a.max[0], 2.5, 1e-6);
+    CHECK_NEAR(a.mean[0], 2.25, 1e-6);
+    CHECK_NEAR(a.range(), 0.5, 1e-6);
+    a.merge(b);
+    CHECK(a.count == 4 && a.flags == WINDOW_FLAG_EVENT);
+    CHECK(a.start_us == 2000000 && a.duration_ms == 3990);
+    CHECK_NEAR(a.min[0], 2.0, 1e-6);
+    CHECK_NEAR(a.max[0], 5.5, 1e-6);
+    CHECK_NEAR(a.mean[0], 3.75, 1e-6);
+    CHECK_NEAR(a.min[1], -5.0, 1e-6);
+    CHECK_NEAR(a.range(), 3.5, 1e-6);
+
+    WindowSummary empty;
+    empty.reset(0);
+    CHECK(empty.range() == 0.0f);
+    empty.merge(batch_window(0, false));
+    CHECK(empty.count == 2);
+    CHECK_NEAR(empty.mean[0], 0.25, 1e-6);
+
+    // A buffer too small for every line is cut off and stays terminated
+    WindowSummary windows[3] = {batch_window(0, false), batch_window(1, false), batch_window(2, false)};
+    char text[100];
+    size_t len = UploadBacklog::format_summaries(text, sizeof(text), 1, windows, 3);
+    CHECK(len == sizeof(text) - 1 && strlen(text) == len);
+    const char *first_line = "#summary,1\n0.000000,990,2,0,0.000,0.000,1.000,0.500,0.000,1.000,0.250,0.000,1.000\n";
+    CHECK(strncmp(text, first_line, strlen(first_line)) == 0);
+}
+
+static void check_window(const WindowSummary &window, int first, int last, bool flagged) {
+    CHECK(window.start_us == (int64_t)first * 1000000);
+    CHECK(window.duration_ms == (uint32_t)(last - first) * 1000 + 990);
+    CHECK(window.count == (uint32_t)(last - first + 1) * 2);
+    CHECK(window.flags == (flagged ? WINDOW_FLAG_EVENT : 0));
+    CHECK_NEAR(window.min[0], first, 1e-3);
+    CHECK_NEAR(window.max[0], last + 0.5, 1e-3);
+    CHECK_NEAR(window.mean[0], (first + last) / 2.0 + 0.25, 1e-3);
+    CHECK_NEAR(window.min[1], -last, 1e-3);
+    CHECK_NEAR(window.max[1], -first, 1e-3);
+}
+
+static void test_outage() {
+    // Static like the firmware's instance, it holds semaphores and a large summary pool
+    static UploadBacklog backlog;
+    CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+    Received received;
+    uint32_t sequence = 0;
+
+    // Connected: every batch goes out on its own and no summaries are sent, although level 1 completes
+    // two windows
+    for (int batch = 0; batch < 25; batch++) {
+        push(backlog, batch);
+        CHECK(send_next(backlog, received));
+        CHECK(!received.summary && received.batch == batch && received.sequence == sequence++);
+        CHECK(!send_next(backlog, received));
+    }
+
+    // Outage of 70 batches, two of them flagged. The backlog holds 60, the ten oldest unflagged ones are
+    // evicted into level 0.
+    for (int batch = 25; batch < 95; batch++) {
+        push(backlog, batch, batch == 30 || batch == 90);
+    }
+    CHECK(backlog.get_raw_pending() == 60);
+    CHECK(backlog.get_evictions() == 10);
+
+    // Reconnected: the coarsest level first. Level 2 covers 0-59, the first window completed while behind.
+    CHECK(send_next(backlog, received));
+    CHECK(received.summary && received.level == 2 && received.windows.size() == 1);
+    if (received.windows.size() == 1) check_window(received.windows[0], 0, 59, true);
+    CHECK(received.sequence == sequence++);
+
+    // Level 1 from the window the outage started in, 20-29, to the last complete one, 80-89
+    CHECK(send_next(backlog, received));
+    CHECK(received.summary && received.level == 1 && received.windows.size() == 7);
+    for (size_t i = 0; i < received.windows.size(); i++) {
+        int first = 20 + 10 * i;
+        check_window(received.windows[i], first, first + 9, first == 30);
+    }
+    CHECK(received.sequence == sequence++);
+
+    // Level 0 holds the evicted batches
+    const int evicted[] = {25, 26, 27, 28, 29, 31, 32, 33, 34, 35};
+    CHECK(send_next(backlog, received));
+    CHECK(received.summary && received.level == 0 && received.windows.size() == 10);
+    for (size_t i = 0; i < received.windows.size() && i < 10; i++) {
+        check_window(received.windows[i], evicted[i], evicted[i], false);
+    }
+    CHECK(received.sequence == sequence++);
+
+    // Then the raw batches, flagged ones first and newest first. A failed send is retried with the same
+    // sequence before anything else.
+    UploadItem item;
+    CHECK(backlog.next(item, 0));
+    CHECK(decode(item).batch == 90 && item.sequence == sequence);
+    backlog.complete(item, false);
+    std::vector<int> expected = {90, 30};
+    for (int batch = 94; batch >= 36; batch--) {
+        if (batch != 90) expected.push_back(batch);
+    }
+    for (int batch : expected) {
+        CHECK(send_next(backlog, received));
+        CHECK(!received.summary && received.batch == batch && received.sequence == sequence++);
+    }
+    CHECK(!send_next(backlog, received));
+    CHECK(backlog.get_raw_pending() == 0);
+
+    // Drained and keeping up again: the level 1 window 90-99 completes, but is covered by the raw batches
+    for (int batch = 95; batch < 105; batch++) {
+        push(backlog, batch);
+        CHECK(send_next(backlog, received));
+        CHECK(!received.summary && received.batch == batch && received.sequence == sequence++);
+    }
+    CHECK(!send_next(backlog, received));
+}
+
+// Flagged batches are kept while unflagged ones are evicted, and a batch that already went out is never
+// evicted: its sequence has to be delivered
+static void test_eviction() {
+    static UploadBacklog backlog;
+    CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+    UploadItem in_flight;
+    push(backlog, 0);
+    CHECK(backlog.next(in_flight, 0));
+    for (int batch = 1; batch < 60; batch++) {
+        push(backlog, batch, batch % 2 == 1);
+    }
+    CHECK(backlog.get_raw_pending() == 60 && backlog.get_evictions() == 0);
+    for (int batch = 60; batch < 90; batch++) {
+        push(backlog, batch, true);
+    }
+    // The 29 unflagged batches go first, then the oldest flagged ones, batch 1 and on evict() batch 3
+    CHECK(backlog.get_raw_pending() == 60);
+    CHECK(backlog.get_evictions() == 30);
+    CHECK(backlog.evict() && backlog.get_evictions() == 31);
+    backlog.complete(in_flight, true);
+    backlog.acknowledge(backlog.get_session(), in_flight.sequence);
+
+    // Only flagged batches are left, the newest first after the summaries
+    Received received;
+    int last = 1000;
+    while (send_next(backlog, received)) {
+        if (received.summary) continue;
+        CHECK(received.batch >= 60 || (received.batch % 2 == 1 && received.batch >= 5));
+        CHECK(received.batch < last);
+        last = received.batch;
+    }
+    CHECK(backlog.get_raw_pending() == 0);
+}
+
+// A server that never acknowledges, like the original HTTPS endpoint: a 2xx reported through delivered()
+// releases the document, and documents sent where delivery is unknown are released once too many wait
+static void test_unacknowledged() {
+    static UploadBacklog backlog;
+    CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+    UploadItem item;
+    push(backlog, 0);
+    CHECK(backlog.next(item, 0));
+    backlog.delivered(item);
+    CHECK(backlog.get_raw_pending() == 0);
+    CHECK(backlog.get_acknowledgements() == 0);
+    CHECK(backlog.get_acknowledged_config() == 1);
+
+    // Three times the slots: every batch goes out once and none is dropped. Unacknowledged batches count
+    // as pending, so summaries go out in between.
+    std::vector<int> sent;
+    for (int batch = 1; batch <= 192; batch++) {
+        push(backlog, batch);
+        while (backlog.next(item, 0)) {
+            Received received = decode(item);
+            if (!received.summary) sent.push_back(received.batch);
+            backlog.complete(item, true);
+        }
+        CHECK(backlog.get_raw_pending() <= 30);
+    }
+    CHECK(sent.size() == 192);
+    for (size_t i = 0; i < sent.size(); i++) {
+        CHECK(sent[i] == (int)i + 1);
+    }
+    CHECK(backlog.get_evictions() == 0);
+
+    // An acknowledgement still releases whatever is left
+    backlog.acknowledge(backlog.get_session(), item.sequence);
+    CHECK(backlog.get_acknowledgements() == 1);
+    CHECK(backlog.get_raw_pending() == 0);
+}
+
+// The header is fixed width, the CRC-32 covers the body. "123456789" is the standard check input.
+static void test_header() {
+    static UploadBacklog backlog;
+    CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+    const char *body = "123456789";
+    char *data = (char *)malloc(UploadBacklog::HEADER_LEN + strlen(body));
+    memcpy(data + UploadBacklog::HEADER_LEN, body, strlen(body));
+    backlog.push(data, UploadBacklog::HEADER_LEN + strlen(body), batch_window(0, false), 1);
+    UploadItem item;
+    CHECK(backlog.next(item, 0));
+    CHECK(UploadBacklog::HEADER_LEN == 49);
+    CHECK(item.len == UploadBacklog::HEADER_LEN + strlen(body) && item.sequence == 0);
+    char expected[64];
+    int len = snprintf(expected, sizeof(expected), "#batch,a0b1c2d3e4f5,%08lx,0000000000,cbf43926\n",
+                       (unsigned long)backlog.get_session());
+    CHECK(len == (int)UploadBacklog::HEADER_LEN);
+    CHECK(memcmp(item.data, expected, UploadBacklog::HEADER_LEN) == 0);
+    CHECK(memcmp(item.data + UploadBacklog::HEADER_LEN, body, strlen(body)) == 0);
+    backlog.complete(item, true);
+    backlog.acknowledge(backlog.get_session(), item.sequence);
+
+    // The sequence is ten decimal digits and the CRC follows the body
+    push(backlog, 7);
+    CHECK(backlog.next(item, 0));
+    std::string text(item.data, item.len);
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)"raw,7\n", 6);
+    snprintf(expected, sizeof(expected), "#batch,a0b1c2d3e4f5,%08lx,0000000001,%08lx\nraw,7\n",
+             (unsigned long)backlog.get_session(), (unsigned long)crc);
+    CHECK(text == expected);
+    backlog.complete(item, true);
+}
+
+// An acknowledgement from an earlier session, e.g. for the sequence numbers before a reboot, releases nothing
+static void test_stale_session() {
+    static UploadBacklog backlog;
+    CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+    UploadItem item;
+    push(backlog, 0);
+    CHECK(backlog.next(item, 0));
+    backlog.complete(item, true);
+    backlog.acknowledge(backlog.get_session() + 1, item.sequence);
+    CHECK(backlog.get_raw_pending() == 1);
+    CHECK(backlog.get_acknowledgements() == 0 && backlog.get_acknowledged_config() == 0);
+    backlog.acknowledge(backlog.get_session(), item.sequence);
+    CHECK(backlog.get_raw_pending() == 0);
+    CHECK(backlog.get_acknowledgements() == 1 && backlog.get_acknowledged_config() == 1);
+}
+
+// Without an acknowledgement only the oldest sent document is resent, once per timeout, with its sequence.
+// An acknowledgement that arrives while a document is being sent leaves its buffer to the uploader.
+static void test_resend() {
+    static UploadBacklog backlog;
+    CHECK(backlog.init(DEVICE_ID) == ESP_OK);
+    UploadItem item;
+    for (int batch = 0; batch < 3; batch++) {
+        push(backlog, batch);
+        CHECK(backlog.next(item, 0));
+        CHECK(decode(item).batch == batch && item.sequence == (uint32_t)batch);
+        backlog.complete(item, true);
+    }
+    CHECK(!backlog.next(item, 0));
+    CHECK(backlog.get_resends() == 0);
+
+    host_advance_ticks(pdMS_TO_TICKS(ACK_TIMEOUT_MS) + 1);
+    CHECK(backlog.next(item, 0));
+    CHECK(decode(item).batch == 0 && item.sequence == 0);
+    CHECK(backlog.get_resends() == 1);
+    // The other two are overdue as well, but the acknowledgement for the first covers what the server has
+    CHECK(!backlog.next(item, 0));
+
+    // Acknowledged up to 1 while 0 is still in flight: 1 is released, 0 stays readable until complete()
+    backlog.acknowledge(backlog.get_session(), 1);
+    CHECK(backlog.get_raw_pending() == 2);
+    CHECK(decode(item).batch == 0);
+    backlog.complete(item, true);
+    CHECK(backlog.get_raw_pending() == 1);
+
+    // 2 went out before the timeout as well, it is now the oldest and resent right away
+    CHECK(backlog.next(item, 0));
+    CHECK(decode(item).batch == 2 && item.sequence == 2);
+    CHECK(backlog.get_resends() == 2);
+    backlog.acknowledge(backlog.get_session(), 2);
+    backlog.complete(item, false);
+    CHECK(backlog.get_raw_pending() == 0);
+    CHECK(!backlog.next(item, 0));
+}
+
+int main() {
+    test_window_summary();
+    test_outage();
+    test_eviction();
+    test_unacknowledged();
+    test_header();
+    test_stale_session();
+    test_resend();
+    return host_test_result();
+}
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Receive the wired capture stream (CONFIG_SENSOR_CAPTURE_MODE) and write it to files.
+
+Frames are resynchronised on the A5 5A marker and checked with CRC-16/CCITT-FALSE. Valid frames are
+appended to <prefix>.bin as-is and decoded into <prefix>.csv. Sample frames carry only the channels in
+the device's channel mask (CONFIG_SENSOR_CAPTURE_CHANNEL_MASK); schema frames announce the mask and the
+ranges, and until the first one arrives the command line values are used. Disabled channels are left
+empty. Gaps in the sequence numbers are counted as dropped frames, whether they were lost on the device
+(sample ring overrun, UART backpressure) or on the wire (CRC failure). Samples the device failed to read
+over I2C are kept with empty readings and counted as flagged.
+
+Requires pyserial:  pip install pyserial
+"""
+
+import argparse
+import binascii
+import struct
+import sys
+import time
+
+SYNC = b"\xa5\x5a"
+HEADER_SIZE = 4
+CRC_SIZE = 2
+SAMPLE_FORMAT = "<Iq"
+POSITION_FORMAT = "<ii"
+FRAME_SAMPLE = 0x01
+FRAME_SCHEMA = 0x02
+FRAME_TYPE_MASK = 0x0F
+FLAG_I2C_ERROR = 0x01
+FLAG_RECOVERED = 0x02
+NO_FIX = -(2**31)
+EARTH_GRAVITY = 9.80665
+
+
+class Stats:
+    def __init__(self):
+        self.frames = 0
+        self.dropped = 0
+        self.crc_errors = 0
+        self.resyncs = 0
+        self.flagged = 0
+        self.recovered = 0
+        self.mismatched = 0
+        self.last_sequence = None
+        self.started = time.monotonic()
+
+    def report(self):
+        elapsed = max(time.monotonic() - self.started, 1e-6)
+        expected = self.frames + self.dropped
+        loss = 100.0 * self.dropped / expected if expected else 0.0
+        return (f"frames={self.frames} rate={self.frames / elapsed:.0f}/s dropped={self.dropped} ({loss:.3f}%) "
+                f"flagged={self.flagged} recovered={self.recovered} mismatched={self.mismatched} crc_errors={self.crc_errors} resyncs={self.resyncs}")
+
+
+def unpack_channels(words, mask):
+    """Spreads the big-endian words of the enabled channels over the 7 register words, None if disabled."""
+    values = [None] * 7
+    packed = iter(struct.unpack(f">{len(words) // 2}h", words))
+    for channel in range(7):
+        if mask & (1 << channel):
+            values[channel] = next(packed)
+    return values
+
+
+def decode_raw(values, accel_range, gyro_range):
+    accel_scale = EARTH_GRAVITY / (2048.0 * (1 << (3 - accel_range)))
+    gyro_scale = 1.0 / (16.4 * (1 << (3 - gyro_range)))
+    accel = [None if v is None else v * accel_scale for v in values[0:3]]
+    temperature = None if values[3] is None else values[3] / 340.0 + 36.53
+    gyro = [None if v is None else v * gyro_scale for v in values[4:7]]
+    return accel, temperature, gyro
+
+
+def field(value, digits):
+    return "" if value is None else f"{value:.{digits}f}"
+
+
+def frames(stream, stats):
+    buffer = bytearray()
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            continue
+        buffer += chunk
+        while len(buffer) >= HEADER_SIZE + CRC_SIZE:
+            start = buffer.find(SYNC)
+            if start < 0:
+                del buffer[:-1]
+                break
+            if start > 0:
+                stats.resyncs += 1
+                del buffer[:start]
+                continue
+            size = HEADER_SIZE + buffer[3] + CRC_SIZE
+            if len(buffer) < size:
+                break
+            frame = bytes(buffer[:size])
+            frame_type = frame[2]
+            (crc,) = struct.unpack("<H", frame[-CRC_SIZE:])
+            if binascii.crc_hqx(frame[2:-CRC_SIZE], 0xFFFF) != crc or \
+                    (frame_type & FRAME_TYPE_MASK) not in (FRAME_SAMPLE, FRAME_SCHEMA):
+                stats.crc_errors += 1
+                del buffer[:1]
+                continue
+            del buffer[:size]
+            yield frame, frame_type, frame[HEADER_SIZE:-CRC_SIZE]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port, e.g. /dev/ttyUSB0")
+    parser.add_argument("-b", "--baud", type=int, default=921600)
+    parser.add_argument("-o", "--output", default="capture", help="output file prefix")
+    parser.add_argument("--channels", type=lambda v: int(v, 0), default=0x77,
+                        help="channel mask until the first schema frame")
+    parser.add_argument("--accel-range", type=int, default=2, choices=range(4))
+    parser.add_argument("--gyro-range", type=int, default=0, choices=range(4))
+    parser.add_argument("--report-interval", type=float, default=5.0, help="seconds between progress reports")
+    args = parser.parse_args()
+
+    import serial
+
+    stats = Stats()
+    next_report = time.monotonic() + args.report_interval
+    with serial.Serial(args.port, args.baud, timeout=0.1) as port, \
+            open(f"{args.output}.bin", "wb") as raw_file, open(f"{args.output}.csv", "w") as csv_file:
+        csv_file.write("sequence,timestamp_us,ax,ay,az,temperature,gx,gy,gz,latitude,longitude,flags\n")
+        mask, accel_range, gyro_range = args.channels, args.accel_range, args.gyro_range
+        try:
+            for frame, frame_type, payload in frames(port, stats):
+                raw_file.write(frame)
+                if frame_type & FRAME_TYPE_MASK == FRAME_SCHEMA:
+                    mask, accel_range, gyro_range = payload[0], payload[1], payload[2]
+                    continue
+                words_len = len(payload) - struct.calcsize(SAMPLE_FORMAT) - struct.calcsize(POSITION_FORMAT)
+                if words_len != 2 * bin(mask).count("1"):
+                    # The schema frame announcing this mask was lost, wait for the next one
+                    stats.mismatched += 1
+                    continue
+                sequence, timestamp_us = struct.unpack_from(SAMPLE_FORMAT, payload)
+                latitude, longitude = struct.unpack_from(POSITION_FORMAT, payload, len(payload) - 8)
+                if stats.last_sequence is not None:
+                    gap = (sequence - stats.last_sequence - 1) & 0xFFFFFFFF
+                    # A huge gap means the device rebooted rather than dropped frames
+                    stats.dropped += gap if gap < 0x80000000 else 0
+                stats.last_sequence = sequence
+                stats.frames += 1
+                flags = frame_type >> 4
+                position = ("", "") if latitude == NO_FIX else (f"{latitude / 1e7:.7f}", f"{longitude / 1e7:.7f}")
+                if flags & FLAG_RECOVERED:
+                    stats.recovered += 1
+                if flags & FLAG_I2C_ERROR:
+                    stats.flagged += 1
+                    readings = ",,,,,,"
+                else:
+                    words = payload[struct.calcsize(SAMPLE_FORMAT):struct.calcsize(SAMPLE_FORMAT) + words_len]
+                    accel, temperature, gyro = decode_raw(unpack_channels(words, mask), accel_range, gyro_range)
+                    readings = ",".join([field(v, 5) for v in accel] + [field(temperature, 2)] +
+                                        [field(v, 4) for v in gyro])
+                csv_file.write(f"{sequence},{timestamp_us},{readings},{position[0]},{position[1]},{flags}\n")
+                if time.monotonic() >= next_report:
+                    print(stats.report(), file=sys.stderr)
+                    next_report += args.report_interval
+        except KeyboardInterrupt:
+            pass
+    print(stats.report())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+"""Local stand-in for the MQTT broker and backend used by the MQTT transport (main/transport.h).
+
+A minimal MQTT 3.1.1 broker without TLS or authentication: CONNECT, PUBLISH with QoS 0 and 1, SUBSCRIBE,
+UNSUBSCRIBE, PINGREQ and DISCONNECT. Subscribers are always served with QoS 0, and retained messages and
+sessions are not kept.
+
+It also plays the backend: documents published on <prefix>/<device>/data are checked and stored like
+upload_server.py does, and the acknowledgement (or the --config document) is published on
+<prefix>/<device>/cmd.
+
+Point MQTT_URI at mqtt://<host>:<port> (the device uses TLS unless the URI says mqtt).
+"""
+
+import argparse
+import json
+import os
+import socketserver
+import struct
+import threading
+import zlib
+
+from upload_server import HEADER_LEN, HEADER_PATTERN, UploadState
+
+CONNECT, CONNACK, PUBLISH, PUBACK = 1, 2, 3, 4
+SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK = 8, 9, 10, 11
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+
+def read_packet(rfile):
+    """Returns (packet type, flags, body), or None when the connection is closed."""
+    first = rfile.read(1)
+    if not first:
+        return None
+    length, multiplier = 0, 1
+    while True:
+        byte = rfile.read(1)
+        if not byte:
+            return None
+        length += (byte[0] & 0x7F) * multiplier
+        if not byte[0] & 0x80:
+            break
+        multiplier *= 128
+        if multiplier > 128 ** 3:
+            return None
+    body = rfile.read(length)
+    if len(body) < length:
+        return None
+    return first[0] >> 4, first[0] & 0x0F, body
+
+
+def encode_packet(packet_type, flags, body):
+    length, encoded = len(body), bytearray()
+    while True:
+        byte, length = length % 128, length // 128
+        encoded.append(byte | (0x80 if length else 0))
+        if not length:
+            break
+    return bytes([packet_type << 4 | flags]) + bytes(encoded) + body
+
+
+def encode_string(value):
+    data = value.encode()
+    return struct.pack(">H", len(data)) + data
+
+
+def decode_string(body, offset):
+    (length,) = struct.unpack_from(">H", body, offset)
+    return body[offset + 2:offset + 2 + length].decode(), offset + 2 + length
+
+
+def topic_matches(topic_filter, topic):
+    filter_levels, topic_levels = topic_filter.split("/"), topic.split("/")
+    for i, level in enumerate(filter_levels):
+        if level == "#":
+            return True
+        if i >= len(topic_levels) or (level != "+" and level != topic_levels[i]):
+            return False
+    return len(filter_levels) == len(topic_levels)
+
+
+class Broker:
+    def __init__(self, state):
+        self.lock = threading.Lock()
+        self.state = state
+        self.subscriptions = {}  # client handler -> set of topic filters
+
+    def subscribe(self, client, topic_filter):
+        with self.lock:
+            self.subscriptions.setdefault(client, set()).add(topic_filter)
+
+    def unsubscribe(self, client, topic_filter=None):
+        with self.lock:
+            if topic_filter is None:
+                self.subscriptions.pop(client, None)
+            else:
+                self.subscriptions.get(client, set()).discard(topic_filter)
+
+    def publish(self, topic, payload):
+        packet = encode_packet(PUBLISH, 0, encode_string(topic) + payload)
+        with self.lock:
+            clients = [client for client, filters in self.subscriptions.items()
+                       if any(topic_matches(f, topic) for f in filters)]
+        for client in clients:
+            client.send(packet)
+
+    def receive(self, topic, payload):
+        levels = topic.split("/")
+        if len(levels) < 3 or levels[-1] != "data":
+            return
+        with self.state.lock:
+            self.state.stats["requests"] += 1
+            self.state.stats["bytes_received"] += len(payload)
+        command_topic = "/".join(levels[:-1] + ["cmd"])
+        match = HEADER_PATTERN.match(payload)
+        if not match:
+            self.publish(command_topic, json.dumps({"error": "missing #batch header"}).encode())
+            return
+        device, session, sequence, crc = match.groups()
+        if zlib.crc32(payload[HEADER_LEN:]) != int(crc, 16):
+            with self.state.lock:
+                self.state.stats["crc_errors"] += 1
+            self.publish(command_topic, json.dumps({"error": "crc mismatch"}).encode())
+            return
+        contiguous = self.state.store(device.decode(), session.decode(), int(sequence), payload)
+        response = self.state.take_config(payload)
+        if response is None:
+            response = {"session": session.decode()}
+            if contiguous >= 0:
+                response["ack"] = contiguous
+        self.publish(command_topic, json.dumps(response).encode())
+
+
+class ClientHandler(socketserver.StreamRequestHandler):
+    disable_nagle_algorithm = True
+
+    def send(self, packet):
+        with self.send_lock:
+            try:
+                self.wfile.write(packet)
+            except OSError:
+                pass
+
+    def handle(self):
+        broker = self.server.broker
+        self.send_lock = threading.Lock()
+        try:
+            packet = read_packet(self.rfile)
+            if packet is None or packet[0] != CONNECT:
+                return
+            self.send(encode_packet(CONNACK, 0, b"\x00\x00"))
+            while True:
+                packet = read_packet(self.rfile)
+                if packet is None:
+                    return
+                packet_type, flags, body = packet
+                if packet_type == PUBLISH:
+                    topic, offset = decode_string(body, 0)
+                    qos = flags >> 1 & 0x03
+                    if qos > 0:
+                        packet_id = body[offset:offset + 2]
+                        offset += 2
+                        self.send(encode_packet(PUBACK, 0, packet_id))
+                    broker.receive(topic, body[offset:])
+                elif packet_type == SUBSCRIBE:
+                    packet_id, offset, granted = body[:2], 2, bytearray()
+                    while offset < len(body):
+                        topic_filter, offset = decode_string(body, offset)
+                        offset += 1
+                        broker.subscribe(self, topic_filter)
+                        granted.append(0)
+                    self.send(encode_packet(SUBACK, 0, packet_id + bytes(granted)))
+                elif packet_type == UNSUBSCRIBE:
+                    offset = 2
+                    while offset < len(body):
+                        topic_filter, offset = decode_string(body, offset)
+                        broker.unsubscribe(self, topic_filter)
+                    self.send(encode_packet(UNSUBACK, 0, body[:2]))
+                elif packet_type == PINGREQ:
+                    self.send(encode_packet(PINGRESP, 0, b""))
+                elif packet_type == DISCONNECT:
+                    return
+        finally:
+            broker.unsubscribe(self)
+
+
+class BrokerServer(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, address, broker):
+        super().__init__(address, ClientHandler)
+        self.broker = broker
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--output", help="directory to store the received documents in")
+    parser.add_argument("--config", help="config document to send once in place of an acknowledgement")
+    args = parser.parse_args()
+
+    config = None
+    if args.config:
+        with open(args.config) as f:
+            config = json.load(f)
+        if not isinstance(config.get("config_version"), int):
+            parser.error("the config document needs an integer config_version")
+
+    if args.output:
+        os.makedirs(args.output, exist_ok=True)
+    state = UploadState(args.output, config)
+    server = BrokerServer((args.host, args.port), Broker(state))
+    print(f"Listening on {args.host}:{args.port}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(json.dumps(state.report(), indent=2))
+
+
+if __name__ == "__main__":
+    main()
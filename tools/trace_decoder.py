@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Decode trace records dumped by trace_dump() (components/trace).
+
+Reads a console log (e.g. saved from `idf.py monitor`) containing "TRACE,<core>,<hex>" lines and prints
+the records in time order, formatted with the strings from components/trace/include/trace_events.h.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD_FORMAT = "<IHBB4I"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+DEFAULT_EVENTS = os.path.join(os.path.dirname(__file__), "..", "components", "trace", "include", "trace_events.h")
+LINE_PATTERN = re.compile(r"TRACE,(\d+),([0-9a-f]{%d})" % (RECORD_SIZE * 2))
+
+
+def load_events(path):
+    with open(path) as f:
+        source = f.read()
+    return [(name, fmt) for name, fmt in re.findall(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', source)]
+
+
+def format_event(fmt, args):
+    # Arguments are stored as uint32_t, reinterpret them for signed conversions
+    values = []
+    specs = re.findall(r"%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l|z)?([diouxXcs])", fmt)
+    for spec, value in zip(specs, args):
+        values.append(value - (1 << 32) if spec in "di" and value >= 1 << 31 else value)
+    python_fmt = re.sub(r"%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z)?([diouxXcs])", r"%\1\2", fmt).replace("%u", "%d")
+    try:
+        return python_fmt % tuple(values)
+    except (TypeError, ValueError):
+        return f"{fmt} {args}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("log", nargs="?", help="console log, stdin if omitted")
+    parser.add_argument("--events", default=DEFAULT_EVENTS, help="path to trace_events.h")
+    args = parser.parse_args()
+
+    events = load_events(args.events)
+    records = []
+    with open(args.log) if args.log else sys.stdin as f:
+        for line in f:
+            match = LINE_PATTERN.search(line)
+            if not match:
+                continue
+            timestamp, event, level, argc, *values = struct.unpack(RECORD_FORMAT, bytes.fromhex(match.group(2)))
+            records.append((timestamp, int(match.group(1)), event, level, values[:min(argc, 4)]))
+
+    # The timestamp is the low 32 bits of esp_timer, so order within a 71 minute window
+    records.sort()
+    for timestamp, core, event, level, values in records:
+        if event < len(events):
+            name, fmt = events[event]
+            text = format_event(fmt, values)
+        else:
+            name, text = f"EVENT_{event}", " ".join(f"{v:#x}" for v in values)
+        print(f"{timestamp / 1e6:12.6f} core{core} {LEVELS.get(level, '?')} {name}: {text}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Build the track-segment index blob consumed by components/track_index.
+
+Input is a GeoJSON FeatureCollection of LineString (or MultiLineString) features, one per
+track line. Each feature needs an integer `line_id` property and may set `start_chainage_m`
+(default 0). Chainage is accumulated along the line from its first vertex.
+
+Flash the result into the `track` partition with:
+    parttool.py write_partition --partition-name track --input track_index.bin
+"""
+
+import argparse
+import json
+import math
+import struct
+import sys
+
+MAGIC = 0x494B5254  # "TRKI"
+VERSION = 1
+HEADER_FORMAT = "<IHHiiiHHIIIIIf"
+SEGMENT_FORMAT = "<iiiiIHH"
+METRES_PER_DEGREE = 111319.49
+
+
+def to_e7(value):
+    return int(round(value * 1e7))
+
+
+def segment_length_m(lat0, lon0, lat1, lon1):
+    x_scale = math.cos(math.radians((lat0 + lat1) / 2))
+    dx = (lon1 - lon0) * x_scale * METRES_PER_DEGREE
+    dy = (lat1 - lat0) * METRES_PER_DEGREE
+    return math.hypot(dx, dy)
+
+
+def load_segments(path):
+    with open(path) as f:
+        collection = json.load(f)
+    segments = []
+    for feature in collection["features"]:
+        properties = feature.get("properties") or {}
+        line_id = int(properties["line_id"])
+        geometry = feature["geometry"]
+        if geometry["type"] == "LineString":
+            parts = [geometry["coordinates"]]
+        elif geometry["type"] == "MultiLineString":
+            parts = geometry["coordinates"]
+        else:
+            continue
+        chainage = float(properties.get("start_chainage_m", 0.0))
+        for coordinates in parts:
+            for (lon0, lat0, *_), (lon1, lat1, *_) in zip(coordinates, coordinates[1:]):
+                segments.append((lat0, lon0, lat1, lon1, chainage, line_id))
+                chainage += segment_length_m(lat0, lon0, lat1, lon1)
+    return segments
+
+
+def build(segments, cell_size_deg, max_distance_m):
+    margin_lat = max_distance_m / METRES_PER_DEGREE
+    min_lat = min(min(s[0], s[2]) for s in segments) - margin_lat
+    max_lat = max(max(s[0], s[2]) for s in segments) + margin_lat
+    margin_lon = max_distance_m / (METRES_PER_DEGREE * math.cos(math.radians(max(abs(min_lat), abs(max_lat)))))
+    min_lon = min(min(s[1], s[3]) for s in segments) - margin_lon
+    max_lon = max(max(s[1], s[3]) for s in segments) + margin_lon
+
+    cell_size = to_e7(cell_size_deg)
+    origin_lat, origin_lon = to_e7(min_lat), to_e7(min_lon)
+    rows = (to_e7(max_lat) - origin_lat) // cell_size + 1
+    cols = (to_e7(max_lon) - origin_lon) // cell_size + 1
+    if rows > 0xFFFF or cols > 0xFFFF:
+        sys.exit(f"Grid of {cols}x{rows} cells is too large, increase --cell-size")
+
+    # Register each segment in every cell its bounding box (grown by max_distance_m) touches,
+    # so the firmware only has to scan the single cell containing the query point
+    cells = [[] for _ in range(rows * cols)]
+    for index, (lat0, lon0, lat1, lon1, _, _) in enumerate(segments):
+        r0 = (to_e7(min(lat0, lat1) - margin_lat) - origin_lat) // cell_size
+        r1 = (to_e7(max(lat0, lat1) + margin_lat) - origin_lat) // cell_size
+        c0 = (to_e7(min(lon0, lon1) - margin_lon) - origin_lon) // cell_size
+        c1 = (to_e7(max(lon0, lon1) + margin_lon) - origin_lon) // cell_size
+        for row in range(max(r0, 0), min(r1, rows - 1) + 1):
+            for col in range(max(c0, 0), min(c1, cols - 1) + 1):
+                cells[row * cols + col].append(index)
+
+    segment_blob = b"".join(
+        struct.pack(SEGMENT_FORMAT, to_e7(lat0), to_e7(lon0), to_e7(lat1), to_e7(lon1),
+                    int(round(chainage * 100)), line_id, 0)
+        for lat0, lon0, lat1, lon1, chainage, line_id in segments)
+    starts, entries = [], []
+    for cell in cells:
+        starts.append(len(entries))
+        entries.extend(cell)
+    starts.append(len(entries))
+    cell_blob = struct.pack(f"<{len(starts)}I", *starts)
+    entry_blob = struct.pack(f"<{len(entries)}I", *entries)
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    segments_offset = header_size
+    cells_offset = segments_offset + len(segment_blob)
+    entries_offset = cells_offset + len(cell_blob)
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, header_size, origin_lat, origin_lon, cell_size, cols, rows,
+                         len(segments), len(entries), segments_offset, cells_offset, entries_offset, max_distance_m)
+    blob = header + segment_blob + cell_blob + entry_blob
+
+    occupied = [len(cell) for cell in cells if cell]
+    report = {
+        "segments": len(segments),
+        "grid": f"{cols}x{rows}",
+        "header bytes": len(header),
+        "segment bytes": len(segment_blob),
+        "cell table bytes": len(cell_blob),
+        "entry bytes": len(entry_blob),
+        "total bytes": len(blob),
+        "occupied cells": len(occupied),
+        "max segments per cell": max(occupied, default=0),
+        "mean segments per occupied cell": round(sum(occupied) / len(occupied), 2) if occupied else 0,
+    }
+    return blob, report
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("geojson", help="track network as a GeoJSON FeatureCollection")
+    parser.add_argument("-o", "--output", default="track_index.bin")
+    parser.add_argument("--cell-size", type=float, default=0.005, help="grid cell edge in degrees")
+    parser.add_argument("--max-distance", type=float, default=50.0, help="maximum match distance in metres")
+    parser.add_argument("--partition-size", type=lambda v: int(v, 0), default=0x80000,
+                        help="size of the track partition, used for the footprint report")
+    args = parser.parse_args()
+
+    segments = load_segments(args.geojson)
+    if not segments:
+        sys.exit("No line segments found")
+    blob, report = build(segments, args.cell_size, args.max_distance)
+    with open(args.output, "wb") as f:
+        f.write(blob)
+
+    for key, value in report.items():
+        print(f"{key:>32}: {value}")
+    print(f"{'partition usage':>32}: {100 * len(blob) / args.partition_size:.1f}%")
+    if len(blob) > args.partition_size:
+        sys.exit("Index does not fit into the partition")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+"""Compare the HTTP and MQTT upload transports (main/transport.h) against the local stand-ins.
+
+Starts upload_server.py and mqtt_broker.py in-process on loopback and sends the same #batch documents
+through both, the way the device does:
+  http            one POST per document on a new connection, like HttpTransport
+  mqtt            QoS 1 publish, waiting for the server's acknowledgement on the command topic before
+                  the next document
+  mqtt pipelined  QoS 1 publishes back to back, as vUpload does since send_batch() returns once the publish
+                  is queued; the acknowledgements are collected as they arrive
+
+Reports documents per second, the latency until the server's acknowledgement, and the protocol bytes per
+document on top of the document itself (both directions, application layer; TCP/IP headers, the TCP
+handshake of each HTTP request and TLS are not included). Exits non-zero if a document is not
+acknowledged.
+"""
+
+import argparse
+import http.server
+import json
+import random
+import socket
+import statistics
+import struct
+import threading
+import time
+import zlib
+
+import mqtt_broker
+import upload_server
+
+DEVICE_ID = "a0b1c2d3e4f5"
+TOPIC_PREFIX = "evr"
+TIMEOUT_S = 10.0
+
+
+def make_documents(count, lines, seed, session):
+    """#batch documents with a body shaped like the encoder's CSV output."""
+    rng = random.Random(seed)
+    documents = []
+    for sequence in range(count):
+        rows = [f"#config,1\n#schema,time,ax,ay,az,lat,lon,speed,flags\n"]
+        for i in range(lines):
+            rows.append(f"{1700000000000 + sequence * lines * 5 + i * 5},{rng.uniform(-2, 2):.3f},"
+                        f"{rng.uniform(-2, 2):.3f},{rng.uniform(8, 11):.3f},60.1699{rng.randrange(100):02d},"
+                        f"24.9384{rng.randrange(100):02d},{rng.uniform(10, 25):.1f},\n")
+        body = "".join(rows).encode()
+        header = f"#batch,{DEVICE_ID},{session:08x},{sequence:010d},{zlib.crc32(body):08x}\n".encode()
+        documents.append(header + body)
+    return documents
+
+
+class CountingSocket:
+    """Socket wrapper counting application bytes in both directions."""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.sent = 0
+        self.received = 0
+
+    def sendall(self, data):
+        self.sock.sendall(data)
+        self.sent += len(data)
+
+    def recv_exact(self, length):
+        data = bytearray()
+        while len(data) < length:
+            chunk = self.sock.recv(length - len(data))
+            if not chunk:
+                raise ConnectionError("connection closed")
+            data += chunk
+        self.received += len(data)
+        return bytes(data)
+
+    def recv_until(self, marker):
+        data = bytearray()
+        while not data.endswith(marker):
+            chunk = self.sock.recv(1)
+            if not chunk:
+                raise ConnectionError("connection closed")
+            data += chunk
+        self.received += len(data)
+        return bytes(data)
+
+
+def run_http(port, documents):
+    latencies, overhead, acknowledged = [], 0, 0
+    start = time.perf_counter()
+    for sequence, document in enumerate(documents):
+        sent_at = time.perf_counter()
+        with socket.create_connection(("127.0.0.1", port), timeout=TIMEOUT_S) as raw:
+            sock = CountingSocket(raw)
+            # Headers as esp_http_client sends them
+            request = (f"POST /api/upload HTTP/1.1\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n"
+                       f"Host: 127.0.0.1:{port}\r\nContent-Type: application/octet-stream\r\n"
+                       f"Content-Length: {len(document)}\r\n\r\n").encode()
+            sock.sendall(request + document)
+            headers = sock.recv_until(b"\r\n\r\n").decode()
+            length = next(int(line.split(":")[1]) for line in headers.split("\r\n")
+                          if line.lower().startswith("content-length:"))
+            response = json.loads(sock.recv_exact(length))
+        latencies.append(time.perf_counter() - sent_at)
+        if response.get("ack", -1) >= sequence:
+            acknowledged += 1
+        overhead += sock.sent + sock.received - len(document)
+    return len(documents) / (time.perf_counter() - start), latencies, overhead / len(documents), acknowledged
+
+
+class MqttClient:
+    """Just enough MQTT 3.1.1 client to publish documents and collect the acknowledgements."""
+
+    def __init__(self, port):
+        raw = socket.create_connection(("127.0.0.1", port), timeout=TIMEOUT_S)
+        raw.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.sock = CountingSocket(raw)
+        self.rfile = raw.makefile("rb")
+        self.data_topic = f"{TOPIC_PREFIX}/{DEVICE_ID}/data"
+        self.condition = threading.Condition()
+        self.acked = -1
+        self.ack_times = {}
+        self.next_packet_id = 1
+
+        keepalive = 30
+        connect = (mqtt_broker.encode_string("MQTT") + bytes([4, 0x02]) + struct.pack(">H", keepalive)
+                   + mqtt_broker.encode_string(DEVICE_ID))
+        self.send(mqtt_broker.encode_packet(mqtt_broker.CONNECT, 0, connect))
+        assert self.read()[0] == mqtt_broker.CONNACK
+        subscribe = struct.pack(">H", self.take_packet_id()) + mqtt_broker.encode_string(
+            f"{TOPIC_PREFIX}/{DEVICE_ID}/cmd") + b"\x01"
+        self.send(mqtt_broker.encode_packet(mqtt_broker.SUBSCRIBE, 0x02, subscribe))
+        assert self.read()[0] == mqtt_broker.SUBACK
+        self.reader = threading.Thread(target=self.read_loop, daemon=True)
+        self.reader.start()
+
+    def send(self, packet):
+        self.sock.sendall(packet)
+
+    def read(self):
+        packet = mqtt_broker.read_packet(self.rfile)
+        if packet is None:
+            raise ConnectionError("connection closed")
+        self.sock.received += 2 + len(packet[2]) + (len(packet[2]) >= 128) + (len(packet[2]) >= 16384)
+        return packet
+
+    def take_packet_id(self):
+        packet_id = self.next_packet_id
+        self.next_packet_id = self.next_packet_id % 0xFFFF + 1
+        return packet_id
+
+    def read_loop(self):
+        try:
+            while True:
+                packet_type, _, body = self.read()
+                if packet_type != mqtt_broker.PUBLISH:
+                    continue
+                _, offset = mqtt_broker.decode_string(body, 0)
+                ack = json.loads(body[offset:]).get("ack", -1)
+                now = time.perf_counter()
+                with self.condition:
+                    for sequence in range(self.acked + 1, ack + 1):
+                        self.ack_times[sequence] = now
+                    self.acked = max(self.acked, ack)
+                    self.condition.notify_all()
+        except (ConnectionError, OSError, ValueError):
+            pass
+
+    def publish(self, document):
+        body = mqtt_broker.encode_string(self.data_topic) + struct.pack(">H", self.take_packet_id()) + document
+        self.send(mqtt_broker.encode_packet(mqtt_broker.PUBLISH, 0x02, body))
+
+    def wait_acked(self, sequence):
+        with self.condition:
+            return self.condition.wait_for(lambda: self.acked >= sequence, TIMEOUT_S)
+
+    def close(self):
+        self.send(mqtt_broker.encode_packet(mqtt_broker.DISCONNECT, 0, b""))
+        self.sock.sock.close()
+
+
+def run_mqtt(port, documents, pipelined):
+    client = MqttClient(port)
+    setup_bytes = client.sock.sent + client.sock.received
+    sent_at = {}
+    start = time.perf_counter()
+    for sequence, document in enumerate(documents):
+        sent_at[sequence] = time.perf_counter()
+        client.publish(document)
+        if not pipelined:
+            client.wait_acked(sequence)
+    client.wait_acked(len(documents) - 1)
+    elapsed = time.perf_counter() - start
+    with client.condition:
+        latencies = [client.ack_times[s] - sent_at[s] for s in sent_at if s in client.ack_times]
+        acknowledged = len(latencies)
+    # The connection set-up is paid once per connection, not per document
+    overhead = (client.sock.sent + client.sock.received - setup_bytes - sum(map(len, documents))) / len(documents)
+    client.close()
+    return len(documents) / elapsed, latencies, overhead, acknowledged
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--count", type=int, default=1000, help="documents per transport")
+    parser.add_argument("--lines", type=int, default=40, help="sample lines per document")
+    parser.add_argument("--seed", type=int, default=30)
+    args = parser.parse_args()
+
+    # Each run uploads as a new session, the servers would otherwise acknowledge from the previous run
+    runs = [make_documents(args.count, args.lines, args.seed, session) for session in range(3)]
+    http_server = http.server.ThreadingHTTPServer(
+        ("127.0.0.1", 0), upload_server.make_handler(upload_server.UploadState(None, None), 0.0, random.Random()))
+    broker_server = mqtt_broker.BrokerServer(
+        ("127.0.0.1", 0), mqtt_broker.Broker(upload_server.UploadState(None, None)))
+    for server in (http_server, broker_server):
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    results = [
+        ("http", run_http(http_server.server_address[1], runs[0])),
+        ("mqtt", run_mqtt(broker_server.server_address[1], runs[1], False)),
+        ("mqtt pipelined", run_mqtt(broker_server.server_address[1], runs[2], True)),
+    ]
+    http_server.shutdown()
+    broker_server.shutdown()
+
+    size = statistics.mean(map(len, runs[0]))
+    print(f"{args.count} documents of {size:.0f} bytes per transport, loopback without TLS")
+    print(f"{'transport':<16}{'docs/s':>10}{'mean ms':>10}{'p95 ms':>10}{'overhead B':>12}{'acked':>8}")
+    failed = False
+    for name, (rate, latencies, overhead, acknowledged) in results:
+        latencies = sorted(latencies) or [float("nan")]
+        p95 = latencies[min(len(latencies) - 1, int(len(latencies) * 0.95))]
+        print(f"{name:<16}{rate:>10.0f}{statistics.mean(latencies) * 1e3:>10.2f}{p95 * 1e3:>10.2f}"
+              f"{overhead:>12.0f}{acknowledged:>8}")
+        failed |= acknowledged != args.count
+    if failed:
+        raise SystemExit("Not every document was acknowledged")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Local stand-in for the upload endpoint, for testing acknowledged uploads (main/upload_backlog.h).
+
+Accepts POSTs whose body starts with the header line
+    #batch,<device id>,<session>,<sequence>,<crc32>
+checks the CRC-32 of the rest of the body, stores each (device, session, sequence) once and answers
+    {"ack": <highest contiguous sequence>, "session": "<session>"}
+GET requests (the lock poll) are answered with {"locked": false}.
+
+--drop-rate injects connection drops: the request is cut off halfway through the body, or the document
+is stored but the connection is closed before the acknowledgement is sent. The statistics printed on
+exit, and served at /stats, show how many bytes had to be sent again because of them.
+
+--config sends a config document (main/device_config.h) once, in place of the next acknowledgement, unless
+the #config line of the batch shows the device already runs that config_version or a newer one.
+
+Point UPLOAD_URL at http://<host>:<port>/api/upload (the device uses TLS unless the URL says http).
+"""
+
+import argparse
+import http.server
+import json
+import os
+import random
+import re
+import threading
+import zlib
+
+HEADER_PATTERN = re.compile(rb"#batch,([0-9a-f]{12}),([0-9a-f]{8}),(\d{10}),([0-9a-f]{8})\n")
+HEADER_LEN = 49
+CONFIG_PATTERN = re.compile(rb"^#config,(\d+)$", re.MULTILINE)
+
+
+class UploadState:
+    def __init__(self, output, config):
+        self.lock = threading.Lock()
+        self.output = output
+        self.config = config
+        self.config_sent = False
+        self.sessions = {}
+        self.stats = {
+            "requests": 0,
+            "documents": 0,
+            "bytes_received": 0,
+            "bytes_stored": 0,
+            "bytes_duplicate": 0,
+            "bytes_cut_off": 0,
+            "crc_errors": 0,
+            "drops_cut_off": 0,
+            "drops_unacknowledged": 0,
+            "configs_sent": 0,
+        }
+
+    def store(self, device, session, sequence, body):
+        """Returns the highest contiguous sequence held for the session, -1 if there is none."""
+        with self.lock:
+            state = self.sessions.setdefault((device, session), {"received": set(), "contiguous": -1})
+            if sequence in state["received"]:
+                self.stats["bytes_duplicate"] += len(body)
+            else:
+                state["received"].add(sequence)
+                self.stats["documents"] += 1
+                self.stats["bytes_stored"] += len(body)
+                if self.output:
+                    path = os.path.join(self.output, f"{device}_{session}_{sequence:010d}.csv")
+                    with open(path, "wb") as f:
+                        f.write(body[HEADER_LEN:])
+            while state["contiguous"] + 1 in state["received"]:
+                state["contiguous"] += 1
+            return state["contiguous"]
+
+    def take_config(self, body):
+        """Returns the config document if it is due, at most once."""
+        match = CONFIG_PATTERN.search(body)
+        with self.lock:
+            if self.config is None or self.config_sent:
+                return None
+            if match and int(match.group(1)) >= self.config["config_version"]:
+                return None
+            self.config_sent = True
+            self.stats["configs_sent"] += 1
+            return self.config
+
+    def report(self):
+        with self.lock:
+            stats = dict(self.stats)
+        # Everything received beyond the first complete copy of each document
+        stats["bytes_resent"] = stats["bytes_received"] - stats["bytes_stored"]
+        return stats
+
+
+def make_handler(state, drop_rate, rng):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, format, *args):
+            pass
+
+        def send_json(self, status, document):
+            body = json.dumps(document).encode()
+            self.send_response(status)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_GET(self):
+            if self.path == "/stats":
+                self.send_json(200, state.report())
+            else:
+                self.send_json(200, {"locked": False})
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", 0))
+            with state.lock:
+                state.stats["requests"] += 1
+            drop = rng.random() < drop_rate
+            if drop and rng.random() < 0.5:
+                partial = self.rfile.read(length // 2)
+                with state.lock:
+                    state.stats["bytes_received"] += len(partial)
+                    state.stats["bytes_cut_off"] += len(partial)
+                    state.stats["drops_cut_off"] += 1
+                self.close_connection = True
+                return
+            body = self.rfile.read(length)
+            with state.lock:
+                state.stats["bytes_received"] += len(body)
+            match = HEADER_PATTERN.match(body)
+            if not match:
+                self.send_json(400, {"error": "missing #batch header"})
+                return
+            device, session, sequence, crc = match.groups()
+            if zlib.crc32(body[HEADER_LEN:]) != int(crc, 16):
+                with state.lock:
+                    state.stats["crc_errors"] += 1
+                self.send_json(400, {"error": "crc mismatch"})
+                return
+            contiguous = state.store(device.decode(), session.decode(), int(sequence), body)
+            if drop:
+                # Stored, but the device never learns about it
+                with state.lock:
+                    state.stats["drops_unacknowledged"] += 1
+                self.close_connection = True
+                return
+            config = state.take_config(body)
+            if config is not None:
+                self.send_json(200, config)
+                return
+            response = {"session": session.decode()}
+            if contiguous >= 0:
+                response["ack"] = contiguous
+            self.send_json(200, response)
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--drop-rate", type=float, default=0.0, help="fraction of uploads to drop, 0..1")
+    parser.add_argument("--seed", type=int, default=None, help="random seed for reproducible drops")
+    parser.add_argument("--output", help="directory to store the received documents in")
+    parser.add_argument("--config", help="config document to send once in place of an acknowledgement")
+    args = parser.parse_args()
+
+    config = None
+    if args.config:
+        with open(args.config) as f:
+            config = json.load(f)
+        if not isinstance(config.get("config_version"), int):
+            parser.error("the config document needs an integer config_version")
+
+    if args.output:
+        os.makedirs(args.output, exist_ok=True)
+    state = UploadState(args.output, config)
+    server = http.server.ThreadingHTTPServer((args.host, args.port),
+                                             make_handler(state, args.drop_rate, random.Random(args.seed)))
+    print(f"Listening on {args.host}:{args.port}, drop rate {args.drop_rate}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(json.dumps(state.report(), indent=2))
+
+
+if __name__ == "__main__":
+    main()